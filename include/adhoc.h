@@ -0,0 +1,61 @@
+#ifndef ADHOC_H
+#define ADHOC_H
+
+#include "query.h"
+
+#define ADHOC_NAME_SIZE 512
+
+// Keys rows of an ad-hoc query can be grouped by
+#define G_COUNTRY 0
+#define G_YEAR 1
+#define G_FILE 2
+#define G_ALL 3
+#define G_IP 4
+
+// Aggregates of the duration column of a group
+#define AGG_COUNT 0
+#define AGG_SUM 1
+#define AGG_AVG 2
+#define AGG_MIN 3
+#define AGG_MAX 4
+#define AGG_DISTINCT 5
+#define AGG_QUANTILE 6
+
+/**
+* Aggregates of a group of rows, the state of an ad-hoc query holds one
+* for every possible key of the group-by column, or a hash table of them
+* for columns with too many keys to hold them all. Sketch aggregates keep
+* their sketch of the group in sketch, made when the group gets its first
+* row.
+*/
+typedef struct agroup {
+    unsigned long count;
+    unsigned long sum;
+    unsigned int min;
+    unsigned int max;
+    void *sketch;
+} agroup;
+
+// Bytes the groups of queries grouped by ip may take before they are
+// spilled to disk, 0 for no limit
+extern size_t adhoc_budget;
+
+/**
+* Compiles command line aggregation flags into the descriptor of an ad-hoc
+* query. The row kernel of the query is picked for its group key and
+* aggregate, rows are filtered by filter_compile before they reach it.
+*
+* @param group_by Column to group by: country, year, file, all or ip, NULL
+* for file
+* @param agg Aggregate of the duration column: count, sum, avg, min, max or
+* a percentile such as p95, optionally written as max(duration), or
+* distinct(ip) for the number of distinct visitors, NULL for count
+* @param where Conditions rows are filtered by, only used to name the query
+* @param having Condition on the aggregate of a group, such as >1000,
+* NULL for every group
+* @return Pointer to the query descriptor, NULL if a flag is invalid
+*/
+const qdesc *adhoc_compile(char *group_by, char *agg, char *where,
+    char *having);
+
+#endif
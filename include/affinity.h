@@ -0,0 +1,88 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include "helpers.h"
+
+#define AFFINITY_MAX_NODES 64
+#define AFFINITY_SAMPLES 32
+
+/**
+* NUMA node of the host, the cores of it the process may run on
+*/
+typedef struct anode {
+    int id;
+    int ncpus;
+    int *cpus;
+} anode;
+
+// Set when map threads are pinned to cores node by node, with the partials
+// of their files allocated by themselves on their node
+extern int use_numa;
+
+/**
+* Reads the NUMA nodes of the host and the cores of each the process may
+* run on. Hosts without NUMA, or without sysfs, are a single node.
+*
+* @return Number of nodes with cores to run on
+*/
+int affinity_init();
+
+/**
+* Number of nodes workers are placed on, 1 until affinity_init is called
+*
+* @return Number of nodes
+*/
+int affinity_nodes();
+
+/**
+* Finds the node a worker is placed on. Workers are spread over the nodes
+* in turn, worker i running on node i % nodes.
+*
+* @param worker Index of the worker
+* @return Index of the node, in [0, affinity_nodes())
+*/
+int affinity_node(int worker);
+
+/**
+* Pins the calling thread to a core of the node of a worker. Memory the
+* thread touches first is then allocated on its node.
+*
+* @param worker Index of the worker the thread runs as
+* @return 0 on success, negative if the thread could not be pinned
+*/
+int affinity_pin(int worker);
+
+/**
+* Finds the node most of the pages of a data file cached in memory are
+* on, by sampling up to AFFINITY_SAMPLES of its pages
+*
+* @param filename Name of the data file in DATA_DIR
+* @return Index of the node, -1 if none of the sampled pages is cached
+*/
+int affinity_file_node(char *filename);
+
+/**
+* Orders files so each worker's share of them is, where possible, cached
+* on the node the worker runs on. Worker w takes the next counts[w] files
+* of the order, as the parts divide their file lists.
+*
+* @param filenames Names of the data files in DATA_DIR
+* @param nfiles Number of files
+* @param counts Number of files of each worker
+* @param nworkers Number of workers
+* @param order Array of nfiles to store the indices of the files in, in
+* the order the workers take them
+*/
+void affinity_assign(char **filenames, int nfiles, int *counts, int nworkers,
+    int *order);
+
+/**
+* Allocates the query state of a file if it is not allocated yet, called
+* by a pinned worker so it is on its node. Country histograms are
+* allocated by the first count in them, on the worker counting.
+*
+* @param state Pointer to the query state of the file
+*/
+void affinity_alloc(void **state);
+
+#endif
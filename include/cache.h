@@ -0,0 +1,97 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <semaphore.h>
+#include <sys/stat.h>
+
+#include "helpers.h"
+
+#define CACHE_FILENAME "cache"
+#define CACHE_MAGIC 0x3448434143544f4cUL
+#define CACHE_MIN_SLOTS 64
+
+// Seconds between checkpoints of a resumable run
+#define CACHE_CHECKPOINT 30
+
+/**
+* Result cache entry, partials of a data file keyed by its identity.
+* The entry is only valid while inode, size and mtime of the file match.
+*/
+typedef struct centry {
+    char filename[FILENAME_SIZE];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    pinfo partial;
+    chist einfo;
+} centry;
+
+// Set when partials are to be reused between runs
+extern int use_cache;
+
+// Set when files only ever grow, partials of a grown file then cover its
+// start and only the appended tail is mapped
+extern int cache_append;
+
+// Semaphore for cache table access
+extern sem_t mut_cache;
+
+// Seconds between checkpoints of the cache while a run maps files, 0 to
+// only write it once the run is done
+extern unsigned int cache_checkpoint;
+
+/**
+* Loads the result cache from the sidecar directory of DATA_DIR, entries
+* of files that have since been removed or changed are dropped. The cache
+* is only loaded once, later calls keep the entries in memory, which are
+* at least as new as those on disk.
+*/
+void cache_load();
+
+/**
+* Writes the result cache back to the sidecar directory of DATA_DIR
+*/
+void cache_save();
+
+/**
+* Starts writing the result cache every cache_checkpoint seconds from a
+* thread of its own, so a run that dies can resume with the files it had
+* mapped. Map threads only wait for the cache to be copied, not written.
+*/
+void cache_checkpoint_start();
+
+/**
+* Stops the checkpoints of cache_checkpoint_start, waiting for one being
+* written
+*/
+void cache_checkpoint_stop();
+
+/**
+* Looks up cached partials for a data file, fills st with the identity of
+* the file for a following cache_store. With cache_append set, partials of
+* a file that has grown since it was cached are returned as well.
+*
+* @param filepath Path of the data file
+* @param st Pointer to stat struct to store the file identity in
+* @param partial Pointer to pinfo to copy cached partials to
+* @param einfo Country histogram to copy cached counts to
+* @return Number of bytes at the start of the file the copied partials
+* cover, 0 if none of the partials current_query needs were cached
+*/
+off_t cache_lookup(char *filepath, struct stat *st, pinfo *partial,
+    chist *einfo);
+
+/**
+* Stores freshly mapped partials of a data file, merging them with the
+* cached fields of other queries if the file is unchanged
+*
+* @param filepath Path of the data file
+* @param st Identity of the file, st_size being the number of bytes mapped
+* @param partial Pointer to partials to store
+* @param einfo Country histogram to store, only read if P_COUNTRY is set
+*/
+void cache_store(char *filepath, struct stat *st, pinfo *partial,
+    chist *einfo);
+
+#endif
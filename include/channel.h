@@ -0,0 +1,86 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <semaphore.h>
+#include <stddef.h>
+
+// Transports records of a channel travel over
+#define CHAN_MEMORY 0
+#define CHAN_FILE 1
+#define CHAN_SOCKET 2
+
+#define CHAN_CAPACITY 64
+#define CHAN_BATCH 16
+
+/**
+* Bounded channel of fixed size records from any number of senders to one
+* receiver. Senders block while capacity records are waiting, so maps
+* slow down to the pace of their reduce instead of piling up records.
+* Memory and file channels keep records in a ring of capacity slots, in
+* memory or in a file of capacity records. Socket channels send each
+* record as a message of its own.
+*/
+typedef struct channel {
+    int transport;
+    size_t capacity;
+    size_t size;
+    size_t head;
+    size_t tail;
+    char *ring;
+    int fds[2];
+    char *path;
+    sem_t mut, slots, filled;
+} channel;
+
+// Capacity of channels and most records their receivers take at once
+extern size_t chan_capacity, chan_batch;
+
+/**
+* Opens a channel of chan_capacity records
+*
+* @param ch Pointer to channel to open
+* @param transport CHAN_MEMORY, CHAN_FILE or CHAN_SOCKET
+* @param size Size of a record
+* @param path Path of the ring file of a file channel, else NULL
+* @return 0 on success, negative if the file or socket could not be made
+*/
+int chan_open(channel *ch, int transport, size_t size, char *path);
+
+/**
+* Sends a record, waiting while the channel is full. A record that could
+* not be sent fails the run and gives its slot back.
+*
+* @param ch Pointer to channel to send on
+* @param record Record to send, size bytes
+* @return 0 on success, negative if the record could not be sent
+*/
+int chan_send(channel *ch, void *record);
+
+/**
+* Receives the records waiting on a channel, waiting for at least one.
+* Records that could not be read fail the run and are dropped.
+*
+* @param ch Pointer to channel to receive from
+* @param records Array of max records to store them in
+* @param max Most records to receive
+* @return Number of records received, 0 once the channel is closed and
+* every record has been received
+*/
+size_t chan_recv(channel *ch, void *records, size_t max);
+
+/**
+* Closes a channel once every sender is done, its receiver then returns
+* from chan_recv after the last record
+*
+* @param ch Pointer to channel to close
+*/
+void chan_close(channel *ch);
+
+/**
+* Frees a channel, removing the ring file of a file channel
+*
+* @param ch Pointer to channel to free
+*/
+void chan_free(channel *ch);
+
+#endif
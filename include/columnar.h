@@ -0,0 +1,56 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "helpers.h"
+
+#define COL_MAGIC 0x324c4f4354544f4cUL
+#define COL_SUFFIX ".col"
+#define COL_NONE 0xFFFF
+#define COL_MIN_ROWS 1024
+#define COL_BATCH 256
+
+/**
+* Columnar file header. The header is followed by the timestamp column
+* (long), the duration column (unsigned int) and the country index column
+* (unsigned short), each nrows long. Size and mtime of the csv file the
+* columns were converted from are kept to detect stale conversions.
+*/
+typedef struct colheader {
+    unsigned long magic;
+    unsigned long nrows;
+    long ts_min;
+    long ts_max;
+    unsigned int dur_min;
+    unsigned int dur_max;
+    long src_size;
+    long src_mtime_sec;
+    long src_mtime_nsec;
+} colheader;
+
+/**
+* Converts every file in DATA_DIR to a columnar file in its sidecar
+* directory, writing the stats sidecar of each file along the way
+*
+* @param nthreads Number of converting threads
+* @return Number of files converted, negative on error
+*/
+int col_convert(size_t nthreads);
+
+/**
+* Maps a data file from its columnar conversion, if one exists that is
+* as recent as the file
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param partial Pointer to pinfo to store the partials current_query
+* needs in
+* @param einfo Country histogram to add counts to, only written for E
+* @return 1 if the file was mapped from its columns, else 0
+*/
+int col_map(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef COUNTRY_H
+#define COUNTRY_H
+
+#include "helpers.h"
+
+// Fewest slots a country histogram is allocated with
+#define CCOUNT_MIN_SLOTS 16
+
+/**
+* Dictionary of the country codes seen so far. Codes get dense slots in the
+* order they are first seen, country histograms are indexed by slot so the
+* few countries a data set has share the first cache lines of a histogram,
+* and merging or scanning one only goes through the slots it has. Slots
+* only mean anything in the process that made them, histograms kept on
+* disk are lists of cpacked counts of the countries in them, moved to and
+* from slots with country_pack and country_unpack.
+*/
+
+/**
+* Count of a country kept on disk, by the index of its code
+*/
+typedef struct cpacked {
+    unsigned long ind;
+    unsigned long count;
+} cpacked;
+
+// Slot of every country code plus one, 0 for codes not seen yet
+extern short country_slots[CCOUNT_SIZE];
+
+/**
+* Gives a country the next slot, or finds the slot another thread gave it
+*
+* @param ind Index of the country code, from country_index
+* @return Slot of the country in country histograms
+*/
+long country_slot_new(long ind);
+
+/**
+* Finds the slot of a country, giving it the next slot the first time
+*
+* @param ind Index of the country code, from country_index
+* @return Slot of the country in country histograms
+*/
+static inline long country_slot(long ind) {
+    short slot = __atomic_load_n(&country_slots[ind], __ATOMIC_ACQUIRE);
+    return slot != 0 ? slot - 1 : country_slot_new(ind);
+}
+
+/**
+* Finds the number of slots given out, every slot below it is in use
+*
+* @return Number of countries seen
+*/
+long country_count();
+
+/**
+* Writes the code of the country in a slot
+*
+* @param slot Slot of the country
+* @param code Buffer of at least 3 chars to write the terminated code to
+*/
+void country_code(long slot, char *code);
+
+/**
+* Adds to the count of a country in a histogram, growing the histogram
+* to hold the slot the first time
+*
+* @param ccount Pointer to the country histogram
+* @param slot Slot of the country
+* @param n Number to add
+*/
+void country_add(chist *ccount, long slot, unsigned long n);
+
+/**
+* Finds the count of a country in a histogram
+*
+* @param ccount Pointer to the country histogram
+* @param slot Slot of the country
+* @return Count of the country, 0 if the histogram does not hold the slot
+*/
+unsigned long country_get(chist *ccount, long slot);
+
+/**
+* Adds the counts of a histogram to those of another
+*
+* @param dst Pointer to the histogram to add to
+* @param src Pointer to the histogram to add
+*/
+void country_merge(chist *dst, chist *src);
+
+/**
+* Copies a histogram over another, keeping the counts of the other when
+* they are large enough
+*
+* @param dst Pointer to the histogram to copy to
+* @param src Pointer to the histogram to copy
+*/
+void country_copy(chist *dst, chist *src);
+
+/**
+* Frees the counts of a histogram, leaving it empty
+*
+* @param ccount Pointer to the country histogram
+*/
+void country_free(chist *ccount);
+
+/**
+* Finds the country with the highest count in a histogram, ties going to
+* the code first in alphabetical order
+*
+* @param ccount Pointer to the country histogram
+* @return Slot of the country, 0 if no country was seen
+*/
+long country_max(chist *ccount);
+
+/**
+* Moves the countries of a histogram from slots to counts by code, to keep
+* on disk
+*
+* @param ccount Pointer to the country histogram to move from
+* @param packed Array of CCOUNT_SIZE counts to move to
+* @return Number of countries moved, those with counts
+*/
+size_t country_pack(chist *ccount, cpacked *packed);
+
+/**
+* Moves counts by code, read from disk, to a histogram of slots
+*
+* @param packed Array of counts to move from
+* @param n Number of counts
+* @param ccount Pointer to the country histogram to move to, emptied first
+* @return 0 on success, negative if a code is not a country index
+*/
+int country_unpack(cpacked *packed, size_t n, chist *ccount);
+
+#endif
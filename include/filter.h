@@ -0,0 +1,97 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "query.h"
+
+#define FILTER_MAX_PREDS 16
+
+// Comparison operators of conditions
+#define OP_EQ 0
+#define OP_NE 1
+#define OP_LT 2
+#define OP_LE 3
+#define OP_GT 4
+#define OP_GE 5
+
+// Set when rows are filtered by --where conditions. Filtered runs map
+// every file themselves, partials of whole files do not apply to them.
+extern int use_filter;
+
+/**
+* Compiles --where conditions into the row filter. Conditions are sorted by
+* column so rows are rejected on their timestamp before the rest of them is
+* split and parsed.
+*
+* @param where Comma separated conditions on timestamp, duration, country
+* or year, such as year>=2015,country=JP|US, all must hold for a row
+* @return 0 on success, negative if a condition is invalid
+*/
+int filter_compile(char *where);
+
+/**
+* Clears the row filter, so rows of the next run are not filtered unless
+* filter_compile is called again
+*/
+void filter_clear();
+
+/**
+* Parses the comparison operator a string starts with
+*
+* @param str String to parse
+* @param op Pointer to store the OP_* code in
+* @return Length of the operator, 0 if str does not start with one
+*/
+int filter_op(char *str, int *op);
+
+/**
+* Checks the timestamp column of a row against the filter
+*
+* @param timestamp Timestamp column of the row
+* @return 1 if the row may pass the filter, 0 if it is rejected
+*/
+int filter_timestamp(char *timestamp);
+
+/**
+* Checks the columns after the timestamp of a row against the filter
+*
+* @param cols Columns of the row
+* @return 1 if the row passes the filter, else 0
+*/
+int filter_row(char **cols);
+
+/**
+* Checks if rows with timestamps in a range can pass the filter, used to
+* skip files and chunks of rows by their timestamp stats
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @return 1 if some row in the range may pass the filter, else 0
+*/
+int filter_window(long ts_min, long ts_max);
+
+/**
+* Checks if rows with timestamps and durations in ranges can pass the
+* filter, used to skip files by their stats
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @param dur_min Lowest duration of the rows
+* @param dur_max Highest duration of the rows
+* @return 1 if some row in the ranges may pass the filter, else 0
+*/
+int filter_ranges(long ts_min, long ts_max, long dur_min, long dur_max);
+
+/**
+* Checks if every row with timestamps and durations in ranges passes the
+* filter, so partials of all of the rows answer a filtered run. Filters on
+* countries are never answered by ranges.
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @param dur_min Lowest duration of the rows
+* @param dur_max Highest duration of the rows
+* @return 1 if every row in the ranges passes the filter, else 0
+*/
+int filter_covers(long ts_min, long ts_max, long dur_min, long dur_max);
+
+#endif
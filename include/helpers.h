@@ -0,0 +1,56 @@
+#ifndef HELPERS_H
+#define HELPERS_H
+
+#define CCOUNT_SIZE 676
+#define FILENAME_SIZE 256
+
+// Hidden directory in DATA_DIR for files lott keeps about the data files
+#define SIDECAR_DIR ".lott"
+
+// Partial field flags, mark which members of a pinfo hold data
+#define P_DURATION 0x1
+#define P_YEARS 0x2
+#define P_COUNTRY 0x4
+
+/**
+* Per-file partial aggregates, everything the queries need from a file
+* before it is reduced. The country histogram is kept in the einfo
+* histogram of the owning sinfo.
+*/
+typedef struct pinfo {
+    int fields;
+    unsigned long nvisits;
+    unsigned long duration;
+    unsigned long used_years;
+} pinfo;
+
+/**
+* Merges the partials of an earlier part of a file into those of the rest
+* of it. Country histograms are merged in place by the map functions.
+*
+* @param dst Pointer to partials to merge into
+* @param src Pointer to partials to merge from
+*/
+void partial_merge(pinfo *dst, pinfo *src);
+
+/**
+* Country histogram, counts indexed by country slot. Only the slots below
+* size are allocated, a histogram grows as countries are counted in it, so
+* it takes the few countries a data set has rather than all CCOUNT_SIZE
+* codes. A zeroed chist is an empty histogram.
+*/
+typedef struct chist {
+    long size;
+    unsigned long *counts;
+} chist;
+
+/**
+* Turns a country code into its index among the CCOUNT_SIZE two letter
+* codes, AA being 0 and ZZ the last
+*
+* @param code Country code, two capital letters
+* @return Index of the country, -1 if the code is not two capital letters
+*/
+long country_index(char *code);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef HIST_H
+#define HIST_H
+
+#define HIST_BITS 5
+#define HIST_MIN_BITS 1
+#define HIST_MAX_BITS 16
+
+/**
+* Log-linear duration histogram. Durations below 2^bits have a bucket
+* each, every power of two above that is split into 2^(bits - 1) buckets,
+* so a bucket is never wider than 2^(1 - bits) of the durations in it.
+*/
+typedef struct hist {
+    unsigned long count;
+    unsigned int min;
+    unsigned int max;
+    unsigned long *counts;
+} hist;
+
+// Number of buckets of every histogram
+extern unsigned long hist_nbuckets;
+
+/**
+* Sets the precision of histograms
+*
+* @param bits Significant bits of a bucket, from HIST_MIN_BITS to
+* HIST_MAX_BITS
+* @return 0 on success, negative if bits is out of range
+*/
+int hist_config(int bits);
+
+/**
+* Clears a histogram, making its buckets the first time
+*
+* @param h Pointer to the histogram
+*/
+void hist_clear(hist *h);
+
+/**
+* Adds a duration to a histogram
+*
+* @param h Pointer to the histogram
+* @param value Duration to add
+*/
+void hist_add(hist *h, unsigned int value);
+
+/**
+* Merges a histogram into another, adding their buckets
+*
+* @param dst Pointer to histogram to merge into
+* @param src Pointer to histogram to merge from
+*/
+void hist_merge(hist *dst, hist *src);
+
+/**
+* Adds a range of the buckets of a histogram to another, leaving their
+* count, min and max alone
+*
+* @param dst Pointer to histogram to merge into
+* @param src Pointer to histogram to merge from
+* @param lo Index of the first bucket to add
+* @param hi Index past the last bucket to add
+*/
+void hist_merge_buckets(hist *dst, hist *src, unsigned long lo,
+    unsigned long hi);
+
+/**
+* Finds the range of durations of a bucket
+*
+* @param ind Index of the bucket
+* @param lo Pointer to store the lowest duration of the bucket in
+* @param hi Pointer to store the highest duration of the bucket in
+*/
+void hist_bounds(unsigned long ind, unsigned long *lo, unsigned long *hi);
+
+/**
+* Finds the duration at a quantile of a histogram, the highest duration of
+* the bucket it falls in
+*
+* @param h Pointer to the histogram
+* @param q Quantile, from 0 for the lowest duration to 1 for the highest
+* @return Duration at the quantile
+*/
+unsigned long hist_quantile(hist *h, double q);
+
+/**
+* Frees the buckets of a histogram
+*
+* @param h Pointer to the histogram
+*/
+void hist_free(hist *h);
+
+#endif
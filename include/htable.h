@@ -0,0 +1,118 @@
+#ifndef HTABLE_H
+#define HTABLE_H
+
+#include <stddef.h>
+
+// Slots of a group of control bytes, probed at once
+#define HTABLE_GROUP 8
+#define HTABLE_MIN_SLOTS 16
+
+// Longest key kept in its slot, longer keys are copied to the arena
+#define HTABLE_INLINE 16
+
+// Bytes of a chunk of the arena keys are copied to
+#define HTABLE_ARENA_SIZE 65536
+
+/**
+* Key of a slot of a table. Keys of up to HTABLE_INLINE bytes are kept in
+* the slot itself, sparing a probe a load from the arena, longer keys in
+* the arena of the table. htable_key finds the bytes of either.
+*/
+typedef struct hkey {
+    unsigned long hash;
+    unsigned int len;
+    union {
+        char bytes[HTABLE_INLINE];
+        char *key;
+    };
+} hkey;
+
+/**
+* Chunk of the arena of a table, chunks are only freed with the table
+*/
+typedef struct harena {
+    struct harena *next;
+    size_t size;
+    size_t used;
+    char data[];
+} harena;
+
+/**
+* Flat open-addressing hash table of fixed-size values keyed by strings.
+* Slots are probed HTABLE_GROUP at a time by their control bytes, 0x80 for
+* an empty slot or the low 7 bits of the hash of the key in it, so a probe
+* mostly compares 8 bytes at once and only touches slots whose control byte
+* matches. Probes start at any slot, the control bytes of the first group
+* are repeated past the last slot so a group read from near the end wraps
+* around. Each slot holds its hkey followed by the value, stride bytes
+* apart. Keys are never removed, a table only grows until it is cleared.
+* bytes counts the memory of the slots and the arena, not of what values
+* point to.
+*/
+typedef struct htable {
+    unsigned char *ctrl;
+    char *slots;
+    size_t nslots;
+    size_t n;
+    size_t value_size;
+    size_t stride;
+    size_t bytes;
+    harena *arena;
+} htable;
+
+/**
+* Finds the bytes of a key
+*
+* @param key Pointer to the key of a slot
+* @return Pointer to the bytes of the key, not terminated
+*/
+static inline char *htable_key(hkey *key) {
+    return key->len <= HTABLE_INLINE ? key->bytes : key->key;
+}
+
+/**
+* Makes an empty table
+*
+* @param table Pointer to table to initialize
+* @param value_size Size of the value of a key
+*/
+void htable_init(htable *table, size_t value_size);
+
+/**
+* Finds the value of a key, adding the key with a zeroed value if it is not
+* in the table
+*
+* @param table Pointer to table
+* @param key Key, not necessarily terminated
+* @param len Length of the key
+* @param hash Hash of the key, from sketch_hash
+* @return Pointer to the value of the key
+*/
+void *htable_get(htable *table, char *key, size_t len, unsigned long hash);
+
+/**
+* Steps through the keys of a table in slot order
+*
+* @param table Pointer to table
+* @param i Pointer to the slot to start at, 0 for the first, left past the
+* slot returned
+* @param value Pointer to store the value of the key in
+* @return Pointer to the key, NULL once every key has been stepped through
+*/
+hkey *htable_next(htable *table, size_t *i, void **value);
+
+/**
+* Empties a table, keeping its slots and first chunk of arena
+*
+* @param table Pointer to table
+*/
+void htable_clear(htable *table);
+
+/**
+* Frees the slots and arena of a table
+*
+* @param table Pointer to table
+*/
+void htable_free(htable *table);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef LIBLOTT_H
+#define LIBLOTT_H
+
+#include <stddef.h>
+
+/**
+* Embedding interface of lott. A program links bin/liblott.a or
+* bin/liblott.so, opens a context and runs jobs on it, each job described
+* by a lott_job the way a command line describes a run of bin/lott. Rows
+* of results, progress and warnings go to the callbacks of the job. Rows
+* are only printed to stdout when a job has no on_result, and nothing is
+* printed to stderr. Data files are read from DATA_DIR under the working
+* directory.
+*
+* liblott is a serial API, it is not reentrant and does not run jobs
+* concurrently. The engine keeps the state of a run in globals, the query,
+* filter, ad-hoc groups, reduce shards, thread pool and result cache among
+* them, not in the context, so one job runs at a time per process.
+* lott_run may be called from any thread, but a call blocks while the job
+* of another is running. A context only holds the error of its last job.
+* Cached jobs share the result cache, loaded once and saved after each of
+* them.
+*
+* Errors in a job, including data files, channels or spills that could
+* not be read or written, fail the job and are returned by lott_run and
+* described by lott_error; the process goes on. Running out of memory is
+* not recovered from.
+*/
+
+/**
+* Receives a row of the result of a job
+*
+* @param arg Argument of the job
+* @param value Value of the row, such as the average of a file or a count
+* @param name Name of the row, such as the file, country or group
+*/
+typedef void (*lott_result_cb)(void *arg, double value, const char *name);
+
+/**
+* Receives the progress of a job every time a file is done mapping
+*
+* @param arg Argument of the job
+* @param nfiles Number of files done so far
+* @param nrows Number of rows of those files the job counted, those meeting
+* its where conditions
+*/
+typedef void (*lott_progress_cb)(void *arg, unsigned long nfiles,
+    unsigned long nrows);
+
+/**
+* Receives a warning or error of a job, such as a malformed condition or a
+* file that could not be read, without its newline. Called from any thread
+* of the job.
+*
+* @param arg Argument of the job
+* @param message Text of the message
+*/
+typedef void (*lott_log_cb)(void *arg, const char *message);
+
+/**
+* Job run by lott_run. Fields left zero take the defaults of bin/lott.
+* query names a built-in query, A to E, H or T, unless any of group_by,
+* agg or having is set to run an ad-hoc query instead.
+*/
+typedef struct lott_job {
+    char part;
+    const char *query;
+    const char *group_by;
+    const char *agg;
+    const char *where;
+    const char *having;
+    size_t nthreads;
+    size_t top_k;
+    size_t reducers;
+    int cache;
+    lott_result_cb on_result;
+    lott_progress_cb on_progress;
+    lott_log_cb on_log;
+    void *arg;
+} lott_job;
+
+/**
+* Context jobs are run on, holding the error of its last job
+*/
+typedef struct lott_ctx lott_ctx;
+
+/**
+* Opens a context
+*
+* @return Pointer to the context, NULL if it could not be made
+*/
+lott_ctx *lott_open();
+
+/**
+* Runs a job, handing the rows of its result to on_result, or printing
+* them to stdout like bin/lott if it is NULL
+*
+* @param ctx Pointer to the context
+* @param job Pointer to the job to run
+* @return 0 on success, negative on error, described by lott_error
+*/
+int lott_run(lott_ctx *ctx, const lott_job *job);
+
+/**
+* Describes the error of the last job run on a context
+*
+* @param ctx Pointer to the context
+* @return Message of the error, empty if the last job succeeded
+*/
+const char *lott_error(lott_ctx *ctx);
+
+/**
+* Closes a context
+*
+* @param ctx Pointer to the context
+*/
+void lott_close(lott_ctx *ctx);
+
+#endif
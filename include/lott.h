@@ -3,6 +3,7 @@
 #define _GNU_SOURCE
 
 #include <dirent.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,14 +11,45 @@
 #include <errno.h>
 #include <string.h>
 
+#include "query.h"
+
 #define DATA_DIR "data"
 
+// Size of a thread name, the most pthread_setname_np takes with its
+// terminator
+#define THREADNAME_SIZE 16
+
 #define HELP do{ \
                 printf("%s\n", "Lord of the Threads");\
-                printf("%s\n", "bin/lott N QUERY [M]");\
+                printf("%s\n", "bin/lott [OPTIONS] N QUERY [M]");\
+                printf("%s\n", "bin/lott [OPTIONS] --group-by KEY --agg AGG N [M]");\
+                printf("%s\n", "bin/lott convert [M]");\
                 printf("%s\n", "N - Part specification: 1, 2, 3, 4, 5 are valid choices.");\
-                printf("%s\n", "QUERY - The calculation the program is to execute: A, B, C, D or E");\
-                printf("%s\n", "M - Number of threads for parts that take a specified amount");\
+                printf("%s\n", "QUERY - The calculation the program is to execute: A, B, C, D, E, H or T");\
+                printf("%s\n", "M - Number of threads for parts that take a specified amount, auto or left out to size them for the host");\
+                printf("%s\n", "convert - Convert data files to columns queries prefer over csv");\
+                printf("%s\n", "--agg AGG - Aggregate of each group: count, sum, avg, min, max, p50, p99 or distinct");\
+                printf("%s\n", "--batch N - Most results the reduce of parts 3, 4 and 5 takes at once, 16 by default");\
+                printf("%s\n", "--bucket WIDTH - Bucket width of T rollups: hour, day, month or year (UTC)");\
+                printf("%s\n", "-c, --cache - Reuse partials of files unchanged since the last run");\
+                printf("%s\n", "--checkpoint SECS - Write the partials of mapped files every SECS seconds while running, implies -c");\
+                printf("%s\n", "--capacity N - Results maps of parts 3, 4 and 5 may get ahead of their reduce by, 64 by default");\
+                printf("%s\n", "--error E - Relative error of the p and distinct sketches, 0.02 by default");\
+                printf("%s\n", "--format FMT - Write the result as text or json, json streaming JSON Lines of progress while running");\
+                printf("%s\n", "--group-by KEY - Group rows by country, year, file, all or ip, in place of QUERY");\
+                printf("%s\n", "--having COND - Only print groups whose aggregate meets COND, e.g. >1000");\
+                printf("%s\n", "-h, --help - Print this message");\
+                printf("%s\n", "--memory MB - Spill groups by ip to disk past MB megabytes, sorted runs are merged at the report");\
+                printf("%s\n", "--numa - Pin map threads to cores node by node, keeping their partials and files local");\
+                printf("%s\n", "--partials - Write a line for every file mapped with its result, with --format json");\
+                printf("%s\n", "--precision B - Significant bits of the H duration buckets, 5 by default");\
+                printf("%s\n", "--quarantine FILE - Append malformed rows to FILE, they are skipped and counted either way");\
+                printf("%s\n", "--reducers R - Reduce threads the keys of results are hash-partitioned over, 1 by default");\
+                printf("%s\n", "--resume - Skip files mapped before the last checkpoint of a run that died, checkpointing every 30 seconds");\
+                printf("%s\n", "-s, --stats - Write per-file stats later runs answer from without scanning");\
+                printf("%s\n", "--top K - Print the K best results in rank order instead of the best one");\
+                printf("%s\n", "-w, --watch - Rerun whenever DATA_DIR changes, mapping only new data");\
+                printf("%s\n", "--where COND - Only map rows meeting COND, e.g. year>=2015,country=JP|US");\
             }while(0)
 
 #define FOREACH_PART(PART) \
@@ -27,26 +59,16 @@
     PART(PART4)            \
     PART(PART5)
 
-#define FOREACH_QUERY(QUERY) \
-    QUERY(A)               \
-    QUERY(B)               \
-    QUERY(C)               \
-    QUERY(D)               \
-    QUERY(E)
-
 #define GENERATE_ENUM(ENUM) ENUM,
 #define GENERATE_STRING(STRING) #STRING,
 
-enum QUERY_ENUM { FOREACH_QUERY(GENERATE_ENUM) };
-typedef enum QUERY_ENUM Query;
-static const char *QUERY_STRINGS[] = {FOREACH_QUERY(GENERATE_STRING)};
-
 enum PART_ENUM { FOREACH_PART(GENERATE_ENUM) };
 typedef enum PART_ENUM Part;
-static const char *PART_STRINGS[] = {FOREACH_PART(GENERATE_STRING)};
+static const char *PART_STRINGS[] __attribute__((unused)) = {FOREACH_PART(GENERATE_STRING)};
 
-Query current_query;
-Part current_part;
+// Query and part of the run, defined in query.c and liblott.c
+extern const qdesc *current_query;
+extern Part current_part;
 
 int part1();
 int part2(size_t);
@@ -54,4 +76,13 @@ int part3(size_t);
 int part4(size_t);
 int part5(size_t);
 
+/**
+* Runs a part on current_query, which prints its result
+*
+* @param part Part character, 1 to 5
+* @param nthreads Number of map threads, unused by part 1
+* @return Negative on error, described by query_error if the run failed
+*/
+int lott_part(char part, size_t nthreads);
+
 #endif /* LOTT_H */
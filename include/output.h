@@ -0,0 +1,61 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+// Formats the result of a run is written in
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSON 1
+
+// Least time between progress lines of a json run
+#define OUTPUT_INTERVAL_MS 250
+
+/**
+* Json output is a stream of JSON Lines objects told apart by their type:
+*
+* {"type":"start","part":"3","query":"A","threads":4}
+* {"type":"file","name":"f.csv","value":2494.9,"rows":1500,"elapsed":0.01}
+* {"type":"progress","files":8,"rows":12000,"elapsed":0.25,
+*  "best":{"name":"f.csv","value":2494.9}}
+* {"type":"row","name":"f.csv","value":2494.9}
+* {"type":"done","ok":true,"files":12,"rows":17125,"bad_rows":0,
+*  "elapsed":0.31}
+*
+* A file line is written for every file mapped when output_files is set,
+* with the country of the file for E. Progress lines are written at most
+* every OUTPUT_INTERVAL_MS as files are done, best being the result over
+* the files so far for queries that have one. Rows are those bin/lott
+* prints after Result:, values that are not numbers are written as null.
+* Lines are flushed as they are written.
+*/
+
+// Format of the output, and set when json output has a line for every
+// file mapped
+extern int output_format;
+extern int output_files;
+
+/**
+* Sets the format of the output
+*
+* @param format Name of the format: text or json
+* @return 0 on success, negative if the format is not one of those
+*/
+int output_config(char *format);
+
+/**
+* Starts the output of a run, sending its rows and progress to the json
+* writer. Does nothing for text output, which the parts print themselves.
+*
+* @param part Part character, 1 to 5
+* @param nthreads Number of map threads, unused by part 1
+*/
+void output_start(char part, size_t nthreads);
+
+/**
+* Ends the output of a run started by output_start
+*
+* @param ret Return of the run, negative on error
+*/
+void output_end(int ret);
+
+#endif
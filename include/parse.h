@@ -0,0 +1,104 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <string.h>
+
+/*
+* Decimal parsers of the timestamp and duration columns. Eight digits are
+* converted at a time within a 64-bit word (SWAR), so a 10-digit epoch
+* timestamp takes one word and two digits instead of ten multiply-adds.
+* They are defined here so every map loop inlines them.
+*/
+
+/**
+* Checks eight bytes are all decimal digits
+*
+* @param str Bytes to check, at least eight
+* @return 1 if all are digits, else 0
+*/
+static inline int parse_is_8digits(const char *str) {
+    unsigned long v;
+    memcpy(&v, str, 8);
+    return ((v & 0xF0F0F0F0F0F0F0F0UL) |
+        (((v + 0x0606060606060606UL) & 0xF0F0F0F0F0F0F0F0UL) >> 4)) ==
+        0x3333333333333333UL;
+}
+
+/**
+* Converts eight decimal digits, the first being the most significant
+*
+* @param str Digits to convert
+* @return Value of the digits
+*/
+static inline unsigned int parse_8digits(const char *str) {
+    unsigned long v;
+    memcpy(&v, str, 8);
+
+    // Combine digits into pairs, then pairs into fours, then the halves
+    v -= 0x3030303030303030UL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFUL) * (100 + (1000000UL << 32))) +
+        (((v >> 16) & 0x000000FF000000FFUL) * (1 + (10000UL << 32)))) >> 32;
+    return v;
+}
+
+/**
+* Converts up to 19 decimal digits, eight at a time while there are eight
+* left. Short tails such as most durations are cheaper digit by digit than
+* padded out to a word.
+*
+* @param str Digits to convert
+* @param n Number of digits
+* @return Value of the digits
+*/
+static inline unsigned long parse_uint(const char *str, int n) {
+    unsigned long num = 0;
+
+    for (; n >= 8; n -= 8, str += 8) {
+        num = num * 100000000UL + parse_8digits(str);
+    }
+    for (; n > 0; --n, ++str) {
+        num = num * 10 + (*str - '0');
+    }
+    return num;
+}
+
+/**
+* Converts a 10-digit epoch timestamp
+*
+* @param str Digits to convert, ten of them
+* @return Value of the digits
+*/
+static inline long parse_timestamp10(const char *str) {
+    return parse_8digits(str) * 100L + (str[8] - '0') * 10 + (str[9] - '0');
+}
+
+/**
+* Converts many columns of digits, such as the timestamps of a batch of
+* rows. Lengths come from splitting the rows, so no column is scanned for
+* its end.
+*
+* @param strs Columns to convert
+* @param lens Number of digits of each column
+* @param n Number of columns
+* @param nums Array of n to store the values in
+*/
+static inline void parse_uints(char **strs, const int *lens, size_t n,
+    unsigned long *nums) {
+    for (size_t i = 0; i < n; ++i) {
+        nums[i] = lens[i] == 10 ? parse_timestamp10(strs[i]) :
+            parse_uint(strs[i], lens[i]);
+    }
+}
+
+// Converts string to integer
+static inline int stoi(char *str, int n) {
+    return parse_uint(str, n);
+}
+
+// Converts string to long
+static inline long stol(char *str, int n) {
+    return n == 10 ? parse_timestamp10(str) : parse_uint(str, n);
+}
+
+#endif
@@ -4,25 +4,19 @@
 #include <semaphore.h>
 #include <time.h>
 
-#define CCOUNT_SIZE 675
+#include "cache.h"
+#include "channel.h"
+#include "columnar.h"
+#include "stats.h"
+#include "topk.h"
+#include "zfile.h"
+
+#define CCOUNT_SIZE 676
 #define FILENAME_SIZE 256
 #define LINE_SIZE 48
 #define MR_FILENAME "mapred.tmp"
-#define THREADNAME_SIZE 7
 #define TIMESTAMP_SIZE 9
 
-/**
-* Website visit info container, each map call will 
-* store its read data to this struct 
-*/
-typedef struct sinfo {
-    FILE *file;
-    char filename[FILENAME_SIZE];
-    double average;
-    unsigned int *einfo;
-    struct sinfo *next;
-} sinfo;
-
 /**
 * Map arguments container, tells the map thread how many
 * files it is responsible for, and provides it with a list
@@ -30,11 +24,32 @@ typedef struct sinfo {
 */
 typedef struct margs {
     int nfiles;
+    int worker;
     sinfo *head;
 } margs;
 
-// Semaphore for file access
-extern sem_t mut_file;
+/**
+* Record a map thread writes to mapred.tmp for each of its files, read
+* back by the reduce thread
+*/
+typedef struct mrecord {
+    char filename[FILENAME_SIZE];
+    double average;
+    unsigned long count;
+    int code;
+    void *state;
+} mrecord;
+
+/**
+* Reduce shard container, the mapred.tmp a reduce thread reads the records
+* of the keys of its shard from and the results it reduces them to
+*/
+typedef struct rshard {
+    int index;
+    channel chan;
+    sinfo result;
+    theap top;
+} rshard;
 
 /********* Map functions *********/
 
@@ -47,66 +62,48 @@ extern sem_t mut_file;
 */
 static void* map(void* v);
 
-/**
-* (A/B) Map function for finding average duration of visit, sets average in 
-* passed sinfo node
-* 
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_dur(sinfo *info);
-
-/**
-* (C/D) Map function for finding average users per year, sets average
-* in passed sinfo node
-*
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_user(sinfo *info);
-
-/**
-* (E) Map function for finding country count, creates linked list for all 
-* countries 
-* 
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store country counts list in
-*/
-static void map_max_country(sinfo *info);
-
 /******* Reduce functions *******/
 
 /**
-* Reduce controller, calls reduce function for current query
+* Reduce controller, calls reduce function for current query on every
+* record read from the mapred.tmp of a shard until the map threads are done
 * 
-* @param v Pointer to head of sinfo linked list
-* @return Pointer to sinfo containing result
+* @param v Pointer to rshard of the shard to reduce
+* @return NULL
 */
 static void* reduce(void* v);
 
 /**
-* (A/B/C/D) Reduce function for finding max/min average in sinfo
-* linked list, bases result from current_query 
+* (A/B/C/D) Reduce function for finding max/min average of the files,
+* bases result from current_query 
 *
-* @param head Pointer to head of sinfo linked list
-* @return Pointer to sinfo node with max/min average 
+* @param shard Pointer to rshard to store result in
+* @param record Record of a file read from mapred.tmp
 */
-static void reduce_avg(sinfo *head);
+static void reduce_avg(rshard *shard, mrecord *record);
 
 /**
 * (E) Reduce function for finding country with the most users
 *
-* @param head Pointer to head of sinfo linked list
-* @return Pointer todo
+* @param shard Pointer to rshard to store result in
+* @param record Record of a file read from mapred.tmp
 */
-static void reduce_max_country(sinfo *head);
+static void reduce_max_country(rshard *shard, mrecord *record);
 
 /**
-* Makes a linked list of sinfo nodes, returns the length of the list
+* (Q_STATE) Reduce function merging the keys of a shard of the query
+* state of every file into the query result
 *
-* @param head Pointer to sinfo pointer where head pointer will be stored
-* @return Number of files found in data dir (length of list created)
+* @param shard Pointer to rshard of the keys to merge
+* @param record Record of a file read from mapred.tmp
+*/
+static void reduce_state(rshard *shard, mrecord *record);
+
+/**
+* Merges the results of the shards of each node into those of its first
+* shard, then those of the nodes into the first shard, and prints results
+* of query
 */
-static int make_files_list(sinfo **head);
+static void reduce_report();
 
 #endif
\ No newline at end of file
@@ -3,25 +3,33 @@
 
 #include <time.h>
 
-#define THREADNAME_SIZE 7
+#include "cache.h"
+#include "columnar.h"
+#include "stats.h"
+#include "topk.h"
+#include "zfile.h"
+
 #define FILENAME_SIZE 256
 #define LINE_SIZE 48
-#define CCOUNT_SIZE 675
+#define CCOUNT_SIZE 676
 #define TIMESTAMP_SIZE 9
 
-typedef struct sinfo {
-    FILE *file;
-    char filename[FILENAME_SIZE];
-    double average;
-    unsigned int *einfo;
-    struct sinfo *next;
-} sinfo;
-
 typedef struct margs {
     int nfiles;
+    int worker;
     sinfo *head;
+    theap top;
 } margs;
 
+/**
+* Reduce arguments container, tells a reduce shard thread which shard of
+* the keys it merges and provides it with the list of files
+*/
+typedef struct rargs {
+    sinfo *head;
+    int shard;
+} rargs;
+
 /********* Map functions *********/
 
 /**
@@ -33,33 +41,6 @@ typedef struct margs {
 */
 static void* map(void* v);
 
-/**
-* (A/B) Map function for finding average duration of visit, sets average in 
-* passed sinfo node
-* 
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_dur(sinfo *info);
-
-/**
-* (C/D) Map function for finding average users per year, sets average
-* in passed sinfo node
-*
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_user(sinfo *info);
-
-/**
-* (E) Map function for finding country count, creates linked list for all 
-* countries 
-* 
-* @param file Pointer to open website csv file
-* @param info Pointer to sinfo node to store country counts list in
-*/
-static void map_max_country(sinfo *info);
-
 /******* Reduce functions *******/
 
 /**
@@ -88,11 +69,12 @@ static void *reduce_avg(sinfo *head);
 static void *reduce_max_country(sinfo *head);
 
 /**
-* Makes a linked list of sinfo nodes, returns the length of the list
+* (Q_STATE) Reduce function merging the query state of every file into
+* the query result
 *
-* @param head Pointer to sinfo pointer where head pointer will be stored
-* @return Number of files found in data dir (length of list created)
+* @param head Pointer to head of sinfo linked list
+* @return Pointer to head of sinfo linked list
 */
-static int make_files_list(sinfo **head);
+static void *reduce_state(sinfo *head);
 
 #endif
\ No newline at end of file
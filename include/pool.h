@@ -0,0 +1,41 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Most threads per core a pool ramps up to while throughput keeps growing
+#define POOL_MAX_FACTOR 2
+
+// Seconds rows/sec is measured over before a pool is resized
+#define POOL_TUNE_SEC 0.05
+
+/**
+* Finds the number of threads to run by default, the cores the process may
+* run on capped by the CPU quota of its cgroup
+*
+* @return Number of threads, at least 1
+*/
+size_t pool_auto();
+
+/**
+* Runs a task on every item with a bounded pool of threads. The pool
+* starts nthreads of them at once and, measuring the rows/sec tasks report
+* through pool_progress, ramps that up to POOL_MAX_FACTOR times nthreads
+* while throughput grows, and back down while it drops.
+*
+* @param task Start routine of a task, called with an item
+* @param items Items to run the task on
+* @param nitems Number of items
+* @param nthreads Number of threads running at once to start with
+*/
+void pool_run(void *(*task)(void*), void **items, size_t nitems,
+    size_t nthreads);
+
+/**
+* Reports rows a task has mapped, the measure the pool is resized by
+*
+* @param rows Number of rows mapped since the last report
+*/
+void pool_progress(unsigned long rows);
+
+#endif
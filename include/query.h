@@ -0,0 +1,318 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+
+#include "helpers.h"
+#include "stats.h"
+
+// Columns of a line of a data file
+#define CSV_TIMESTAMP 0
+#define CSV_IP 1
+#define CSV_DURATION 2
+#define CSV_COUNTRY 3
+#define CSV_NCOLS 4
+
+// Ways the per-file results of a query are reduced to the query result
+#define Q_MAX 0
+#define Q_MIN 1
+#define Q_COUNTRY 2
+#define Q_STATE 3
+
+// Rows a scan splits before handing them to a query at once, and the
+// independent accumulators batch kernels sum them into
+#define QUERY_BATCH 16
+#define QUERY_LANES 4
+
+// Years used_years has a bit for, from 1970
+#define QUERY_YEARS 64
+
+// Longest error message a run keeps
+#define QUERY_ERROR_SIZE 256
+
+/**
+* Website visit info container, each map call will
+* store its read data to this struct. mapped is set once the partials and
+* state of the file are complete, files a failed run left unmapped have
+* none to reduce.
+*/
+typedef struct sinfo {
+    int mapped;
+    char filename[FILENAME_SIZE];
+    double average;
+    chist einfo;
+    pinfo partial;
+    void *state;
+    struct sinfo *next;
+} sinfo;
+
+/**
+* Query descriptor. A query keeps a pinfo of partials for every file, the
+* fixed-size partial state shared by the map functions, the result cache,
+* the stats sidecars and the columnar files. The country histogram of a
+* file is kept next to it in einfo.
+*
+* init clears the partials of a file before it is mapped, row adds one
+* line of it, split into its CSV_NCOLS columns, and combine merges the
+* partials of another part of the same file. Queries may add up to
+* QUERY_BATCH rows at once with rows instead, NULL for those that add rows
+* one at a time. finalize derives the result of
+* the file from its partials, select tells the reduce how the results of all
+* files make up the query result: the file with the highest or lowest
+* result, or for Q_COUNTRY the country with the most users when summing the
+* country each file returns.
+*
+* Queries needing more than the partials keep state_size bytes of state for
+* every file as well. Such queries have no partial fields, so they are never
+* answered from the cache, stats or columns. With Q_STATE, reduce merges the
+* state of every file into the query result, which report prints. The keys
+* of a state are partitioned over reduce_shards shards, reduce only merging
+* the keys of the shard it is given, so the shards of a file may be reduced
+* by threads of their own at once.
+*/
+typedef struct qdesc {
+    char *name;
+    int fields;
+    int select;
+    size_t state_size;
+    void (*init)(pinfo *partial, void *state);
+    void (*row)(pinfo *partial, chist *einfo, void *state,
+        char **cols);
+    void (*rows)(pinfo *partial, chist *einfo, void *state,
+        char *(*cols)[CSV_NCOLS], int n);
+    void (*combine)(pinfo *dst, pinfo *src);
+    double (*finalize)(pinfo *partial, chist *einfo, void *state);
+    void (*reduce)(char *filename, void *state, int shard);
+    void (*report)();
+} qdesc;
+
+/**
+* Progress of a run, handed to the progress sink every time a file is done
+* mapping. value is the result of the file just done, for Q_COUNTRY the
+* count of country, the country with the most users in it. best is the
+* query result over the files done so far, for queries reduced by select
+* rather than by report, NULL until there is one.
+*/
+typedef struct qprogress {
+    unsigned long nfiles;
+    unsigned long nrows;
+    char *filename;
+    double value;
+    char country[3];
+    unsigned long rows;
+    char *best;
+    double best_value;
+} qprogress;
+
+// Query registry, terminated by an entry without a name
+extern const qdesc queries[];
+
+// Number of shards the keys of results are partitioned over to reduce
+extern size_t reduce_shards;
+
+/**
+* Finds the reduce shard a key is partitioned to, by its hash
+*
+* @param key Key, such as the index of a group or country
+* @return Index of the shard, in [0, reduce_shards)
+*/
+static inline int query_shard(unsigned long key) {
+    return ((key * 0x9E3779B97F4A7C15UL) >> 32) % reduce_shards;
+}
+
+/**
+* Finds the reduce shard a file is partitioned to, by the FNV-1a hash of
+* its name
+*
+* @param name Name of the file
+* @return Index of the shard, in [0, reduce_shards)
+*/
+static inline int query_shard_name(char *name) {
+    unsigned long hash = 0xCBF29CE484222325UL;
+    for (; *name != '\0'; ++name) {
+        hash = (hash ^ (unsigned char)*name) * 0x100000001B3UL;
+    }
+    return query_shard(hash);
+}
+
+/**
+* Finds a query in the registry by name
+*
+* @param name Name of the query, as given on the command line
+* @return Pointer to the query descriptor, NULL if there is none
+*/
+const qdesc *query_find(char *name);
+
+/**
+* Maps the rest of an open data file into partials for current_query. The
+* row callback is looked up once for the file, not for every line. Filtered
+* runs only read the chunks of the file its zone map says may have rows
+* passing the filter.
+*
+* @param file Pointer to open data file
+* @param filename Name of the data file in DATA_DIR
+* @param partial Pointer to pinfo to store the partials in
+* @param einfo Country histogram to add counts to
+* @param state Query state of the file, NULL if the query keeps none
+* @param range Pointer to store the ranges of the well formed rows in,
+* NULL if they are not needed
+* @return Bytes of a last line without a newline left unread when files
+* are mapped as they are appended to, it is mapped once it is whole
+*/
+size_t query_map(FILE *file, char *filename, pinfo *partial,
+    chist *einfo, void *state, srange *range);
+
+/**
+* Maps a file of DATA_DIR for current_query, the same way for every part.
+* Partials cached for the file are reused, only mapping what was appended
+* to it since they were stored, and stats and columns of the file are
+* preferred to its rows. The result of the file is finalized and reported
+* as progress.
+*
+* @param info Pointer to sinfo of the file, marked mapped once it is
+* @return Number of rows read from the file itself, negative if it could
+* not be opened, which fails the run
+*/
+long map_file(sinfo *info);
+
+/**
+* Makes a linked list of sinfo nodes, returns the length of the list
+*
+* @param head Pointer to sinfo pointer where head pointer will be stored
+* @return Number of files found in data dir (length of list created),
+* negative if it could not be opened
+*/
+int make_files_list(sinfo **head);
+
+/**
+* Frees a linked list of sinfo nodes made by make_files_list
+*
+* @param head Pointer to head of sinfo linked list
+*/
+void free_files_list(sinfo *head);
+
+/**
+* Reorders the sinfo list so the share of each map thread is, where
+* possible, cached on the node the thread runs on
+*
+* @param head Pointer to sinfo pointer of the head of the list
+* @param nfiles Length of the list
+* @param counts Number of files of each map thread
+* @param nthreads Number of map threads
+*/
+void place_files(sinfo **head, int nfiles, int *counts, size_t nthreads);
+
+/**
+* Checks timestamps from ts_min to ts_max all fall in the QUERY_YEARS years
+* from 1970 that used_years has bits for, in local time
+*
+* @param ts_min Earliest timestamp
+* @param ts_max Latest timestamp
+* @return 1 if they do, else 0
+*/
+int query_years(long ts_min, long ts_max);
+
+/**
+* Compares two per-file results by the select direction of current_query
+*
+* @param a Result of a file
+* @param b Result of another file
+* @return Positive if a is the better result, negative if b is, else 0
+*/
+int query_cmp(double a, double b);
+
+/**
+* Sends the rows of results to a sink in place of stdout, and reports files
+* done mapping to another, starting the progress of a run over
+*
+* @param result Sink of rows, called with arg, the value and the name of a
+* row, NULL to print rows
+* @param progress Sink of progress, called with arg and the progress of the
+* run every time a file is done mapping, NULL for none
+* @param arg Argument the sinks are called with
+*/
+void query_sinks(void (*result)(void*, double, const char*),
+    void (*progress)(void*, qprogress*), void *arg);
+
+/**
+* Sends the warnings and errors of the engine to a sink in place of stderr
+*
+* @param log Sink of messages, called with arg and a message without its
+* newline from any thread, NULL to print them to stderr
+* @param arg Argument the sink is called with
+*/
+void query_logger(void (*log)(void*, const char*), void *arg);
+
+/**
+* Prints a warning or error of the engine to stderr, or hands it to the log
+* sink
+*
+* @param format printf format of the message, without a newline
+*/
+void query_log(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/**
+* Prints a line of the output of a query other than a row of its result,
+* such as its name. Nothing is printed while rows go to a result sink, or
+* once the run has failed.
+*
+* @param format printf format of the line
+*/
+void query_print(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/**
+* Prints a row of the result of a query, or hands it to the result sink.
+* Rows of a failed run are dropped.
+*
+* @param value Value of the row, such as the average of a file
+* @param name Name of the row, such as the file or country
+*/
+void query_row(double value, char *name);
+
+/**
+* Prints a row of the result of a query whose value is a count, or hands it
+* to the result sink. Rows of a failed run are dropped.
+*
+* @param value Count of the row
+* @param name Name of the row, such as the bucket counted
+*/
+void query_count(unsigned long value, char *name);
+
+/**
+* Reports a file a part is done mapping to the progress sink, if set
+*
+* @param filename Name of the file
+* @param value Result of the file, from finalize
+* @param rows Number of rows of the file
+* @param einfo Country histogram of the file
+*/
+void query_progress(char *filename, double value, unsigned long rows,
+    chist *einfo);
+
+/**
+* Fails the run with an error the process can go on after, such as a data
+* file or channel that could not be read, logging it like perror. Maps
+* skip the files they have left, the result is not printed and the part
+* returns an error once its threads are done. The first error of a run is
+* kept for query_error.
+*
+* @param what What failed, such as the path of a file
+* @param err errno of the failure, 0 if there is none
+*/
+void query_fail(const char *what, int err);
+
+/**
+* Finds the error that failed the run
+*
+* @return Message of the first error of the run, NULL if it has not failed
+*/
+const char *query_error();
+
+/**
+* Clears the error of the last run, before a run starts
+*/
+void query_error_clear();
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stdio.h>
+
+#define READER_BUF_SIZE (64 * 1024)
+
+// Longest timestamp and duration columns that fit their types
+#define TIMESTAMP_MAX_DIGITS 18
+#define DURATION_MAX_DIGITS 9
+
+/**
+* Buffered line reader over an open data file. Lines are returned in place
+* in the buffer, which grows to hold lines of any length. A last line
+* without a newline is returned like any other unless hold is set, for
+* files still being appended to, where it may be a row half written. It is
+* then left unread, end - start bytes of it.
+*/
+typedef struct lreader {
+    FILE *file;
+    char *buf;
+    size_t size;
+    size_t start;
+    size_t scanned;
+    size_t end;
+    int eof;
+    int hold;
+} lreader;
+
+// Number of malformed rows skipped by all scans
+extern unsigned long nbad_rows;
+
+/**
+* Makes a line reader reading an open file from its current offset
+*
+* @param r Pointer to the reader
+* @param file Pointer to open data file
+*/
+void reader_init(lreader *r, FILE *file);
+
+/**
+* Drops what a reader has buffered, for when its file was seeked
+*
+* @param r Pointer to the reader
+*/
+void reader_reset(lreader *r);
+
+/**
+* Reads the next line, terminated in place without its newline or CRLF
+*
+* @param r Pointer to the reader
+* @param end Pointer to store the end of the line in
+* @param raw Pointer to store the bytes the line took in the file in
+* @return Pointer to the line, NULL at the end of the file
+*/
+char *reader_line(lreader *r, char **end, size_t *raw);
+
+/**
+* Reads a batch of lines, all of them from the buffer as last filled so
+* they stay valid together until the next read
+*
+* @param r Pointer to the reader
+* @param lines Array of max to store the lines in
+* @param ends Array of max to store the ends of the lines in
+* @param raws Array of max to store the bytes each line took in
+* @param max Most lines to read
+* @return Number of lines read, 0 at the end of the file
+*/
+int reader_lines(lreader *r, char **lines, char **ends, size_t *raws,
+    int max);
+
+/**
+* Frees the buffer of a reader
+*
+* @param r Pointer to the reader
+*/
+void reader_free(lreader *r);
+
+/**
+* Splits the timestamp column off a line in place, checking it is a
+* number that fits a long
+*
+* @param line Line to split
+* @param end End of the line
+* @param cols Columns of the line to store the timestamp in
+* @return Pointer to the rest of the line, NULL if the column is malformed
+*/
+char *csv_timestamp(char *line, char *end, char **cols);
+
+/**
+* Splits the rest of a line into its ip, duration and country columns in
+* place, checking the duration is a number that fits an int and the
+* country is a two letter code
+*
+* @param rest Rest of the line after the timestamp column
+* @param end End of the line
+* @param cols Columns of the line to store the columns in
+* @return 0 if the columns are well formed, else negative
+*/
+int csv_rest(char *rest, char *end, char **cols);
+
+/**
+* Counts a malformed row, writing it to the quarantine file if one is open
+*
+* @param filename Name of the data file the row is in
+* @param line Line of the row, split in place or not
+* @param end End of the line
+*/
+void reader_reject(char *filename, char *line, char *end);
+
+/**
+* Opens the file malformed rows are quarantined in, appending to it
+*
+* @param path Path of the quarantine file
+* @return 0 on success, negative on error
+*/
+int reader_quarantine(char *path);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stddef.h>
+
+#include "htable.h"
+
+// Widths of rollup buckets
+#define R_HOUR 0
+#define R_DAY 1
+#define R_MONTH 2
+#define R_YEAR 3
+
+#define ROLLUP_LABEL_SIZE 32
+
+// Buckets of a page of a series, a power of two
+#define ROLLUP_PAGE_BITS 8
+#define ROLLUP_PAGE_SIZE (1 << ROLLUP_PAGE_BITS)
+
+// Most pages the directory of a series spans
+#define ROLLUP_DIR_PAGES 4096
+
+// Buckets each merging thread takes at least
+#define ROLLUP_MERGE_SPAN 4096
+
+/**
+* Visits and summed duration of the rows in a bucket
+*/
+typedef struct rbucket {
+    unsigned long nvisits;
+    unsigned long duration;
+} rbucket;
+
+/**
+* Bucket of a merged series and its key, keys counting buckets since 1970
+* in UTC
+*/
+typedef struct rentry {
+    long key;
+    rbucket bucket;
+} rentry;
+
+/**
+* Dense page of the buckets of ROLLUP_PAGE_SIZE keys, starting at key
+* page << ROLLUP_PAGE_BITS
+*/
+typedef struct rpage {
+    long page;
+    rbucket buckets[ROLLUP_PAGE_SIZE];
+} rpage;
+
+/**
+* Sparse time series of buckets, a table of dense pages of buckets keyed by
+* page. Only pages rows fall in are made, so a row with a timestamp far
+* from the rest costs one page, not the span between them. Rows find their
+* page in the directory first, page dir_base + i at dir[i], which spans up
+* to ROLLUP_DIR_PAGES pages around the first row and skips the table for
+* every page in it.
+*/
+typedef struct rollup {
+    htable pages;
+    rpage **dir;
+    long dir_base;
+    size_t dir_n;
+    size_t dir_size;
+} rollup;
+
+/**
+* Sets the width of rollup buckets
+*
+* @param width Bucket width: hour, day, month or year
+* @return 0 on success, negative if the width is not one of those
+*/
+int rollup_config(char *width);
+
+/**
+* Finds the key of the bucket of a timestamp
+*
+* @param ts Timestamp, seconds since 1970
+* @return Buckets of the configured width since 1970
+*/
+long rollup_key(long ts);
+
+/**
+* Writes the start of a bucket as a UTC date, to the hour for hourly
+* buckets
+*
+* @param key Key of the bucket
+* @param label Buffer of ROLLUP_LABEL_SIZE to write the label to
+*/
+void rollup_label(long key, char *label);
+
+/**
+* Empties a series, making its table the first time
+*
+* @param r Pointer to the series, zeroed or emptied before
+*/
+void rollup_clear(rollup *r);
+
+/**
+* Frees the pages and table of a series
+*
+* @param r Pointer to the series
+*/
+void rollup_free(rollup *r);
+
+/**
+* Adds a row to its bucket, adding the page of the bucket the first time
+*
+* @param r Pointer to the series
+* @param key Key of the bucket of the row
+* @param duration Duration of the row
+*/
+void rollup_add(rollup *r, long key, unsigned int duration);
+
+/**
+* Merges series into the buckets with rows of all of them in key order, in
+* parallel over partitions of the pages
+*
+* @param series Array of series to merge
+* @param n Number of series
+* @param nentries Pointer to store the number of buckets in
+* @return Array of the buckets, freed with free
+*/
+rentry *rollup_merge(rollup *series, size_t n, size_t *nentries);
+
+#endif
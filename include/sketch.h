@@ -0,0 +1,159 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define SKETCH_ERROR 0.02
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 16
+#define KLL_MIN_K 8
+#define KLL_MAX_LEVELS 48
+
+/**
+* HyperLogLog sketch of the distinct values added to it, 2^precision
+* registers each holding the highest rank seen in its share of the hashes
+*/
+typedef struct hll {
+    int precision;
+    unsigned char reg[];
+} hll;
+
+/**
+* KLL sketch of a stream of values. Level h holds up to k values standing
+* for 2^h values each. A full level is sorted and every other value of it
+* is promoted to the next level.
+*/
+typedef struct kll {
+    unsigned int k;
+    unsigned long nvalues;
+    unsigned long seed;
+    unsigned int n[KLL_MAX_LEVELS];
+    unsigned int *levels[KLL_MAX_LEVELS];
+} kll;
+
+/**
+* Sizes new sketches for a relative error, the standard error of
+* distinct counts and the rank error of quantiles
+*
+* @param error Relative error, such as 0.01
+* @return 0 on success, negative if the error is out of range
+*/
+int sketch_config(double error);
+
+/**
+* Hashes a value for a distinct count sketch
+*
+* @param str Value to hash
+* @param len Length of the value
+* @return 64-bit hash of the value
+*/
+unsigned long sketch_hash(char *str, size_t len);
+
+/**
+* Makes an empty HyperLogLog sketch
+*
+* @return Pointer to the sketch, freed with free
+*/
+hll *hll_new();
+
+/**
+* Adds a hashed value to a HyperLogLog sketch
+*
+* @param sketch Pointer to the sketch
+* @param hash Hash of the value, from sketch_hash
+*/
+void hll_add(hll *sketch, unsigned long hash);
+
+/**
+* Merges a HyperLogLog sketch into another of the same precision
+*
+* @param dst Pointer to sketch to merge into
+* @param src Pointer to sketch to merge from
+*/
+void hll_merge(hll *dst, hll *src);
+
+/**
+* Estimates the number of distinct values added to a HyperLogLog sketch
+*
+* @param sketch Pointer to the sketch
+* @return Estimated distinct count
+*/
+double hll_count(hll *sketch);
+
+/**
+* Writes a HyperLogLog sketch to a file
+*
+* @param sketch Pointer to the sketch
+* @param fp File to write to
+* @return 0 on success, negative if it could not be written
+*/
+int hll_write(hll *sketch, FILE *fp);
+
+/**
+* Reads a HyperLogLog sketch written by hll_write
+*
+* @param fp File to read from
+* @return Pointer to the sketch, freed with free, NULL if it could not be
+* read
+*/
+hll *hll_read(FILE *fp);
+
+/**
+* Makes an empty KLL sketch
+*
+* @return Pointer to the sketch, freed with kll_free
+*/
+kll *kll_new();
+
+/**
+* Adds a value to a KLL sketch
+*
+* @param sketch Pointer to the sketch
+* @param value Value to add
+*/
+void kll_add(kll *sketch, unsigned int value);
+
+/**
+* Merges a KLL sketch into another
+*
+* @param dst Pointer to sketch to merge into
+* @param src Pointer to sketch to merge from
+*/
+void kll_merge(kll *dst, kll *src);
+
+/**
+* Estimates a quantile of the values added to a KLL sketch
+*
+* @param sketch Pointer to the sketch
+* @param q Quantile, from 0 for the lowest value to 1 for the highest
+* @return Estimated value at the quantile
+*/
+double kll_quantile(kll *sketch, double q);
+
+/**
+* Frees a KLL sketch
+*
+* @param sketch Pointer to the sketch
+*/
+void kll_free(kll *sketch);
+
+/**
+* Writes a KLL sketch to a file
+*
+* @param sketch Pointer to the sketch
+* @param fp File to write to
+* @return 0 on success, negative if it could not be written
+*/
+int kll_write(kll *sketch, FILE *fp);
+
+/**
+* Reads a KLL sketch written by kll_write
+*
+* @param fp File to read from
+* @return Pointer to the sketch, freed with kll_free, NULL if it could not
+* be read
+*/
+kll *kll_read(FILE *fp);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/stat.h>
+
+#include "helpers.h"
+
+#define STATS_MAGIC 0x3553544154535453UL
+#define STATS_SUFFIX ".stats"
+
+/**
+* Ranges of the timestamps and durations of the rows of a data file. Files
+* whose rows were not all seen have the widest ranges, which rule out no
+* filter.
+*/
+typedef struct srange {
+    long ts_min;
+    long ts_max;
+    long dur_min;
+    long dur_max;
+} srange;
+
+/**
+* Stats sidecar header, followed by the number of countries of the file
+* and their cpacked counts when the partials have P_COUNTRY set. The sidecar is only valid while it is newer
+* than the data file and src_size matches the size of the file.
+*/
+typedef struct sheader {
+    unsigned long magic;
+    long src_size;
+    pinfo partial;
+    srange range;
+} sheader;
+
+// Set when scans are to write stats sidecars for the files they map
+extern int use_stats;
+
+/**
+* Reads the partials current_query needs from the stats sidecar of a
+* data file, if it is newer than the file
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param partial Pointer to pinfo to copy the partials to
+* @param einfo Country histogram to copy counts to, only written for E
+* @return 1 if the partials were read from the sidecar, else 0
+*/
+int stats_lookup(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo);
+
+/**
+* Checks if the stats sidecar of a data file rules out every row of it for
+* the filter of the run, by the ranges of its timestamps and durations
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @return 1 if no row of the file can pass the filter, else 0
+*/
+int stats_prune(char *filename, struct stat *st);
+
+/**
+* Writes the partials of a data file to its stats sidecar, keeping the
+* fields of other queries already in a valid sidecar
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file, st_size being the number of bytes
+* the partials cover
+* @param partial Pointer to partials to write
+* @param einfo Country histogram to write, only read if P_COUNTRY is set
+* @param range Ranges of every row of the file, NULL to keep those of a
+* valid sidecar or leave them unknown
+*/
+void stats_store(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo, srange *range);
+
+#endif
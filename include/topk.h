@@ -0,0 +1,76 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include "helpers.h"
+
+/**
+* Named result in a ranking, a file and its average or a country and its
+* user count
+*/
+typedef struct tentry {
+    double score;
+    char name[FILENAME_SIZE];
+} tentry;
+
+/**
+* Bounded heap of the k best results seen, the worst of them at the root.
+* Results rank by query_cmp, ties going to the name first in alphabetical
+* order like the single result of a query.
+*/
+typedef struct theap {
+    tentry *entries;
+    size_t n;
+    size_t k;
+} theap;
+
+// Number of results to print in rank order, 0 for the single best result
+extern size_t top_k;
+
+/**
+* Makes an empty heap keeping the k best results
+*
+* @param heap Pointer to heap to initialize
+* @param k Number of results to keep
+*/
+void topk_init(theap *heap, size_t k);
+
+/**
+* Adds a result to a heap, if it ranks among the k best
+*
+* @param heap Pointer to heap to add to
+* @param score Score of the result
+* @param name Name of the result
+*/
+void topk_push(theap *heap, double score, char *name);
+
+/**
+* Adds every country with users in a histogram to a heap
+*
+* @param heap Pointer to heap to add to
+* @param ccount Pointer to the country histogram
+*/
+void topk_countries(theap *heap, chist *ccount);
+
+/**
+* Adds the results of a heap to another
+*
+* @param dst Pointer to heap to add to
+* @param src Pointer to heap to add from
+*/
+void topk_merge(theap *dst, theap *src);
+
+/**
+* Prints the results of a heap best first, leaving the heap empty
+*
+* @param heap Pointer to heap to print
+*/
+void topk_print(theap *heap);
+
+/**
+* Frees the results of a heap
+*
+* @param heap Pointer to heap to free
+*/
+void topk_free(theap *heap);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <sys/inotify.h>
+#include <sys/poll.h>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | \
+    IN_MOVED_FROM)
+#define WATCH_BUF_SIZE 4096
+#define WATCH_SETTLE_MS 200
+#define WATCH_MAX_SETTLES 10
+
+// Set when results are to be kept fresh as DATA_DIR changes
+extern int use_watch;
+
+/**
+* Watches DATA_DIR for written, moved or removed files and reruns the part
+* after every burst of changes. The result cache is kept between runs, so
+* only new files and the appended tails of grown files are mapped. Queries
+* keeping a state (H, T and ad-hoc queries) and runs filtered by --where
+* are not cached, every rerun of them maps every file again.
+*
+* @param f_run Function running the part and printing its result
+* @param part Part character from the command line
+* @param nthreads Number of map threads
+* @return Negative on error, only returns if watching failed
+*/
+int watch_data(int (*f_run)(char, size_t), char part, size_t nthreads);
+
+#endif
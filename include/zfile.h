@@ -0,0 +1,41 @@
+#ifndef ZFILE_H
+#define ZFILE_H
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#define GZ_SUFFIX ".gz"
+#define ZST_SUFFIX ".zst"
+#define GZ_BUF_SIZE (128 * 1024)
+#define ZST_MAX_WORKERS 8
+#define ZST_FRAMES_AHEAD 2
+
+/**
+* Checks if a data file is read through a decompressor
+*
+* @param filepath Path of the data file
+* @return 1 if the file is gzip or zstd compressed, else 0
+*/
+int zcompressed(char *filepath);
+
+/**
+* Opens a data file for reading, .gz and .zst files are decompressed as
+* they are read. Independent frames of multi-frame .zst files are
+* decompressed in parallel ahead of the reader.
+*
+* @param filepath Path of the data file
+* @param offset Offset to start reading at, must be 0 for compressed files
+* @return Stream of the file, NULL on error
+*/
+FILE *zopen(char *filepath, off_t offset);
+
+/**
+* Closes a stream opened by zopen
+*
+* @param file Stream to close
+* @param size Size of the file as it was opened
+* @return Number of bytes of the file read, size for compressed files
+*/
+off_t zclose(FILE *file, off_t size);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <sys/stat.h>
+
+#include "helpers.h"
+
+#define ZONE_MAGIC 0x31454e4f5a54544fUL
+#define ZONE_SUFFIX ".zone"
+#define ZONE_ROWS 4096
+
+/**
+* Zone map header, followed by nzones zones in file order. Size and mtime
+* of the csv file the zones were built from are kept to detect stale maps.
+*/
+typedef struct zheader {
+    unsigned long magic;
+    unsigned long nzones;
+    long ts_min;
+    long ts_max;
+    long src_size;
+    long src_mtime_sec;
+    long src_mtime_nsec;
+} zheader;
+
+/**
+* Timestamp range of a chunk of up to ZONE_ROWS lines of a data file,
+* starting at byte offset and ending where the next zone starts
+*/
+typedef struct zone {
+    long offset;
+    long ts_min;
+    long ts_max;
+} zone;
+
+/**
+* Reads the zone map of a data file, if one exists that is as recent as
+* the file
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param header Pointer to zheader to store the header of the map in
+* @return Array of header->nzones zones to be freed, NULL if there is none
+*/
+zone *zone_load(char *filename, struct stat *st, zheader *header);
+
+/**
+* Writes the zone map of a data file to its sidecar directory
+*
+* @param filename Name of the data file in DATA_DIR
+* @param header Pointer to header of the map, identifying the data file
+* @param zones Array of header->nzones zones
+* @return 0 on success, negative on error
+*/
+int zone_store(char *filename, zheader *header, zone *zones);
+
+#endif
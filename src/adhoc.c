@@ -0,0 +1,902 @@
+#include "lott.h"
+#include "adhoc.h"
+#include "filter.h"
+#include "htable.h"
+#include "parse.h"
+#include "sketch.h"
+#include "topk.h"
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <time.h>
+
+#define NYEARS 64
+
+// Bytes a table grows by between charges to the memory budget
+#define ADHOC_CHARGE_STEP 65536
+
+/**
+* Result row of an ad-hoc query grouped by file
+*/
+typedef struct afile {
+    char filename[FILENAME_SIZE];
+    agroup group;
+} afile;
+
+/**
+* Rows of an ad-hoc query grouped by file that one reduce shard added
+*/
+typedef struct afiles {
+    afile *rows;
+    size_t n;
+    size_t size;
+} afiles;
+
+/**
+* Groups of an ad-hoc query grouped by a column kept in a hash table, the
+* bytes of the table charged to the memory budget and the number of reduce
+* shards yet to merge it
+*/
+typedef struct atable {
+    htable table;
+    size_t charged;
+    size_t pending;
+} atable;
+
+/**
+* Run of groups spilled in key order, or of the groups left in memory at
+* the report when fp is NULL, and the group it is at while runs are merged
+*/
+typedef struct arun {
+    FILE *fp;
+    hkey **keys;
+    size_t i;
+    size_t n;
+    char *key;
+    size_t len;
+    size_t size;
+    agroup group;
+} arun;
+
+// Descriptor of the compiled query
+static qdesc adhoc;
+static char adhoc_name[ADHOC_NAME_SIZE];
+static int group_by, agg, ngroups;
+static double quantile;
+
+// Mask of the columns rows need parsed
+static int needs;
+
+// Condition on the aggregate of a group
+static int having_op = -1;
+static double having_value;
+
+// Query result, groups merged over all files or a row for every file,
+// kept apart for every reduce shard until the report
+static agroup *result;
+static afiles *files;
+
+// Query result grouped by a column kept in hash tables, a table for every
+// reduce shard, and the number of shards they were made for
+static atable *tables;
+static size_t ntables;
+
+// Bytes tables may take before they are spilled, 0 for no limit
+size_t adhoc_budget;
+
+// Bytes taken by every table, and by the sketch of a group
+static size_t spill_bytes, sketch_bytes;
+
+// Runs spilled since the last report
+static arun *runs;
+static size_t nruns, runs_size, nspills;
+static sem_t runs_mut;
+
+static void table_charge(atable *table, int spill);
+
+// Finds the offset from 1970 of the year of a timestamp
+static inline int year_key(long timestamp) {
+    time_t ts = timestamp;
+    struct tm tm;
+    localtime_r(&ts, &tm);
+    return tm.tm_year - 70;
+}
+
+// Parses the columns of a row the query needs into vals
+static inline void adhoc_parse(char **cols, long *vals) {
+    if (needs & (1 << CSV_TIMESTAMP)) {
+        vals[CSV_TIMESTAMP] = stol(cols[CSV_TIMESTAMP],
+            strlen(cols[CSV_TIMESTAMP]));
+    }
+    if (needs & (1 << CSV_DURATION)) {
+        vals[CSV_DURATION] = stoi(cols[CSV_DURATION],
+            strlen(cols[CSV_DURATION]));
+    }
+    if (needs & (1 << CSV_COUNTRY)) {
+        vals[CSV_COUNTRY] = country_index(cols[CSV_COUNTRY]);
+    }
+}
+
+/********* Spilling *********/
+
+// Frees the sketch of a group
+static void sketch_free(agroup *group) {
+    if (agg == AGG_QUANTILE) {
+        kll_free(group->sketch);
+    } else {
+        free(group->sketch);
+    }
+    group->sketch = NULL;
+}
+
+// Compares keys of hash tables by their bytes, then their length
+static int hkey_cmp(const void *a, const void *b) {
+    hkey *ka = *(hkey**)a, *kb = *(hkey**)b;
+    int cmp = memcmp(htable_key(ka), htable_key(kb),
+        ka->len < kb->len ? ka->len : kb->len);
+    return cmp ? cmp : (ka->len > kb->len) - (ka->len < kb->len);
+}
+
+// Finds the bytes a table takes, with the sketches of its groups
+static inline size_t table_bytes(atable *table) {
+    return table->table.bytes + table->table.n * sketch_bytes;
+}
+
+// Writes a group to a run, its key, aggregates and sketch
+static int run_write(FILE *fp, hkey *key, agroup *group) {
+    unsigned int len = key->len;
+    char has_sketch = group->sketch != NULL;
+    if (fwrite(&len, sizeof(int), 1, fp) != 1 ||
+        fwrite(htable_key(key), 1, len, fp) != len ||
+        fwrite(group, offsetof(agroup, sketch), 1, fp) != 1 ||
+        fwrite(&has_sketch, 1, 1, fp) != 1) {
+        return -1;
+    }
+    if (!has_sketch) {
+        return 0;
+    }
+    return agg == AGG_QUANTILE ? kll_write(group->sketch, fp) :
+        hll_write(group->sketch, fp);
+}
+
+// Adds an empty run to the runs spilled since the last report
+static arun *runs_add() {
+    if (nruns == runs_size) {
+        runs_size = runs_size ? runs_size << 1 : 16;
+        runs = realloc(runs, runs_size * sizeof(arun));
+    }
+    memset(&runs[nruns], 0, sizeof(arun));
+    return &runs[nruns++];
+}
+
+// Sorts the groups of a table by key into a new run file, then empties the
+// table. Run files are unlinked once open, they only last as long as the
+// run is kept. A table that could not be spilled fails the run and keeps
+// its groups.
+static void table_spill(atable *table) {
+    char path[32];
+    size_t n = 0, id;
+    void *group;
+    hkey *key;
+
+    hkey **keys = malloc(table->table.n * sizeof(hkey*));
+    for (size_t i = 0; (key = htable_next(&table->table, &i, &group));) {
+        keys[n++] = key;
+    }
+    qsort(keys, n, sizeof(hkey*), hkey_cmp);
+
+    id = __atomic_fetch_add(&nspills, 1, __ATOMIC_RELAXED);
+    snprintf(path, sizeof(path), "adhoc.tmp.%zu", id);
+    FILE *fp = fopen(path, "w+");
+    if (fp == NULL) {
+        query_fail("Could not spill groups", errno);
+        free(keys);
+        return;
+    }
+    unlink(path);
+    for (size_t i = 0; i < n; ++i) {
+        if (run_write(fp, keys[i], (agroup*)(keys[i] + 1)) < 0) {
+            query_fail("Could not spill groups", errno);
+            fclose(fp);
+            free(keys);
+            return;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        sketch_free((agroup*)(keys[i] + 1));
+    }
+    free(keys);
+
+    // Give back the slots, they were sized for the groups just spilled
+    htable_free(&table->table);
+    htable_init(&table->table, sizeof(agroup));
+    table_charge(table, 0);
+
+    sem_wait(&runs_mut);
+    runs_add()->fp = fp;
+    sem_post(&runs_mut);
+}
+
+// Charges the bytes a table grew or shrank by since it was last charged,
+// spilling the table if spill is set and the budget is spent, unless the
+// run has failed
+static void table_charge(atable *table, int spill) {
+    size_t bytes = table_bytes(table);
+    size_t total = __atomic_add_fetch(&spill_bytes, bytes - table->charged,
+        __ATOMIC_RELAXED);
+    table->charged = bytes;
+    if (spill && adhoc_budget && total > adhoc_budget && table->table.n > 0 &&
+        query_error() == NULL) {
+        table_spill(table);
+    }
+}
+
+/********* Row kernels *********/
+
+// Defines the row kernel of a group key and aggregate, KEY sets key from
+// the parsed columns in vals and UPDATE adds the row to group
+#define ADHOC_KERNEL(NAME, KEY, UPDATE)                                     \
+    static void NAME(pinfo *partial, chist *einfo, void *state,            \
+        char **cols) {                                                     \
+        long vals[CSV_NCOLS];                                              \
+        int key;                                                           \
+        adhoc_parse(cols, vals);                                           \
+        KEY;                                                               \
+        if (key < 0 || key >= ngroups) {                                   \
+            return;                                                        \
+        }                                                                  \
+        agroup *group = (agroup*)state + key;                              \
+        ++group->count;                                                    \
+        UPDATE;                                                            \
+        ++partial->nvisits;                                                \
+    }
+
+// Defines the row kernel of a group key kept in a hash table, COL being
+// the column of the key and UPDATE adding the row to group
+#define ADHOC_HKERNEL(NAME, COL, UPDATE)                                    \
+    static void NAME(pinfo *partial, chist *einfo, void *state,            \
+        char **cols) {                                                     \
+        long vals[CSV_NCOLS];                                              \
+        atable *table = state;                                             \
+        size_t len = strlen(cols[COL]);                                    \
+        adhoc_parse(cols, vals);                                           \
+        agroup *group = htable_get(&table->table, cols[COL], len,          \
+            sketch_hash(cols[COL], len));                                  \
+        ++group->count;                                                    \
+        UPDATE;                                                            \
+        ++partial->nvisits;                                                \
+        if (adhoc_budget &&                                                \
+            table_bytes(table) >= table->charged + ADHOC_CHARGE_STEP) {    \
+            table_charge(table, 1);                                        \
+        }                                                                  \
+    }
+
+#define KEY_COUNTRY key = vals[CSV_COUNTRY]
+#define KEY_YEAR key = year_key(vals[CSV_TIMESTAMP])
+#define KEY_FILE key = 0
+#define KEY_ALL key = 0
+
+#define UPDATE_COUNT
+#define UPDATE_SUM group->sum += vals[CSV_DURATION]
+#define UPDATE_MIN                                                          \
+    if (group->count == 1 || vals[CSV_DURATION] < group->min) {            \
+        group->min = vals[CSV_DURATION];                                   \
+    }
+#define UPDATE_MAX                                                          \
+    if (vals[CSV_DURATION] > group->max) {                                 \
+        group->max = vals[CSV_DURATION];                                   \
+    }
+#define UPDATE_DISTINCT                                                     \
+    if (group->sketch == NULL) {                                           \
+        group->sketch = hll_new();                                         \
+    }                                                                      \
+    hll_add(group->sketch,                                                 \
+        sketch_hash(cols[CSV_IP], strlen(cols[CSV_IP])))
+#define UPDATE_QUANTILE                                                     \
+    if (group->sketch == NULL) {                                           \
+        group->sketch = kll_new();                                         \
+    }                                                                      \
+    kll_add(group->sketch, vals[CSV_DURATION])
+
+ADHOC_KERNEL(row_country_count, KEY_COUNTRY, UPDATE_COUNT)
+ADHOC_KERNEL(row_country_sum, KEY_COUNTRY, UPDATE_SUM)
+ADHOC_KERNEL(row_country_min, KEY_COUNTRY, UPDATE_MIN)
+ADHOC_KERNEL(row_country_max, KEY_COUNTRY, UPDATE_MAX)
+ADHOC_KERNEL(row_country_distinct, KEY_COUNTRY, UPDATE_DISTINCT)
+ADHOC_KERNEL(row_country_quantile, KEY_COUNTRY, UPDATE_QUANTILE)
+ADHOC_KERNEL(row_year_count, KEY_YEAR, UPDATE_COUNT)
+ADHOC_KERNEL(row_year_sum, KEY_YEAR, UPDATE_SUM)
+ADHOC_KERNEL(row_year_min, KEY_YEAR, UPDATE_MIN)
+ADHOC_KERNEL(row_year_max, KEY_YEAR, UPDATE_MAX)
+ADHOC_KERNEL(row_year_distinct, KEY_YEAR, UPDATE_DISTINCT)
+ADHOC_KERNEL(row_year_quantile, KEY_YEAR, UPDATE_QUANTILE)
+ADHOC_KERNEL(row_file_count, KEY_FILE, UPDATE_COUNT)
+ADHOC_KERNEL(row_file_sum, KEY_FILE, UPDATE_SUM)
+ADHOC_KERNEL(row_file_min, KEY_FILE, UPDATE_MIN)
+ADHOC_KERNEL(row_file_max, KEY_FILE, UPDATE_MAX)
+ADHOC_KERNEL(row_file_distinct, KEY_FILE, UPDATE_DISTINCT)
+ADHOC_KERNEL(row_file_quantile, KEY_FILE, UPDATE_QUANTILE)
+ADHOC_HKERNEL(row_ip_count, CSV_IP, UPDATE_COUNT)
+ADHOC_HKERNEL(row_ip_sum, CSV_IP, UPDATE_SUM)
+ADHOC_HKERNEL(row_ip_min, CSV_IP, UPDATE_MIN)
+ADHOC_HKERNEL(row_ip_max, CSV_IP, UPDATE_MAX)
+ADHOC_HKERNEL(row_ip_distinct, CSV_IP, UPDATE_DISTINCT)
+ADHOC_HKERNEL(row_ip_quantile, CSV_IP, UPDATE_QUANTILE)
+
+// Kernels by group key, then by count, sum (also for avg), min, max,
+// distinct and quantile. Rows of all files go to a single group like those
+// of a file do.
+static void (*const kernels[5][6])(pinfo*, chist*, void*, char**) = {
+    {row_country_count, row_country_sum, row_country_min, row_country_max,
+        row_country_distinct, row_country_quantile},
+    {row_year_count, row_year_sum, row_year_min, row_year_max,
+        row_year_distinct, row_year_quantile},
+    {row_file_count, row_file_sum, row_file_min, row_file_max,
+        row_file_distinct, row_file_quantile},
+    {row_file_count, row_file_sum, row_file_min, row_file_max,
+        row_file_distinct, row_file_quantile},
+    {row_ip_count, row_ip_sum, row_ip_min, row_ip_max, row_ip_distinct,
+        row_ip_quantile}
+};
+
+/********* Query callbacks *********/
+
+static void adhoc_init(pinfo *partial, void *state) {
+    agroup *groups = state;
+
+    // Tables are made the first time or after being merged, else emptied
+    // of the groups of the file they were last mapped for
+    if (group_by == G_IP) {
+        atable *table = state;
+        agroup *group;
+        hkey *key;
+        memset(partial, 0, sizeof(pinfo));
+        if (table->table.ctrl == NULL) {
+            htable_init(&table->table, sizeof(agroup));
+        } else {
+            for (size_t i = 0;
+                (key = htable_next(&table->table, &i, (void**)&group));) {
+                sketch_free(group);
+            }
+            htable_clear(&table->table);
+        }
+        table->pending = reduce_shards;
+        table_charge(table, 0);
+        return;
+    }
+
+    for (int i = 0; i < ngroups; ++i) {
+        sketch_free(&groups[i]);
+    }
+    memset(partial, 0, sizeof(pinfo));
+    memset(state, 0, adhoc.state_size);
+}
+
+// Result of a file is the number of its rows that were aggregated. Tables
+// of mapped files are spilled while they wait for reduce if the budget is
+// spent.
+static double adhoc_finalize(pinfo *partial, chist *einfo,
+    void *state) {
+    if (group_by == G_IP) {
+        table_charge(state, 1);
+    }
+    return partial->nvisits;
+}
+
+// Merges the aggregates of a group into those of another
+static void group_merge(agroup *dst, agroup *src) {
+    if (src->count == 0) {
+        return;
+    }
+    if (dst->count == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+
+    // Sketches move to groups without one, else they are merged
+    if (src->sketch == NULL) {
+        return;
+    }
+    if (dst->sketch == NULL) {
+        dst->sketch = src->sketch;
+        src->sketch = NULL;
+        return;
+    }
+    if (agg == AGG_QUANTILE) {
+        kll_merge(dst->sketch, src->sketch);
+    } else {
+        hll_merge(dst->sketch, src->sketch);
+    }
+    sketch_free(src);
+}
+
+// Merges the groups of a file partitioned to a shard into the result, or
+// adds a row for the file if the file is
+static void adhoc_reduce(char *filename, void *state, int shard) {
+    agroup *groups = state;
+
+    // Merge the groups of the shard into its table, the last shard to
+    // merge the table of the file frees it
+    if (group_by == G_IP) {
+        atable *table = state;
+        agroup *group;
+        hkey *key;
+        for (size_t i = 0;
+            (key = htable_next(&table->table, &i, (void**)&group));) {
+            if (query_shard(key->hash) == shard) {
+                group_merge(htable_get(&tables[shard].table, htable_key(key),
+                    key->len, key->hash), group);
+            }
+        }
+        table_charge(&tables[shard], 1);
+        if (__atomic_sub_fetch(&table->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            htable_free(&table->table);
+            table_charge(table, 0);
+        }
+        return;
+    }
+
+    if (group_by != G_FILE) {
+        for (int i = 0; i < ngroups; ++i) {
+            if (query_shard(i) == shard) {
+                group_merge(&result[i], &groups[i]);
+            }
+        }
+        return;
+    }
+
+    // Add a row for the file, doubling the rows when full
+    afiles *rows = &files[shard];
+    if (groups[0].count == 0 || query_shard_name(filename) != shard) {
+        return;
+    }
+    if (rows->n == rows->size) {
+        rows->size = rows->size ? rows->size << 1 : 16;
+        rows->rows = realloc(rows->rows, rows->size * sizeof(afile));
+    }
+    strcpy(rows->rows[rows->n].filename, filename);
+    rows->rows[rows->n].group = groups[0];
+    groups[0].sketch = NULL;
+    ++rows->n;
+}
+
+// Finds the value of the aggregate of a group
+static double agg_value(agroup *group) {
+    switch (agg) {
+        case AGG_COUNT:
+            return group->count;
+        case AGG_SUM:
+            return group->sum;
+        case AGG_AVG:
+            return (double)group->sum / group->count;
+        case AGG_MIN:
+            return group->min;
+        case AGG_MAX:
+            return group->max;
+        case AGG_DISTINCT:
+            return hll_count(group->sketch);
+        default:
+            return kll_quantile(group->sketch, quantile);
+    }
+}
+
+// Returns 1 if the aggregate of a group meets the having condition
+static int having_match(double value) {
+    switch (having_op) {
+        case OP_EQ:
+            return value == having_value;
+        case OP_NE:
+            return value != having_value;
+        case OP_LT:
+            return value < having_value;
+        case OP_LE:
+            return value <= having_value;
+        case OP_GT:
+            return value > having_value;
+        case OP_GE:
+            return value >= having_value;
+        default:
+            return 1;
+    }
+}
+
+static int file_cmp(const void *a, const void *b) {
+    return strcmp(((afile*)a)->filename, ((afile*)b)->filename);
+}
+
+// Reads the next group of a run into its key and group, returns 0 at the
+// end of the run or if it could not be read, which fails the run
+static int run_next(arun *run) {
+    unsigned int len;
+    char has_sketch;
+    char *key = NULL;
+
+    if (run->fp == NULL) {
+        // The sketch moves out of the table with the group
+        if (run->i == run->n) {
+            return 0;
+        }
+        len = run->keys[run->i]->len;
+        key = htable_key(run->keys[run->i]);
+        run->group = *(agroup*)(run->keys[run->i] + 1);
+        ((agroup*)(run->keys[run->i] + 1))->sketch = NULL;
+        ++run->i;
+    } else if (fread(&len, sizeof(int), 1, run->fp) != 1) {
+        return 0;
+    }
+    if (len > run->size) {
+        run->size = len;
+        run->key = realloc(run->key, len);
+    }
+    run->len = len;
+    if (run->fp == NULL) {
+        memcpy(run->key, key, len);
+        return 1;
+    }
+
+    run->group.sketch = NULL;
+    if (fread(run->key, 1, len, run->fp) != len ||
+        fread(&run->group, offsetof(agroup, sketch), 1, run->fp) != 1 ||
+        fread(&has_sketch, 1, 1, run->fp) != 1 ||
+        (has_sketch && (run->group.sketch = agg == AGG_QUANTILE ?
+        (void*)kll_read(run->fp) : (void*)hll_read(run->fp)) == NULL)) {
+        query_fail("Could not read spilled groups", 0);
+        return 0;
+    }
+    return 1;
+}
+
+// Compares runs by the keys they are at
+static inline int run_cmp(arun *a, arun *b) {
+    int cmp = memcmp(a->key, b->key, a->len < b->len ? a->len : b->len);
+    return cmp ? cmp : (a->len > b->len) - (a->len < b->len);
+}
+
+// Sifts a run down a heap of n runs ordered by their keys
+static void runs_sift(arun **heap, size_t n, size_t i) {
+    for (size_t child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n && run_cmp(heap[child + 1], heap[child]) < 0) {
+            ++child;
+        }
+        if (run_cmp(heap[i], heap[child]) <= 0) {
+            break;
+        }
+        arun *tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+}
+
+// Moves the first run of a heap of runs to its next group, dropping it at
+// its end, returns the new number of runs
+static size_t runs_advance(arun **heap, size_t n) {
+    if (!run_next(heap[0])) {
+        heap[0] = heap[--n];
+    }
+    runs_sift(heap, n, 0);
+    return n;
+}
+
+// Prints a row for every group in the tables of the shards and the runs
+// spilled from tables in key order, or pushes it for --top, then empties
+// the tables. Runs are sorted, so a k-way merge of them with the groups
+// left in memory meets every group of a key one after the other.
+static void report_tables(theap *top) {
+    char label[FILENAME_SIZE];
+    size_t n = 0, nheap = 0, len, size = 0;
+    char *key = NULL;
+    hkey *hk;
+    void *value;
+
+    // Groups left in memory make one more run
+    arun *memory = runs_add();
+    for (size_t s = 0; s < reduce_shards; ++s) {
+        n += tables[s].table.n;
+    }
+    memory->keys = malloc((n ? n : 1) * sizeof(hkey*));
+    for (size_t s = 0; s < reduce_shards; ++s) {
+        for (size_t i = 0;
+            (hk = htable_next(&tables[s].table, &i, &value));) {
+            memory->keys[memory->n++] = hk;
+        }
+    }
+    qsort(memory->keys, memory->n, sizeof(hkey*), hkey_cmp);
+
+    arun **heap = malloc(nruns * sizeof(arun*));
+    for (size_t i = 0; i < nruns; ++i) {
+        if (runs[i].fp != NULL) {
+            rewind(runs[i].fp);
+        }
+        if (run_next(&runs[i])) {
+            heap[nheap++] = &runs[i];
+        }
+    }
+    for (size_t i = nheap / 2; i-- > 0;) {
+        runs_sift(heap, nheap, i);
+    }
+
+    while (nheap > 0) {
+        // Merge the groups of the least key of every run
+        agroup group = heap[0]->group;
+        len = heap[0]->len;
+        if (len > size) {
+            size = len;
+            key = realloc(key, size);
+        }
+        memcpy(key, heap[0]->key, len);
+        nheap = runs_advance(heap, nheap);
+        while (nheap > 0 && heap[0]->len == len &&
+            memcmp(heap[0]->key, key, len) == 0) {
+            group_merge(&group, &heap[0]->group);
+            nheap = runs_advance(heap, nheap);
+        }
+
+        double value = agg_value(&group);
+        sketch_free(&group);
+        if (!having_match(value)) {
+            continue;
+        }
+        snprintf(label, sizeof(label), "%.*s", (int)len, key);
+        if (top_k) {
+            topk_push(top, value, label);
+        } else {
+            query_row(value, label);
+        }
+    }
+    free(heap);
+    free(key);
+
+    for (size_t i = 0; i < nruns; ++i) {
+        if (runs[i].fp != NULL) {
+            fclose(runs[i].fp);
+        }
+        free(runs[i].keys);
+        free(runs[i].key);
+    }
+    nruns = 0;
+    for (size_t s = 0; s < reduce_shards; ++s) {
+        htable_clear(&tables[s].table);
+        table_charge(&tables[s], 0);
+    }
+}
+
+// Prints a row of the result for every group, or for the top_k best groups
+// in rank order, then clears the result for the next run
+static void adhoc_report() {
+    char label[FILENAME_SIZE];
+    double value;
+
+    theap top;
+
+    // Keep only the best groups for --top
+    if (top_k) {
+        topk_init(&top, top_k);
+    } else {
+        query_print("Result:\n");
+    }
+    if (group_by == G_IP) {
+        report_tables(&top);
+    } else if (group_by == G_FILE) {
+        // Gather the rows of every shard into those of the first
+        afiles *rows = &files[0];
+        for (size_t s = 1; s < reduce_shards; ++s) {
+            for (size_t i = 0; i < files[s].n; ++i) {
+                if (rows->n == rows->size) {
+                    rows->size = rows->size ? rows->size << 1 : 16;
+                    rows->rows = realloc(rows->rows,
+                        rows->size * sizeof(afile));
+                }
+                rows->rows[rows->n++] = files[s].rows[i];
+            }
+            files[s].n = 0;
+        }
+
+        qsort(rows->rows, rows->n, sizeof(afile), file_cmp);
+        for (size_t i = 0; i < rows->n; ++i) {
+            value = agg_value(&rows->rows[i].group);
+            sketch_free(&rows->rows[i].group);
+            if (!having_match(value)) {
+                continue;
+            }
+            if (top_k) {
+                topk_push(&top, value, rows->rows[i].filename);
+            } else {
+                query_row(value, rows->rows[i].filename);
+            }
+        }
+        rows->n = 0;
+    }
+
+    for (int i = 0; i < ngroups && group_by != G_FILE && group_by != G_IP;
+        ++i) {
+        if (result[i].count == 0) {
+            continue;
+        }
+        value = agg_value(&result[i]);
+        sketch_free(&result[i]);
+        if (!having_match(value)) {
+            continue;
+        }
+        if (group_by == G_COUNTRY) {
+            label[0] = (i / 26) + 'A';
+            label[1] = (i % 26) + 'A';
+            label[2] = '\0';
+        } else if (group_by == G_YEAR) {
+            sprintf(label, "%d", 1970 + i);
+        } else {
+            strcpy(label, "all");
+        }
+        if (top_k) {
+            topk_push(&top, value, label);
+        } else {
+            query_row(value, label);
+        }
+    }
+    memset(result, 0, ngroups * sizeof(agroup));
+
+    if (top_k) {
+        topk_print(&top);
+        topk_free(&top);
+    }
+}
+
+/********* Compiling *********/
+
+// Finds the index of name in names, -1 if it is not there
+static int find_name(char *name, const char **names, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+* Compiles command line aggregation flags into the descriptor of an ad-hoc
+* query. The row kernel of the query is picked for its group key and
+* aggregate, rows are filtered by filter_compile before they reach it.
+*
+* @param group_by Column to group by: country, year, file, all or ip, NULL
+* for file
+* @param agg Aggregate of the duration column: count, sum, avg, min, max or
+* a percentile such as p95, optionally written as max(duration), or
+* distinct(ip) for the number of distinct visitors, NULL for count
+* @param where Conditions rows are filtered by, only used to name the query
+* @param having Condition on the aggregate of a group, such as >1000,
+* NULL for every group
+* @return Pointer to the query descriptor, NULL if a flag is invalid
+*/
+const qdesc *adhoc_compile(char *group_by_str, char *agg_str, char *where,
+    char *having) {
+    static const char *groups[] = {"country", "year", "file", "all", "ip"};
+    static const char *aggs[] = {"count", "sum", "avg", "min", "max",
+        "distinct"};
+    static const int kernel_of[] = {0, 1, 1, 2, 3, 4, 5};
+    char aggname[16], *end;
+
+    group_by = find_name(group_by_str ? group_by_str : "file", groups, 5);
+    if (group_by < 0) {
+        query_log("%s: %s", "Not an acceptable group-by column",
+            group_by_str);
+        return NULL;
+    }
+
+    // Distinct counts take the ip column, other aggregates the duration
+    snprintf(aggname, sizeof(aggname), "%s", agg_str ? agg_str : "count");
+    char *paren = strchr(aggname, '(');
+    if (paren != NULL && (strcmp(paren, "(duration)") == 0 ||
+        (strcmp(paren, "(ip)") == 0 && strncmp(aggname, "distinct", 8) == 0))) {
+        *paren = '\0';
+    }
+    agg = find_name(aggname, aggs, 6);
+
+    // Percentiles are written p followed by the percent, such as p99.9
+    if (agg < 0 && aggname[0] == 'p') {
+        quantile = strtod(aggname + 1, &end) / 100;
+        if (end != aggname + 1 && *end == '\0' && quantile >= 0 &&
+            quantile <= 1) {
+            agg = AGG_QUANTILE;
+        }
+    }
+    if (agg < 0) {
+        query_log("%s: %s", "Not an acceptable aggregate", agg_str);
+        return NULL;
+    }
+
+    needs = 0;
+    having_op = -1;
+    if (having != NULL) {
+        int n = filter_op(having, &having_op);
+        having_value = strtod(having + n, &end);
+        if (n == 0 || end == having + n || *end != '\0') {
+            query_log("%s: %s", "Not an acceptable condition", having);
+            return NULL;
+        }
+    }
+
+    // Parse only the columns the kernel reads
+    if (group_by == G_COUNTRY) {
+        needs |= 1 << CSV_COUNTRY;
+        ngroups = CCOUNT_SIZE;
+    } else if (group_by == G_YEAR) {
+        needs |= 1 << CSV_TIMESTAMP;
+        ngroups = NYEARS;
+    } else if (group_by == G_IP) {
+        ngroups = 0;
+    } else {
+        ngroups = 1;
+    }
+    if (agg != AGG_COUNT && agg != AGG_DISTINCT) {
+        needs |= 1 << CSV_DURATION;
+    }
+    // Free the result of a query compiled before, the shards it was made
+    // for may differ
+    free(result);
+    result = calloc(ngroups, sizeof(agroup));
+    for (size_t s = 0; files != NULL && s < ntables; ++s) {
+        free(files[s].rows);
+    }
+    free(files);
+    files = calloc(reduce_shards, sizeof(afiles));
+    for (size_t s = 0; tables != NULL && s < ntables; ++s) {
+        htable_free(&tables[s].table);
+    }
+    free(tables);
+    tables = NULL;
+    ntables = reduce_shards;
+    if (group_by == G_IP) {
+        tables = calloc(reduce_shards, sizeof(atable));
+        for (size_t s = 0; s < reduce_shards; ++s) {
+            htable_init(&tables[s].table, sizeof(agroup));
+        }
+        sem_init(&runs_mut, 0, 1);
+    }
+
+    // Charge every group the sketch it is made with
+    sketch_bytes = 0;
+    if (agg == AGG_DISTINCT) {
+        hll *sketch = hll_new();
+        sketch_bytes = sizeof(hll) + (1UL << sketch->precision);
+        free(sketch);
+    } else if (agg == AGG_QUANTILE) {
+        kll *sketch = kll_new();
+        sketch_bytes = sizeof(kll) + 2 * sketch->k * sizeof(int);
+        kll_free(sketch);
+    }
+
+    int len;
+    if (agg == AGG_QUANTILE) {
+        len = snprintf(adhoc_name, ADHOC_NAME_SIZE, "%s(duration) by %s",
+            aggname, groups[group_by]);
+    } else {
+        len = snprintf(adhoc_name, ADHOC_NAME_SIZE, "%s%s by %s", aggs[agg],
+            agg == AGG_COUNT ? "" : agg == AGG_DISTINCT ? "(ip)" :
+            "(duration)", groups[group_by]);
+    }
+    if (where != NULL && len < ADHOC_NAME_SIZE) {
+        len += snprintf(adhoc_name + len, ADHOC_NAME_SIZE - len, " where %s",
+            where);
+    }
+    if (having != NULL && len < ADHOC_NAME_SIZE) {
+        snprintf(adhoc_name + len, ADHOC_NAME_SIZE - len, " having %s",
+            having);
+    }
+
+    adhoc.name = adhoc_name;
+    adhoc.fields = 0;
+    adhoc.select = Q_STATE;
+    adhoc.state_size = group_by == G_IP ? sizeof(atable) :
+        ngroups * sizeof(agroup);
+    adhoc.init = adhoc_init;
+    adhoc.row = kernels[group_by][kernel_of[agg]];
+    adhoc.combine = partial_merge;
+    adhoc.finalize = adhoc_finalize;
+    adhoc.reduce = adhoc_reduce;
+    adhoc.report = adhoc_report;
+    return &adhoc;
+}
@@ -0,0 +1,278 @@
+#include "lott.h"
+#include "affinity.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define NODE_DIR "/sys/devices/system/node"
+
+int use_numa;
+
+// Nodes with cores the process may run on, ordered by id
+static anode nodes[AFFINITY_MAX_NODES];
+static int nnodes;
+
+// Adds the cores of a cpulist such as 0-3,8-11 the process may run on to
+// a node
+static void parse_cpulist(char *list, cpu_set_t *allowed, anode *node) {
+    char *saveptr, *range;
+    int lo, hi;
+
+    for (range = strtok_r(list, ",\n", &saveptr); range != NULL;
+        range = strtok_r(NULL, ",\n", &saveptr)) {
+        int n = sscanf(range, "%d-%d", &lo, &hi);
+        if (n < 1) {
+            continue;
+        }
+        hi = n == 2 ? hi : lo;
+        for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, allowed)) {
+                node->cpus = realloc(node->cpus,
+                    (node->ncpus + 1) * sizeof(int));
+                node->cpus[node->ncpus++] = cpu;
+            }
+        }
+    }
+}
+
+// Compares nodes by id
+static int node_cmp(const void *a, const void *b) {
+    return ((anode*)a)->id - ((anode*)b)->id;
+}
+
+/**
+* Reads the NUMA nodes of the host and the cores of each the process may
+* run on. Hosts without NUMA, or without sysfs, are a single node.
+*
+* @return Number of nodes with cores to run on
+*/
+int affinity_init() {
+    char path[FILENAME_SIZE + 48], list[4096];
+    struct dirent *direp;
+    cpu_set_t allowed;
+    int id;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+
+    // Read the cpulist of every node, skipping nodes of memory only
+    DIR *dir = opendir(NODE_DIR);
+    while (dir != NULL && (direp = readdir(dir)) != NULL &&
+        nnodes < AFFINITY_MAX_NODES) {
+        if (sscanf(direp->d_name, "node%d", &id) != 1) {
+            continue;
+        }
+        sprintf(path, "%s/%s/cpulist", NODE_DIR, direp->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        anode *node = &nodes[nnodes];
+        memset(node, 0, sizeof(anode));
+        node->id = id;
+        if (fgets(list, sizeof(list), file) != NULL) {
+            parse_cpulist(list, &allowed, node);
+        }
+        fclose(file);
+        if (node->ncpus > 0) {
+            ++nnodes;
+        } else {
+            free(node->cpus);
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    qsort(nodes, nnodes, sizeof(anode), node_cmp);
+
+    // Without nodes every core the process may run on is one node
+    if (nnodes == 0) {
+        nodes[0].id = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                nodes[0].cpus = realloc(nodes[0].cpus,
+                    (nodes[0].ncpus + 1) * sizeof(int));
+                nodes[0].cpus[nodes[0].ncpus++] = cpu;
+            }
+        }
+        nnodes = nodes[0].ncpus > 0;
+    }
+
+    return nnodes;
+}
+
+/**
+* Number of nodes workers are placed on, 1 until affinity_init is called
+*
+* @return Number of nodes
+*/
+int affinity_nodes() {
+    return nnodes > 0 ? nnodes : 1;
+}
+
+/**
+* Finds the node a worker is placed on. Workers are spread over the nodes
+* in turn, worker i running on node i % nodes.
+*
+* @param worker Index of the worker
+* @return Index of the node, in [0, affinity_nodes())
+*/
+int affinity_node(int worker) {
+    return worker % affinity_nodes();
+}
+
+/**
+* Pins the calling thread to a core of the node of a worker. Memory the
+* thread touches first is then allocated on its node.
+*
+* @param worker Index of the worker the thread runs as
+* @return 0 on success, negative if the thread could not be pinned
+*/
+int affinity_pin(int worker) {
+    cpu_set_t set;
+
+    if (nnodes == 0) {
+        return -1;
+    }
+
+    // Workers of a node take its cores in turn
+    anode *node = &nodes[affinity_node(worker)];
+    CPU_ZERO(&set);
+    CPU_SET(node->cpus[(worker / nnodes) % node->ncpus], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) ?
+        -1 : 0;
+}
+
+/**
+* Finds the node most of the pages of a data file cached in memory are
+* on, by sampling up to AFFINITY_SAMPLES of its pages
+*
+* @param filename Name of the data file in DATA_DIR
+* @return Index of the node, -1 if none of the sampled pages is cached
+*/
+int affinity_file_node(char *filename) {
+    char filepath[FILENAME_SIZE + 8];
+    void *pages[AFFINITY_SAMPLES];
+    int status[AFFINITY_SAMPLES], votes[AFFINITY_MAX_NODES];
+    unsigned char resident;
+    struct stat st;
+    int npages = 0, best = -1;
+
+    if (nnodes < 2) {
+        return -1;
+    }
+    sprintf(filepath, "./%s/%s", DATA_DIR, filename);
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // Fault in the sampled pages that are cached, pages are only found on
+    // a node once they are mapped
+    long pagesize = sysconf(_SC_PAGESIZE);
+    long total = (st.st_size + pagesize - 1) / pagesize;
+    long step = total > AFFINITY_SAMPLES ? total / AFFINITY_SAMPLES : 1;
+    for (long i = 0; i < total && npages < AFFINITY_SAMPLES; i += step) {
+        char *page = map + i * pagesize;
+        if (mincore(page, pagesize, &resident) == 0 && (resident & 1)) {
+            (void)*(volatile char*)page;
+            pages[npages++] = page;
+        }
+    }
+
+    // Ask the kernel which node each page is on
+    memset(votes, 0, sizeof(votes));
+    if (npages > 0 && syscall(SYS_move_pages, 0, npages, pages, NULL, status,
+        0) == 0) {
+        for (int i = 0; i < npages; ++i) {
+            for (int n = 0; n < nnodes; ++n) {
+                if (status[i] == nodes[n].id) {
+                    ++votes[n];
+                }
+            }
+        }
+        for (int n = 0; n < nnodes; ++n) {
+            if (votes[n] > 0 && (best < 0 || votes[n] > votes[best])) {
+                best = n;
+            }
+        }
+    }
+
+    munmap(map, st.st_size);
+    return best;
+}
+
+/**
+* Orders files so each worker's share of them is, where possible, cached
+* on the node the worker runs on. Worker w takes the next counts[w] files
+* of the order, as the parts divide their file lists.
+*
+* @param filenames Names of the data files in DATA_DIR
+* @param nfiles Number of files
+* @param counts Number of files of each worker
+* @param nworkers Number of workers
+* @param order Array of nfiles to store the indices of the files in, in
+* the order the workers take them
+*/
+void affinity_assign(char **filenames, int nfiles, int *counts, int nworkers,
+    int *order) {
+    int *fnodes = malloc(nfiles * sizeof(int));
+    char *taken = calloc(nfiles, 1);
+    int norder = 0;
+
+    for (int i = 0; i < nfiles; ++i) {
+        fnodes[i] = affinity_file_node(filenames[i]);
+    }
+
+    // Give each worker the files cached on its node first, then files not
+    // cached anywhere, then whatever is left
+    for (int w = 0; w < nworkers; ++w) {
+        int node = affinity_node(w), left = counts[w];
+        for (int pass = 0; pass < 3 && left > 0; ++pass) {
+            for (int i = 0; i < nfiles && left > 0; ++i) {
+                if (taken[i] || (pass == 0 && fnodes[i] != node) ||
+                    (pass == 1 && fnodes[i] >= 0)) {
+                    continue;
+                }
+                taken[i] = 1;
+                order[norder++] = i;
+                --left;
+            }
+        }
+    }
+
+    // Files no worker was given keep their place at the end
+    for (int i = 0; i < nfiles; ++i) {
+        if (!taken[i]) {
+            order[norder++] = i;
+        }
+    }
+
+    free(fnodes);
+    free(taken);
+}
+
+/**
+* Allocates the query state of a file if it is not allocated yet, called
+* by a pinned worker so it is on its node. Country histograms are
+* allocated by the first count in them, on the worker counting.
+*
+* @param state Pointer to the query state of the file
+*/
+void affinity_alloc(void **state) {
+    if (*state == NULL && current_query->state_size) {
+        *state = calloc(1, current_query->state_size);
+    }
+}
@@ -0,0 +1,405 @@
+#include "lott.h"
+#include "cache.h"
+#include "country.h"
+#include "filter.h"
+#include "zfile.h"
+
+#include <time.h>
+
+int use_cache, cache_append;
+sem_t mut_cache;
+unsigned int cache_checkpoint;
+
+// Open addressing table of cache entries, keyed by device and inode
+static centry *table;
+static size_t nslots, nused;
+
+// Set once the table has been loaded from disk
+static int cache_loaded;
+
+// Number of stores into the table, and of those it was last written with
+static unsigned long nstores, nsaved;
+
+// Checkpoint thread, and the semaphore that stops it
+static pthread_t checkpoint_thread;
+static sem_t checkpoint_stop;
+static int checkpointing;
+
+/**
+* On-disk cache record, followed by the number of countries of the file and
+* their cpacked counts when fields has P_COUNTRY set
+*/
+typedef struct crecord {
+    char filename[FILENAME_SIZE];
+    unsigned long dev;
+    unsigned long ino;
+    long size;
+    long mtime_sec;
+    long mtime_nsec;
+    int fields;
+    unsigned long nvisits;
+    unsigned long duration;
+    unsigned long used_years;
+} crecord;
+
+// Hashes a file identity to a slot of the table
+static size_t cache_slot(dev_t dev, ino_t ino) {
+    unsigned long h = ((unsigned long)dev * 31 + ino) * 0x9E3779B97F4A7C15UL;
+    return (h >> 17) & (nslots - 1);
+}
+
+// Finds the entry for a file identity, returns NULL if none exists
+static centry *cache_find(dev_t dev, ino_t ino) {
+    if (nslots == 0) {
+        return NULL;
+    }
+    for (size_t i = cache_slot(dev, ino);; i = (i + 1) & (nslots - 1)) {
+        if (table[i].filename[0] == '\0') {
+            return NULL;
+        }
+        if (table[i].dev == dev && table[i].ino == ino) {
+            return &table[i];
+        }
+    }
+}
+
+// Finds or claims the entry for a file identity, growing the table
+// when it is half full
+static centry *cache_insert(dev_t dev, ino_t ino) {
+    centry *entry = cache_find(dev, ino);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    // Rehash into a table twice the size
+    if ((nused + 1) * 2 > nslots) {
+        centry *old = table;
+        size_t nold = nslots;
+        nslots = nslots ? nslots << 1 : CACHE_MIN_SLOTS;
+        table = calloc(nslots, sizeof(centry));
+        for (size_t i = 0; i < nold; ++i) {
+            if (old[i].filename[0] != '\0') {
+                size_t j = cache_slot(old[i].dev, old[i].ino);
+                while (table[j].filename[0] != '\0') {
+                    j = (j + 1) & (nslots - 1);
+                }
+                table[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    size_t i = cache_slot(dev, ino);
+    while (table[i].filename[0] != '\0') {
+        i = (i + 1) & (nslots - 1);
+    }
+    ++nused;
+    table[i].dev = dev;
+    table[i].ino = ino;
+    return &table[i];
+}
+
+// Returns 1 if entry still describes the file st was taken of
+static int cache_match(centry *entry, struct stat *st) {
+    return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+        entry->size == st->st_size &&
+        entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Sets the identity of entry to the file st was taken of
+static void cache_identify(centry *entry, char *filename, struct stat *st) {
+    strncpy(entry->filename, filename, FILENAME_SIZE - 1);
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+}
+
+/**
+* Loads the result cache from the sidecar directory of DATA_DIR, entries
+* of files that have since been removed or changed are dropped. The cache
+* is only loaded once, later calls keep the entries in memory, which are
+* at least as new as those on disk.
+*/
+void cache_load() {
+    if (!use_cache || cache_loaded) {
+        return;
+    }
+    sem_init(&mut_cache, 0, 1);
+    cache_loaded = 1;
+
+    FILE *file = fopen("./" DATA_DIR "/" SIDECAR_DIR "/" CACHE_FILENAME, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    // Check the cache was written by this version
+    unsigned long header[2];
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        header[0] != CACHE_MAGIC) {
+        fclose(file);
+        return;
+    }
+
+    crecord record;
+    char filepath[FILENAME_SIZE + 8];
+    struct stat st;
+    cpacked packed[CCOUNT_SIZE];
+    unsigned long npacked;
+    chist einfo;
+    for (unsigned long i = 0; i < header[1]; ++i) {
+        if (fread(&record, sizeof(crecord), 1, file) != 1) {
+            break;
+        }
+        memset(&einfo, 0, sizeof(chist));
+        if ((record.fields & P_COUNTRY) &&
+            (fread(&npacked, sizeof(long), 1, file) != 1 ||
+            npacked > CCOUNT_SIZE ||
+            fread(packed, sizeof(cpacked), npacked, file) != npacked ||
+            country_unpack(packed, npacked, &einfo) < 0)) {
+            country_free(&einfo);
+            break;
+        }
+
+        // Drop entries of files that are gone or have changed, grown files
+        // are kept when only their tails need mapping
+        record.filename[FILENAME_SIZE - 1] = '\0';
+        sprintf(filepath, "./%s/%s", DATA_DIR, record.filename);
+        if (stat(filepath, &st) < 0 || st.st_dev != record.dev ||
+            st.st_ino != record.ino || ((st.st_size != record.size ||
+            st.st_mtim.tv_sec != record.mtime_sec ||
+            st.st_mtim.tv_nsec != record.mtime_nsec) &&
+            !(cache_append && st.st_size > record.size))) {
+            country_free(&einfo);
+            continue;
+        }
+
+        centry *entry = cache_insert(st.st_dev, st.st_ino);
+        strcpy(entry->filename, record.filename);
+        entry->size = record.size;
+        entry->mtime.tv_sec = record.mtime_sec;
+        entry->mtime.tv_nsec = record.mtime_nsec;
+        entry->partial.fields = record.fields;
+        entry->partial.nvisits = record.nvisits;
+        entry->partial.duration = record.duration;
+        entry->partial.used_years = record.used_years;
+        country_free(&entry->einfo);
+        entry->einfo = einfo;
+    }
+
+    fclose(file);
+}
+
+// Copies the table into the records of a cache file, so it is written
+// without holding up cache lookups and stores. Returns the buffer and sets
+// size to its length.
+static char *cache_copy(size_t *size) {
+    sem_wait(&mut_cache);
+    nsaved = nstores;
+
+    // Size for every entry having every country seen
+    char *buf = malloc(2 * sizeof(long) + nused * (sizeof(crecord) +
+        sizeof(long) + country_count() * sizeof(cpacked)));
+    unsigned long header[2] = {CACHE_MAGIC, nused};
+    memcpy(buf, header, sizeof(header));
+    *size = sizeof(header);
+
+    crecord record;
+    for (size_t i = 0; i < nslots; ++i) {
+        centry *entry = &table[i];
+        if (entry->filename[0] == '\0') {
+            continue;
+        }
+
+        memset(&record, 0, sizeof(crecord));
+        strcpy(record.filename, entry->filename);
+        record.dev = entry->dev;
+        record.ino = entry->ino;
+        record.size = entry->size;
+        record.mtime_sec = entry->mtime.tv_sec;
+        record.mtime_nsec = entry->mtime.tv_nsec;
+        record.fields = entry->partial.fields;
+        record.nvisits = entry->partial.nvisits;
+        record.duration = entry->partial.duration;
+        record.used_years = entry->partial.used_years;
+        memcpy(buf + *size, &record, sizeof(crecord));
+        *size += sizeof(crecord);
+        if (record.fields & P_COUNTRY) {
+            unsigned long npacked = country_pack(&entry->einfo,
+                (cpacked*)(buf + *size + sizeof(long)));
+            memcpy(buf + *size, &npacked, sizeof(long));
+            *size += sizeof(long) + npacked * sizeof(cpacked);
+        }
+    }
+    sem_post(&mut_cache);
+
+    return buf;
+}
+
+/**
+* Writes the result cache back to the sidecar directory of DATA_DIR
+*/
+void cache_save() {
+    size_t size;
+
+    if (!use_cache) {
+        return;
+    }
+    char *buf = cache_copy(&size);
+
+    // Write to a temporary file first so a crash never leaves a torn cache
+    mkdir("./" DATA_DIR "/" SIDECAR_DIR, 0755);
+    FILE *file = fopen("./" DATA_DIR "/" SIDECAR_DIR "/" CACHE_FILENAME ".tmp",
+        "w");
+    if (file == NULL) {
+        query_log("%s: %s", "Could not write result cache", strerror(errno));
+        free(buf);
+        return;
+    }
+    size_t written = fwrite(buf, 1, size, file);
+    if (fclose(file) != 0 || written != size) {
+        query_log("%s: %s", "Could not write result cache", strerror(errno));
+    } else {
+        rename("./" DATA_DIR "/" SIDECAR_DIR "/" CACHE_FILENAME ".tmp",
+            "./" DATA_DIR "/" SIDECAR_DIR "/" CACHE_FILENAME);
+    }
+    free(buf);
+}
+
+// Writes the cache every cache_checkpoint seconds while files were stored
+// since it was last written, until cache_checkpoint_stop
+static void *checkpoint_loop(void *arg) {
+    struct timespec deadline;
+
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += cache_checkpoint;
+        if (sem_timedwait(&checkpoint_stop, &deadline) == 0) {
+            return NULL;
+        }
+        if (errno != ETIMEDOUT) {
+            continue;
+        }
+
+        sem_wait(&mut_cache);
+        int changed = nstores != nsaved;
+        sem_post(&mut_cache);
+        if (changed) {
+            cache_save();
+        }
+    }
+}
+
+/**
+* Starts writing the result cache every cache_checkpoint seconds from a
+* thread of its own, so a run that dies can resume with the files it had
+* mapped. Map threads only wait for the cache to be copied, not written.
+*/
+void cache_checkpoint_start() {
+    if (!use_cache || cache_checkpoint == 0 || checkpointing) {
+        return;
+    }
+    sem_init(&checkpoint_stop, 0, 0);
+    int err = pthread_create(&checkpoint_thread, NULL, checkpoint_loop, NULL);
+    if (err != 0) {
+        query_log("%s: %s", "Could not start checkpoints", strerror(err));
+        return;
+    }
+    checkpointing = 1;
+}
+
+/**
+* Stops the checkpoints of cache_checkpoint_start, waiting for one being
+* written
+*/
+void cache_checkpoint_stop() {
+    if (!checkpointing) {
+        return;
+    }
+    sem_post(&checkpoint_stop);
+    pthread_join(checkpoint_thread, NULL);
+    sem_destroy(&checkpoint_stop);
+    checkpointing = 0;
+}
+
+/**
+* Looks up cached partials for a data file, fills st with the identity of
+* the file for a following cache_store. With cache_append set, partials of
+* a file that has grown since it was cached are returned as well.
+*
+* @param filepath Path of the data file
+* @param st Pointer to stat struct to store the file identity in
+* @param partial Pointer to pinfo to copy cached partials to
+* @param einfo Country histogram to copy cached counts to
+* @return Number of bytes at the start of the file the copied partials
+* cover, 0 if none of the partials current_query needs were cached
+*/
+off_t cache_lookup(char *filepath, struct stat *st, pinfo *partial,
+    chist *einfo) {
+    int fields = current_query->fields;
+    off_t covered = 0;
+
+    memset(partial, 0, sizeof(pinfo));
+    if (stat(filepath, st) < 0) {
+        memset(st, 0, sizeof(struct stat));
+        return 0;
+    }
+    if (!use_cache || fields == 0 || use_filter) {
+        return 0;
+    }
+
+    sem_wait(&mut_cache);
+    centry *entry = cache_find(st->st_dev, st->st_ino);
+    if (entry != NULL && (entry->partial.fields & fields) == fields &&
+        (cache_match(entry, st) ||
+        (cache_append && entry->size < st->st_size &&
+        !zcompressed(filepath)))) {
+        *partial = entry->partial;
+        if (fields & P_COUNTRY) {
+            country_copy(einfo, &entry->einfo);
+        }
+        covered = entry->size;
+    }
+    sem_post(&mut_cache);
+
+    return covered;
+}
+
+/**
+* Stores freshly mapped partials of a data file, merging them with the
+* cached fields of other queries if the file is unchanged
+*
+* @param filepath Path of the data file
+* @param st Identity of the file, st_size being the number of bytes mapped
+* @param partial Pointer to partials to store
+* @param einfo Country histogram to store, only read if P_COUNTRY is set
+*/
+void cache_store(char *filepath, struct stat *st, pinfo *partial,
+    chist *einfo) {
+    if (!use_cache || partial->fields == 0 || use_filter) {
+        return;
+    }
+
+    sem_wait(&mut_cache);
+    centry *entry = cache_insert(st->st_dev, st->st_ino);
+
+    // File changed since it was cached - start over
+    if (!cache_match(entry, st)) {
+        entry->partial.fields = 0;
+    }
+    cache_identify(entry, strrchr(filepath, '/') + 1, st);
+
+    // Merge the new fields with those cached by other queries
+    entry->partial.fields |= partial->fields;
+    entry->partial.nvisits = partial->nvisits;
+    if (partial->fields & P_DURATION) {
+        entry->partial.duration = partial->duration;
+    }
+    if (partial->fields & P_YEARS) {
+        entry->partial.used_years = partial->used_years;
+    }
+    if (partial->fields & P_COUNTRY) {
+        country_copy(&entry->einfo, einfo);
+    }
+    ++nstores;
+    sem_post(&mut_cache);
+}
@@ -0,0 +1,199 @@
+#include "lott.h"
+#include "channel.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+size_t chan_capacity = CHAN_CAPACITY, chan_batch = CHAN_BATCH;
+
+/**
+* Opens a channel of chan_capacity records
+*
+* @param ch Pointer to channel to open
+* @param transport CHAN_MEMORY, CHAN_FILE or CHAN_SOCKET
+* @param size Size of a record
+* @param path Path of the ring file of a file channel, else NULL
+* @return 0 on success, negative if the file or socket could not be made
+*/
+int chan_open(channel *ch, int transport, size_t size, char *path) {
+    memset(ch, 0, sizeof(channel));
+    ch->transport = transport;
+    ch->capacity = chan_capacity;
+    ch->size = size;
+    ch->fds[0] = ch->fds[1] = -1;
+
+    if (transport == CHAN_MEMORY) {
+        ch->ring = malloc(ch->capacity * size);
+    } else if (transport == CHAN_FILE) {
+        if ((ch->fds[0] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+            return -1;
+        }
+        ch->path = strdup(path);
+    } else if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ch->fds) < 0) {
+        return -1;
+    }
+
+    sem_init(&ch->mut, 0, 1);
+    sem_init(&ch->slots, 0, ch->capacity);
+    sem_init(&ch->filled, 0, 0);
+    return 0;
+}
+
+// Copies n records starting at slot head out of the ring of a memory or
+// file channel, in two runs if they wrap around its end. Returns negative
+// if the ring file could not be read.
+static int ring_read(channel *ch, char *records, size_t head, size_t n) {
+    while (n > 0) {
+        size_t slot = head % ch->capacity;
+        size_t run = ch->capacity - slot < n ? ch->capacity - slot : n;
+        if (ch->transport == CHAN_MEMORY) {
+            memcpy(records, ch->ring + slot * ch->size, run * ch->size);
+        } else if (pread(ch->fds[0], records, run * ch->size,
+            slot * ch->size) != run * ch->size) {
+            return -1;
+        }
+        records += run * ch->size;
+        head += run;
+        n -= run;
+    }
+    return 0;
+}
+
+/**
+* Sends a record, waiting while the channel is full. A record that could
+* not be sent fails the run and gives its slot back.
+*
+* @param ch Pointer to channel to send on
+* @param record Record to send, size bytes
+* @return 0 on success, negative if the record could not be sent
+*/
+int chan_send(channel *ch, void *record) {
+    // Wait for a free slot, holding the sender back while the receiver
+    // catches up
+    while (sem_wait(&ch->slots) < 0) {
+    }
+
+    if (ch->transport == CHAN_SOCKET) {
+        // Messages keep their bounds, a blocked send must not hold the lock
+        // the receiver takes
+        while (send(ch->fds[1], record, ch->size, 0) < 0) {
+            if (errno != EINTR) {
+                query_fail("Could not send to channel", errno);
+                sem_post(&ch->slots);
+                return -1;
+            }
+        }
+        sem_wait(&ch->mut);
+    } else {
+        sem_wait(&ch->mut);
+        size_t slot = ch->tail % ch->capacity;
+        if (ch->transport == CHAN_MEMORY) {
+            memcpy(ch->ring + slot * ch->size, record, ch->size);
+        } else if (pwrite(ch->fds[0], record, ch->size, slot * ch->size) !=
+            ch->size) {
+            query_fail("Could not write channel", errno);
+            sem_post(&ch->mut);
+            sem_post(&ch->slots);
+            return -1;
+        }
+    }
+    ++ch->tail;
+    sem_post(&ch->mut);
+
+    sem_post(&ch->filled);
+    return 0;
+}
+
+// Takes the records waiting on a channel, waiting for at least one. Sets
+// failed if any of them could not be read, they are taken all the same.
+static size_t chan_take(channel *ch, void *records, size_t max,
+    int *failed) {
+    size_t n = 1, head;
+
+    // Wait for the first record, then take every other one ready
+    *failed = 0;
+    while (sem_wait(&ch->filled) < 0) {
+    }
+    while (n < max && sem_trywait(&ch->filled) == 0) {
+        ++n;
+    }
+
+    // A wakeup without a record is chan_close, leave it for the next call
+    sem_wait(&ch->mut);
+    head = ch->head;
+    if (n > ch->tail - head) {
+        n = ch->tail - head;
+        sem_post(&ch->filled);
+    }
+    if (ch->transport != CHAN_SOCKET && ring_read(ch, records, head, n) < 0) {
+        query_fail("Could not read channel", errno);
+        *failed = 1;
+    }
+    ch->head += n;
+    sem_post(&ch->mut);
+
+    // Every message is taken off the socket so the next ones stay in order
+    for (size_t i = 0; i < n; ++i) {
+        if (ch->transport == CHAN_SOCKET &&
+            recv(ch->fds[0], (char*)records + i * ch->size, ch->size, 0) !=
+            ch->size) {
+            if (!*failed) {
+                query_fail("Could not receive from channel", errno);
+            }
+            *failed = 1;
+        }
+        sem_post(&ch->slots);
+    }
+    return n;
+}
+
+/**
+* Receives the records waiting on a channel, waiting for at least one.
+* Records that could not be read fail the run and are dropped.
+*
+* @param ch Pointer to channel to receive from
+* @param records Array of max records to store them in
+* @param max Most records to receive
+* @return Number of records received, 0 once the channel is closed and
+* every record has been received
+*/
+size_t chan_recv(channel *ch, void *records, size_t max) {
+    size_t n;
+    int failed;
+
+    // Drop records that could not be read and wait for the next ones
+    while ((n = chan_take(ch, records, max, &failed)) > 0 && failed) {
+    }
+    return n;
+}
+
+/**
+* Closes a channel once every sender is done, its receiver then returns
+* from chan_recv after the last record
+*
+* @param ch Pointer to channel to close
+*/
+void chan_close(channel *ch) {
+    sem_post(&ch->filled);
+}
+
+/**
+* Frees a channel, removing the ring file of a file channel
+*
+* @param ch Pointer to channel to free
+*/
+void chan_free(channel *ch) {
+    for (int i = 0; i < 2; ++i) {
+        if (ch->fds[i] >= 0) {
+            close(ch->fds[i]);
+        }
+    }
+    if (ch->path != NULL) {
+        unlink(ch->path);
+        free(ch->path);
+    }
+    free(ch->ring);
+    sem_destroy(&ch->mut);
+    sem_destroy(&ch->slots);
+    sem_destroy(&ch->filled);
+}
@@ -0,0 +1,498 @@
+#include "lott.h"
+#include "columnar.h"
+#include "country.h"
+#include "filter.h"
+#include "parse.h"
+#include "reader.h"
+#include "stats.h"
+#include "zfile.h"
+#include "zone.h"
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <time.h>
+
+typedef long v4l __attribute__((vector_size(32)));
+typedef unsigned long v4ul __attribute__((vector_size(32)));
+typedef unsigned int v4ui __attribute__((vector_size(16)));
+
+/**
+* Growable columns of a file being converted
+*/
+typedef struct colbuf {
+    long *ts;
+    unsigned int *dur;
+    unsigned short *country;
+    unsigned long nrows;
+    unsigned long size;
+} colbuf;
+
+// Directory being converted, shared by all converting threads
+static DIR *convert_dir;
+static sem_t mut_convert;
+static int nconverted;
+
+static void col_reduce(long *ts, unsigned int *dur, unsigned short *country,
+    unsigned long n, long ts_min, long ts_max, int fields, pinfo *partial,
+    chist *einfo);
+
+// Appends a row to the columns, doubling them when full
+static void col_append(colbuf *buf, long ts, unsigned int dur,
+    unsigned short country) {
+    if (buf->nrows == buf->size) {
+        buf->size = buf->size ? buf->size << 1 : COL_MIN_ROWS;
+        buf->ts = realloc(buf->ts, buf->size * sizeof(long));
+        buf->dur = realloc(buf->dur, buf->size * sizeof(int));
+        buf->country = realloc(buf->country, buf->size * sizeof(short));
+    }
+    buf->ts[buf->nrows] = ts;
+    buf->dur[buf->nrows] = dur;
+    buf->country[buf->nrows] = country;
+    ++buf->nrows;
+}
+
+// Converts a single csv file in DATA_DIR, returns 0 on success
+static int col_convert_file(char *filename) {
+    char filepath[FILENAME_SIZE + 16], colpath[FILENAME_SIZE + 32];
+    char *lines[COL_BATCH], *ends[COL_BATCH], *rest, *cols[CSV_NCOLS];
+    char *tsstrs[COL_BATCH], *durstrs[COL_BATCH], *codes[COL_BATCH];
+    size_t raws[COL_BATCH];
+    unsigned long tss[COL_BATCH], durs[COL_BATCH];
+    long offset = 0, lineoffs[COL_BATCH];
+    int tslens[COL_BATCH], durlens[COL_BATCH], nlines, nbatch;
+    struct stat st;
+    lreader reader;
+    colbuf buf;
+    colheader header;
+    zheader zheader;
+    zone *zones = NULL;
+
+    sprintf(filepath, "./%s/%s", DATA_DIR, filename);
+    if (stat(filepath, &st) < 0) {
+        query_log("%s: %s", filepath, strerror(errno));
+        return -1;
+    }
+    FILE *file = zopen(filepath, 0);
+    if (file == NULL) {
+        return -1;
+    }
+
+    memset(&buf, 0, sizeof(colbuf));
+    memset(&header, 0, sizeof(colheader));
+    header.magic = COL_MAGIC;
+    header.ts_min = 0x7FFFFFFFFFFFFFFFL;
+    header.dur_min = 0xFFFFFFFF;
+    header.src_size = st.st_size;
+    header.src_mtime_sec = st.st_mtim.tv_sec;
+    header.src_mtime_nsec = st.st_mtim.tv_nsec;
+
+    // Zone offsets are only known in uncompressed files
+    memset(&zheader, 0, sizeof(zheader));
+    int use_zones = !zcompressed(filepath);
+
+    // For all batches of lines in file
+    reader_init(&reader, file);
+    while ((nlines = reader_lines(&reader, lines, ends, raws, COL_BATCH)) > 0) {
+        // Split lines into their columns, skipping malformed rows
+        nbatch = 0;
+        for (int i = 0; i < nlines; ++i) {
+            lineoffs[nbatch] = offset;
+            offset += raws[i];
+            if (lines[i] == ends[i]) {
+                continue;
+            }
+            if ((rest = csv_timestamp(lines[i], ends[i], cols)) == NULL ||
+                csv_rest(rest, ends[i], cols) < 0) {
+                reader_reject(filename, lines[i], ends[i]);
+                continue;
+            }
+            // Columns are split in place, each ends a byte before the next
+            tsstrs[nbatch] = cols[CSV_TIMESTAMP];
+            tslens[nbatch] = cols[CSV_IP] - cols[CSV_TIMESTAMP] - 1;
+            durstrs[nbatch] = cols[CSV_DURATION];
+            durlens[nbatch] = cols[CSV_COUNTRY] - cols[CSV_DURATION] - 1;
+            codes[nbatch] = cols[CSV_COUNTRY];
+            ++nbatch;
+        }
+
+        // Convert the timestamp and duration columns of the batch at once
+        parse_uints(tsstrs, tslens, nbatch, tss);
+        parse_uints(durstrs, durlens, nbatch, durs);
+
+        for (int i = 0; i < nbatch; ++i) {
+            long ts = tss[i];
+            unsigned int dur = durs[i];
+
+            // Turn country code into an index, marking codes out of range
+            long ind = country_index(codes[i]);
+            unsigned short country = ind < 0 ? COL_NONE : ind;
+
+            // Start a zone every ZONE_ROWS rows
+            if (use_zones && buf.nrows % ZONE_ROWS == 0) {
+                zones = realloc(zones, (zheader.nzones + 1) * sizeof(zone));
+                zones[zheader.nzones].offset = lineoffs[i];
+                zones[zheader.nzones].ts_min = ts;
+                zones[zheader.nzones].ts_max = ts;
+                ++zheader.nzones;
+            }
+            if (use_zones) {
+                zone *z = &zones[zheader.nzones - 1];
+                z->ts_min = ts < z->ts_min ? ts : z->ts_min;
+                z->ts_max = ts > z->ts_max ? ts : z->ts_max;
+            }
+
+            col_append(&buf, ts, dur, country);
+            header.ts_min = ts < header.ts_min ? ts : header.ts_min;
+            header.ts_max = ts > header.ts_max ? ts : header.ts_max;
+            header.dur_min = dur < header.dur_min ? dur : header.dur_min;
+            header.dur_max = dur > header.dur_max ? dur : header.dur_max;
+        }
+    }
+    reader_free(&reader);
+    zclose(file, st.st_size);
+    header.nrows = buf.nrows;
+
+    // Write columns to a temporary file, then move it in place
+    mkdir("./" DATA_DIR "/" SIDECAR_DIR, 0755);
+    sprintf(colpath, "./%s/%s/%s%s.tmp", DATA_DIR, SIDECAR_DIR, filename,
+        COL_SUFFIX);
+    file = fopen(colpath, "w");
+    int r = -1;
+    if (file != NULL) {
+        fwrite(&header, sizeof(colheader), 1, file);
+        fwrite(buf.ts, sizeof(long), buf.nrows, file);
+        fwrite(buf.dur, sizeof(int), buf.nrows, file);
+        fwrite(buf.country, sizeof(short), buf.nrows, file);
+        if (fclose(file) == 0) {
+            strcpy(filepath, colpath);
+            colpath[strlen(colpath) - 4] = '\0';
+            r = rename(filepath, colpath);
+        }
+    }
+    if (r < 0) {
+        query_log("%s: %s", colpath, strerror(errno));
+    }
+
+    // Pre-aggregate every field into the stats sidecar of the file
+    else {
+        pinfo partial = {0};
+        chist ccount = {0};
+        col_reduce(buf.ts, buf.dur, buf.country, buf.nrows, header.ts_min,
+            header.ts_max, P_DURATION | P_YEARS | P_COUNTRY, &partial,
+            &ccount);
+        stats_store(filename, &st, &partial, &ccount,
+            &(srange){header.ts_min, header.ts_max, header.dur_min,
+            header.dur_max});
+        country_free(&ccount);
+
+        // Map the timestamps of chunks of the file for filtered runs
+        if (use_zones) {
+            zheader.magic = ZONE_MAGIC;
+            zheader.ts_min = header.ts_min;
+            zheader.ts_max = header.ts_max;
+            zheader.src_size = header.src_size;
+            zheader.src_mtime_sec = header.src_mtime_sec;
+            zheader.src_mtime_nsec = header.src_mtime_nsec;
+            zone_store(filename, &zheader, zones);
+        }
+    }
+
+    free(buf.ts), free(buf.dur), free(buf.country), free(zones);
+    return r;
+}
+
+// Start routine of converting threads, converts files until every file in
+// the directory has been taken
+static void *col_convert_files(void *v) {
+    char filename[FILENAME_SIZE];
+    struct dirent *direp;
+
+    while (1) {
+        // Take the next file of the directory
+        sem_wait(&mut_convert);
+        if ((direp = readdir(convert_dir)) != NULL) {
+            strcpy(filename, direp->d_name);
+        }
+        sem_post(&mut_convert);
+        if (direp == NULL) {
+            break;
+        }
+        if (filename[0] == '.') {
+            continue;
+        }
+
+        if (col_convert_file(filename) == 0) {
+            sem_wait(&mut_convert);
+            ++nconverted;
+            sem_post(&mut_convert);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+* Converts every file in DATA_DIR to a columnar file in its sidecar
+* directory, writing the stats sidecar of each file along the way
+*
+* @param nthreads Number of converting threads
+* @return Number of files converted, negative on error
+*/
+int col_convert(size_t nthreads) {
+    if (nthreads < 1 || (convert_dir = opendir(DATA_DIR)) == NULL) {
+        return -1;
+    }
+    sem_init(&mut_convert, 0, 1);
+    nconverted = 0;
+
+    pthread_t t_converters[nthreads];
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_create(&t_converters[i], NULL, col_convert_files, NULL);
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(t_converters[i], NULL);
+    }
+
+    closedir(convert_dir);
+    return nconverted;
+}
+
+// Sums the duration column, eight rows at a time into two vector
+// accumulators
+static unsigned long col_sum(unsigned int *dur, unsigned long n) {
+    v4ul acc0 = {0, 0, 0, 0}, acc1 = {0, 0, 0, 0};
+    v4ui a, b;
+    unsigned long i = 0, sum = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&a, dur + i, sizeof(v4ui));
+        memcpy(&b, dur + i + 4, sizeof(v4ui));
+        acc0 += __builtin_convertvector(a, v4ul);
+        acc1 += __builtin_convertvector(b, v4ul);
+    }
+    acc0 += acc1;
+    sum = acc0[0] + acc0[1] + acc0[2] + acc0[3];
+
+    // Rows left over
+    for (; i < n; ++i) {
+        sum += dur[i];
+    }
+    return sum;
+}
+
+// Finds the bit array of years used in the timestamp column, bit 0 being
+// 1970. Years are found by comparing four timestamps at a time against the
+// starts of the years between ts_min and ts_max.
+static unsigned long col_years(long *ts, unsigned long n, long ts_min,
+    long ts_max) {
+    time_t t;
+    struct tm tm;
+    long starts[64];
+    int first, nstarts = 0;
+    unsigned long used_years = 0, i = 0;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    // Find first and last year of the file
+    t = ts_min;
+    localtime_r(&t, &tm);
+    first = tm.tm_year;
+    t = ts_max;
+    localtime_r(&t, &tm);
+
+    // Find where every year after the first starts
+    for (int year = first + 1; year <= tm.tm_year && nstarts < 63; ++year) {
+        struct tm start = {.tm_year = year, .tm_mday = 1, .tm_isdst = -1};
+        starts[nstarts++] = mktime(&start);
+    }
+    first -= 70;
+    if (nstarts == 0) {
+        return 1UL << first;
+    }
+
+    v4l x, idx;
+    for (; i + 4 <= n; i += 4) {
+        memcpy(&x, ts + i, sizeof(v4l));
+        idx = (v4l){0, 0, 0, 0};
+        for (int k = 0; k < nstarts; ++k) {
+            // Comparison is -1 for every timestamp past the start
+            idx -= x >= starts[k];
+        }
+        used_years |= (1UL << (first + idx[0])) | (1UL << (first + idx[1])) |
+            (1UL << (first + idx[2])) | (1UL << (first + idx[3]));
+    }
+
+    // Rows left over
+    for (; i < n; ++i) {
+        int k = 0;
+        while (k < nstarts && ts[i] >= starts[k]) {
+            ++k;
+        }
+        used_years |= 1UL << (first + k);
+    }
+    return used_years;
+}
+
+// Counts the country column into a histogram. Consecutive rows count into
+// four separate tables of the first CCOUNT_MIN_SLOTS slots so runs of the
+// same country do not wait on each other's increments, the tables are
+// added up at the end. Countries in later slots and codes out of range go
+// to the histogram row by row.
+static void col_countries(unsigned short *country, unsigned long n,
+    chist *einfo) {
+    unsigned long counts[4][CCOUNT_MIN_SLOTS];
+    unsigned long i = 0;
+
+    memset(counts, 0, sizeof(counts));
+    for (; i < n; ++i) {
+        unsigned short c = country[i];
+        if (c >= CCOUNT_SIZE) {
+            continue;
+        }
+        long slot = country_slot(c);
+        if (slot < CCOUNT_MIN_SLOTS) {
+            ++counts[i & 3][slot];
+        } else {
+            country_add(einfo, slot, 1);
+        }
+    }
+
+    for (int s = CCOUNT_MIN_SLOTS - 1; s >= 0; --s) {
+        unsigned long count = counts[0][s] + counts[1][s] + counts[2][s] +
+            counts[3][s];
+        if (count != 0) {
+            country_add(einfo, s, count);
+        }
+    }
+}
+
+// Adds n rows of columns with timestamps in [ts_min, ts_max] to the
+// partial fields asked for
+static void col_reduce(long *ts, unsigned int *dur, unsigned short *country,
+    unsigned long n, long ts_min, long ts_max, int fields, pinfo *partial,
+    chist *einfo) {
+    partial->fields = fields;
+    partial->nvisits += n;
+    if (fields & P_DURATION) {
+        partial->duration += col_sum(dur, n);
+    }
+    if (fields & P_YEARS) {
+        partial->used_years |= col_years(ts, n, ts_min, ts_max);
+    }
+    if (fields & P_COUNTRY) {
+        col_countries(country, n, einfo);
+    }
+}
+
+/**
+* Maps a data file from its columnar conversion, if one exists that is
+* as recent as the file. Filtered runs are only mapped when the zone map
+* of the file tells every chunk passes the filter whole or not at all.
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param partial Pointer to pinfo to store the partials current_query
+* needs in
+* @param einfo Country histogram to add counts to, only written for E
+* @return 1 if the file was mapped from its columns, else 0
+*/
+int col_map(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo) {
+    char colpath[FILENAME_SIZE + 32];
+    struct stat cst;
+    colheader *header;
+    zheader zh;
+    zone *zones = NULL, whole;
+
+    if (current_query->fields == 0) {
+        return 0;
+    }
+    sprintf(colpath, "./%s/%s/%s%s", DATA_DIR, SIDECAR_DIR, filename,
+        COL_SUFFIX);
+    int fd = open(colpath, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &cst) < 0 || cst.st_size < sizeof(colheader)) {
+        close(fd);
+        return 0;
+    }
+    header = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        return 0;
+    }
+
+    // Ignore columns of an older version of the file
+    if (header->magic != COL_MAGIC || header->src_size != st->st_size ||
+        header->src_mtime_sec != st->st_mtim.tv_sec ||
+        header->src_mtime_nsec != st->st_mtim.tv_nsec ||
+        cst.st_size != sizeof(colheader) + header->nrows *
+        (sizeof(long) + sizeof(int) + sizeof(short))) {
+        munmap(header, cst.st_size);
+        return 0;
+    }
+    madvise(header, cst.st_size, MADV_SEQUENTIAL);
+
+    // Rows out of the years used_years has bits for are rejected row by
+    // row when the file itself is scanned
+    if ((current_query->fields & P_YEARS) && header->nrows > 0 &&
+        !query_years(header->ts_min, header->ts_max)) {
+        munmap(header, cst.st_size);
+        return 0;
+    }
+
+    unsigned long n = header->nrows;
+    long *ts = (long*)(header + 1);
+    unsigned int *dur = (unsigned int*)(ts + n);
+    unsigned short *country = (unsigned short*)(dur + n);
+
+    // Without a zone map matching the columns, the file is a single zone
+    if (use_filter) {
+        zones = zone_load(filename, st, &zh);
+    }
+    if (zones == NULL || zh.nzones != (n + ZONE_ROWS - 1) / ZONE_ROWS) {
+        free(zones);
+        zones = &whole;
+        whole.ts_min = header->ts_min;
+        whole.ts_max = header->ts_max;
+        zh.nzones = 1;
+    }
+    unsigned long zrows = zones == &whole ? n : ZONE_ROWS;
+
+    // Every zone must be answerable without reading its rows one by one
+    for (unsigned long i = 0; use_filter && i < zh.nzones; ++i) {
+        if (filter_ranges(zones[i].ts_min, zones[i].ts_max, header->dur_min,
+            header->dur_max) && !filter_covers(zones[i].ts_min,
+            zones[i].ts_max, header->dur_min, header->dur_max)) {
+            if (zones != &whole) {
+                free(zones);
+            }
+            munmap(header, cst.st_size);
+            return 0;
+        }
+    }
+
+    // Reduce only the columns current_query needs of the zones that pass
+    memset(partial, 0, sizeof(pinfo));
+    partial->fields = current_query->fields;
+    for (unsigned long i = 0; i < zh.nzones; ++i) {
+        unsigned long first = i * zrows;
+        unsigned long count = n - first < zrows ? n - first : zrows;
+        if (use_filter && !filter_ranges(zones[i].ts_min, zones[i].ts_max,
+            header->dur_min, header->dur_max)) {
+            continue;
+        }
+        col_reduce(ts + first, dur + first, country + first, count,
+            zones[i].ts_min, zones[i].ts_max, current_query->fields, partial,
+            einfo);
+    }
+
+    if (zones != &whole) {
+        free(zones);
+    }
+    munmap(header, cst.st_size);
+    return 1;
+}
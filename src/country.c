@@ -0,0 +1,193 @@
+#include "lott.h"
+#include "country.h"
+
+// Slot of every country code plus one, and the code index of every slot
+// given out
+short country_slots[CCOUNT_SIZE];
+static short codes[CCOUNT_SIZE];
+static long nslots;
+static pthread_mutex_t slots_mut = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+* Gives a country the next slot, or finds the slot another thread gave it
+*
+* @param ind Index of the country code, from country_index
+* @return Slot of the country in country histograms
+*/
+long country_slot_new(long ind) {
+    short slot;
+
+    // Codes are seen for the first time a handful of times a run, another
+    // map may have given the code a slot while this one waited
+    pthread_mutex_lock(&slots_mut);
+    if ((slot = country_slots[ind]) == 0) {
+        codes[nslots] = ind;
+        slot = nslots + 1;
+        __atomic_store_n(&country_slots[ind], slot, __ATOMIC_RELEASE);
+        __atomic_store_n(&nslots, nslots + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&slots_mut);
+    return slot - 1;
+}
+
+/**
+* Finds the number of slots given out, every slot below it is in use
+*
+* @return Number of countries seen
+*/
+long country_count() {
+    return __atomic_load_n(&nslots, __ATOMIC_ACQUIRE);
+}
+
+/**
+* Writes the code of the country in a slot
+*
+* @param slot Slot of the country
+* @param code Buffer of at least 3 chars to write the terminated code to
+*/
+void country_code(long slot, char *code) {
+    code[0] = (codes[slot] / 26) + 'A';
+    code[1] = (codes[slot] % 26) + 'A';
+    code[2] = '\0';
+}
+
+/**
+* Adds to the count of a country in a histogram, growing the histogram
+* to hold the slot the first time
+*
+* @param ccount Pointer to the country histogram
+* @param slot Slot of the country
+* @param n Number to add
+*/
+void country_add(chist *ccount, long slot, unsigned long n) {
+    if (slot >= ccount->size) {
+        // Double up to the slot, countries are seen a handful of times
+        long size = ccount->size ? ccount->size : CCOUNT_MIN_SLOTS;
+        while (size <= slot) {
+            size <<= 1;
+        }
+        if (size > CCOUNT_SIZE) {
+            size = CCOUNT_SIZE;
+        }
+        ccount->counts = realloc(ccount->counts, size * sizeof(long));
+        memset(ccount->counts + ccount->size, 0,
+            (size - ccount->size) * sizeof(long));
+        ccount->size = size;
+    }
+    ccount->counts[slot] += n;
+}
+
+/**
+* Finds the count of a country in a histogram
+*
+* @param ccount Pointer to the country histogram
+* @param slot Slot of the country
+* @return Count of the country, 0 if the histogram does not hold the slot
+*/
+unsigned long country_get(chist *ccount, long slot) {
+    return slot < ccount->size ? ccount->counts[slot] : 0;
+}
+
+/**
+* Adds the counts of a histogram to those of another
+*
+* @param dst Pointer to the histogram to add to
+* @param src Pointer to the histogram to add
+*/
+void country_merge(chist *dst, chist *src) {
+    for (long i = src->size - 1; i >= 0; --i) {
+        if (src->counts[i] != 0) {
+            country_add(dst, i, src->counts[i]);
+        }
+    }
+}
+
+/**
+* Copies a histogram over another, keeping the counts of the other when
+* they are large enough
+*
+* @param dst Pointer to the histogram to copy to
+* @param src Pointer to the histogram to copy
+*/
+void country_copy(chist *dst, chist *src) {
+    if (dst->size != 0) {
+        memset(dst->counts, 0, dst->size * sizeof(long));
+    }
+    country_merge(dst, src);
+}
+
+/**
+* Frees the counts of a histogram, leaving it empty
+*
+* @param ccount Pointer to the country histogram
+*/
+void country_free(chist *ccount) {
+    free(ccount->counts);
+    ccount->counts = NULL;
+    ccount->size = 0;
+}
+
+/**
+* Finds the country with the highest count in a histogram, ties going to
+* the code first in alphabetical order
+*
+* @param ccount Pointer to the country histogram
+* @return Slot of the country, 0 if no country was seen
+*/
+long country_max(chist *ccount) {
+    long n = country_count(), max = 0;
+
+    // Slots past those given out have no code to break ties with
+    if (n > ccount->size) {
+        n = ccount->size;
+    }
+    for (long i = 1; i < n; ++i) {
+        if (ccount->counts[i] > ccount->counts[max] ||
+            (ccount->counts[i] == ccount->counts[max] &&
+            codes[i] < codes[max])) {
+            max = i;
+        }
+    }
+    return max;
+}
+
+/**
+* Moves the countries of a histogram from slots to counts by code, to keep
+* on disk
+*
+* @param ccount Pointer to the country histogram to move from
+* @param packed Array of CCOUNT_SIZE counts to move to
+* @return Number of countries moved, those with counts
+*/
+size_t country_pack(chist *ccount, cpacked *packed) {
+    size_t n = 0;
+
+    for (long i = 0; i < ccount->size; ++i) {
+        if (ccount->counts[i] != 0) {
+            packed[n].ind = codes[i];
+            packed[n++].count = ccount->counts[i];
+        }
+    }
+    return n;
+}
+
+/**
+* Moves counts by code, read from disk, to a histogram of slots
+*
+* @param packed Array of counts to move from
+* @param n Number of counts
+* @param ccount Pointer to the country histogram to move to, emptied first
+* @return 0 on success, negative if a code is not a country index
+*/
+int country_unpack(cpacked *packed, size_t n, chist *ccount) {
+    if (ccount->size != 0) {
+        memset(ccount->counts, 0, ccount->size * sizeof(long));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (packed[i].ind >= CCOUNT_SIZE) {
+            return -1;
+        }
+        country_add(ccount, country_slot(packed[i].ind), packed[i].count);
+    }
+    return 0;
+}
@@ -0,0 +1,338 @@
+#include "lott.h"
+#include "filter.h"
+#include "parse.h"
+
+#include <limits.h>
+#include <time.h>
+
+/**
+* Compiled condition. A row matches when its parsed column is in [lo, hi),
+* or for country sets when set has the country. negate inverts the match.
+*/
+typedef struct apred {
+    int col;
+    long lo;
+    long hi;
+    unsigned char *set;
+    int negate;
+} apred;
+
+int use_filter;
+
+// Compiled conditions sorted by column, the first nts_preds of them are on
+// the timestamp
+static apred preds[FILTER_MAX_PREDS];
+static int npreds, nts_preds;
+
+// Windows every timestamp and duration passing the filter is in
+static long ts_lo = LONG_MIN, ts_hi = LONG_MAX;
+static long dur_lo = LONG_MIN, dur_hi = LONG_MAX;
+
+// Finds the timestamp local time year starts at
+static long year_start(long year) {
+    struct tm start = {.tm_year = year - 1900, .tm_mday = 1, .tm_isdst = -1};
+    return mktime(&start);
+}
+
+// Returns 1 if a parsed column value matches a condition
+static inline int pred_match(apred *pred, long val) {
+    if (pred->set != NULL) {
+        return (val >= 0 && pred->set[val]) != pred->negate;
+    }
+    return (val >= pred->lo && val < pred->hi) != pred->negate;
+}
+
+/**
+* Parses the comparison operator a string starts with
+*
+* @param str String to parse
+* @param op Pointer to store the OP_* code in
+* @return Length of the operator, 0 if str does not start with one
+*/
+int filter_op(char *str, int *op) {
+    static const char *ops[] = {"<=", ">=", "!=", "<", ">", "="};
+    static const int codes[] = {OP_LE, OP_GE, OP_NE, OP_LT, OP_GT, OP_EQ};
+
+    for (int i = 0; i < sizeof(codes) / sizeof(int); ++i) {
+        size_t len = strlen(ops[i]);
+        if (strncmp(str, ops[i], len) == 0) {
+            *op = codes[i];
+            return len;
+        }
+    }
+    return 0;
+}
+
+// Returns 1 if the first len characters of str are the column name
+static int is_column(char *str, size_t len, char *name) {
+    return len == strlen(name) && strncmp(str, name, len) == 0;
+}
+
+// Compiles a set of countries such as JP|US, returns 0 on success
+static int compile_set(apred *pred, char *value) {
+    char *saveptr, *code;
+    long ind;
+
+    pred->set = calloc(CCOUNT_SIZE, 1);
+    for (code = strtok_r(value, "|", &saveptr); code != NULL;
+        code = strtok_r(NULL, "|", &saveptr)) {
+        if ((ind = country_index(code)) < 0 || code[2] != '\0') {
+            return -1;
+        }
+        pred->set[ind] = 1;
+    }
+    return 0;
+}
+
+// Compiles a condition such as duration>=100 into a range of a column,
+// returns 0 on success
+static int compile_pred(char *cond) {
+    char *opstr = cond, *value, *end;
+    long lo, hi;
+    int col, op, n;
+
+    while (*opstr >= 'a' && *opstr <= 'z') {
+        ++opstr;
+    }
+    size_t len = opstr - cond;
+    if ((n = filter_op(opstr, &op)) == 0 || npreds == FILTER_MAX_PREDS) {
+        return -1;
+    }
+    value = opstr + n;
+    apred *pred = &preds[npreds++];
+    memset(pred, 0, sizeof(apred));
+
+    // Countries compared for (in)equality are a set
+    if (is_column(cond, len, "country") && (op == OP_EQ || op == OP_NE)) {
+        pred->col = CSV_COUNTRY;
+        pred->negate = op == OP_NE;
+        return compile_set(pred, value);
+    }
+
+    // Find the range of the column a single value covers
+    if (is_column(cond, len, "country")) {
+        col = CSV_COUNTRY;
+        if ((lo = country_index(value)) < 0 || value[2] != '\0') {
+            return -1;
+        }
+        hi = lo + 1;
+    } else {
+        lo = strtol(value, &end, 10);
+        if (end == value || *end != '\0') {
+            return -1;
+        }
+        hi = lo + 1;
+        if (is_column(cond, len, "timestamp")) {
+            col = CSV_TIMESTAMP;
+        } else if (is_column(cond, len, "duration")) {
+            col = CSV_DURATION;
+        } else if (is_column(cond, len, "year")) {
+            // Years are compared as the timestamps they span
+            col = CSV_TIMESTAMP;
+            hi = year_start(lo + 1);
+            lo = year_start(lo);
+        } else {
+            return -1;
+        }
+    }
+
+    // Widen the range by the operator
+    pred->col = col;
+    pred->lo = lo;
+    pred->hi = hi;
+    switch (op) {
+        case OP_NE:
+            pred->negate = 1;
+            break;
+        case OP_LT:
+            pred->lo = LONG_MIN;
+            pred->hi = lo;
+            break;
+        case OP_LE:
+            pred->lo = LONG_MIN;
+            break;
+        case OP_GT:
+            pred->lo = hi;
+            pred->hi = LONG_MAX;
+            break;
+        case OP_GE:
+            pred->hi = LONG_MAX;
+            break;
+    }
+    return 0;
+}
+
+/**
+* Compiles --where conditions into the row filter. Conditions are sorted by
+* column so rows are rejected on their timestamp before the rest of them is
+* split and parsed.
+*
+* @param where Comma separated conditions on timestamp, duration, country
+* or year, such as year>=2015,country=JP|US, all must hold for a row
+* @return 0 on success, negative if a condition is invalid
+*/
+int filter_compile(char *where) {
+    char *conds = strdup(where), *saveptr, *cond;
+
+    for (cond = strtok_r(conds, ",", &saveptr); cond != NULL;
+        cond = strtok_r(NULL, ",", &saveptr)) {
+        if (compile_pred(cond) < 0) {
+            query_log("%s: %s", "Not an acceptable condition", cond);
+            free(conds);
+            return -1;
+        }
+    }
+    free(conds);
+
+    // Sort conditions by the order columns are read in
+    for (int i = 1; i < npreds; ++i) {
+        apred pred = preds[i];
+        int j = i;
+        for (; j > 0 && preds[j - 1].col > pred.col; --j) {
+            preds[j] = preds[j - 1];
+        }
+        preds[j] = pred;
+    }
+
+    // Narrow the timestamp window to every timestamp range
+    for (nts_preds = 0; nts_preds < npreds &&
+        preds[nts_preds].col == CSV_TIMESTAMP; ++nts_preds) {
+        apred *pred = &preds[nts_preds];
+        if (!pred->negate) {
+            ts_lo = pred->lo > ts_lo ? pred->lo : ts_lo;
+            ts_hi = pred->hi < ts_hi ? pred->hi : ts_hi;
+        }
+    }
+
+    // And the duration window to every duration range
+    for (int i = nts_preds; i < npreds; ++i) {
+        apred *pred = &preds[i];
+        if (pred->col == CSV_DURATION && !pred->negate) {
+            dur_lo = pred->lo > dur_lo ? pred->lo : dur_lo;
+            dur_hi = pred->hi < dur_hi ? pred->hi : dur_hi;
+        }
+    }
+
+    use_filter = 1;
+    return 0;
+}
+
+/**
+* Clears the row filter, so rows of the next run are not filtered unless
+* filter_compile is called again
+*/
+void filter_clear() {
+    for (int i = 0; i < npreds; ++i) {
+        free(preds[i].set);
+    }
+    npreds = nts_preds = 0;
+    ts_lo = dur_lo = LONG_MIN;
+    ts_hi = dur_hi = LONG_MAX;
+    use_filter = 0;
+}
+
+/**
+* Checks the timestamp column of a row against the filter
+*
+* @param timestamp Timestamp column of the row
+* @return 1 if the row may pass the filter, 0 if it is rejected
+*/
+int filter_timestamp(char *timestamp) {
+    if (nts_preds == 0) {
+        return 1;
+    }
+
+    long ts = stol(timestamp, strlen(timestamp));
+    for (int i = 0; i < nts_preds; ++i) {
+        if (!pred_match(&preds[i], ts)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+* Checks the columns after the timestamp of a row against the filter
+*
+* @param cols Columns of the row
+* @return 1 if the row passes the filter, else 0
+*/
+int filter_row(char **cols) {
+    long val = 0;
+    int col = -1;
+
+    // Parse every column once, at the first condition on it
+    for (int i = nts_preds; i < npreds; ++i) {
+        if (preds[i].col != col) {
+            col = preds[i].col;
+            if (col == CSV_COUNTRY) {
+                val = country_index(cols[col]);
+            } else {
+                val = stol(cols[col], strlen(cols[col]));
+            }
+        }
+        if (!pred_match(&preds[i], val)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+* Checks if rows with timestamps in a range can pass the filter, used to
+* skip files and chunks of rows by their timestamp stats
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @return 1 if some row in the range may pass the filter, else 0
+*/
+int filter_window(long ts_min, long ts_max) {
+    return ts_max >= ts_lo && ts_min < ts_hi;
+}
+
+/**
+* Checks if rows with timestamps and durations in ranges can pass the
+* filter, used to skip files by their stats
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @param dur_min Lowest duration of the rows
+* @param dur_max Highest duration of the rows
+* @return 1 if some row in the ranges may pass the filter, else 0
+*/
+int filter_ranges(long ts_min, long ts_max, long dur_min, long dur_max) {
+    return filter_window(ts_min, ts_max) && dur_max >= dur_lo &&
+        dur_min < dur_hi;
+}
+
+/**
+* Checks if every row with timestamps and durations in ranges passes the
+* filter, so partials of all of the rows answer a filtered run. Filters on
+* countries are never answered by ranges.
+*
+* @param ts_min Lowest timestamp of the rows
+* @param ts_max Highest timestamp of the rows
+* @param dur_min Lowest duration of the rows
+* @param dur_max Highest duration of the rows
+* @return 1 if every row in the ranges passes the filter, else 0
+*/
+int filter_covers(long ts_min, long ts_max, long dur_min, long dur_max) {
+    for (int i = 0; i < npreds; ++i) {
+        apred *pred = &preds[i];
+        long min = ts_min, max = ts_max;
+        if (pred->col == CSV_DURATION) {
+            min = dur_min;
+            max = dur_max;
+        } else if (pred->col != CSV_TIMESTAMP || pred->set != NULL) {
+            return 0;
+        }
+
+        // Inside the range of a condition, or outside it when negated
+        int inside = min >= pred->lo && max < pred->hi;
+        int outside = max < pred->lo || min >= pred->hi;
+        if (!(pred->negate ? outside : inside)) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,29 @@
+#include "lott.h"
+#include "helpers.h"
+
+/**
+* Merges the partials of an earlier part of a file into those of the rest
+* of it. Country histograms are merged in place by the map functions.
+*
+* @param dst Pointer to partials to merge into
+* @param src Pointer to partials to merge from
+*/
+void partial_merge(pinfo *dst, pinfo *src) {
+    dst->nvisits += src->nvisits;
+    dst->duration += src->duration;
+    dst->used_years |= src->used_years;
+}
+
+/**
+* Turns a country code into its index among the CCOUNT_SIZE two letter
+* codes, AA being 0 and ZZ the last
+*
+* @param code Country code, two capital letters
+* @return Index of the country, -1 if the code is not two capital letters
+*/
+long country_index(char *code) {
+    if (code[0] < 'A' || code[0] > 'Z' || code[1] < 'A' || code[1] > 'Z') {
+        return -1;
+    }
+    return ((code[0] - 'A') * 26) + (code[1] - 'A');
+}
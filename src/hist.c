@@ -0,0 +1,161 @@
+#include "lott.h"
+#include "hist.h"
+
+#include <math.h>
+
+typedef unsigned long v4ul __attribute__((vector_size(32)));
+
+// Significant bits of a bucket, and buckets of a histogram
+static int hist_bits = HIST_BITS;
+unsigned long hist_nbuckets = (1UL << HIST_BITS) +
+    (32 - HIST_BITS) * (1UL << (HIST_BITS - 1));
+
+/**
+* Sets the precision of histograms
+*
+* @param bits Significant bits of a bucket, from HIST_MIN_BITS to
+* HIST_MAX_BITS
+* @return 0 on success, negative if bits is out of range
+*/
+int hist_config(int bits) {
+    if (bits < HIST_MIN_BITS || bits > HIST_MAX_BITS) {
+        return -1;
+    }
+    hist_bits = bits;
+
+    // Exact buckets, then half as many for each power of two above them
+    hist_nbuckets = (1UL << bits) + (32 - bits) * (1UL << (bits - 1));
+    return 0;
+}
+
+// Finds the bucket of a duration
+static inline unsigned long hist_index(unsigned int value) {
+    if (value < (1U << hist_bits)) {
+        return value;
+    }
+    int shift = (31 - __builtin_clz(value)) - hist_bits + 1;
+    unsigned long half = 1UL << (hist_bits - 1);
+    return (1UL << hist_bits) + (shift - 1) * half + (value >> shift) - half;
+}
+
+/**
+* Clears a histogram, making its buckets the first time
+*
+* @param h Pointer to the histogram
+*/
+void hist_clear(hist *h) {
+    if (h->counts == NULL) {
+        h->counts = calloc(hist_nbuckets, sizeof(long));
+    } else {
+        memset(h->counts, 0, hist_nbuckets * sizeof(long));
+    }
+    h->count = h->max = 0;
+    h->min = 0xFFFFFFFF;
+}
+
+/**
+* Adds a duration to a histogram
+*
+* @param h Pointer to the histogram
+* @param value Duration to add
+*/
+void hist_add(hist *h, unsigned int value) {
+    ++h->counts[hist_index(value)];
+    ++h->count;
+    h->min = value < h->min ? value : h->min;
+    h->max = value > h->max ? value : h->max;
+}
+
+/**
+* Merges a histogram into another, adding their buckets
+*
+* @param dst Pointer to histogram to merge into
+* @param src Pointer to histogram to merge from
+*/
+void hist_merge(hist *dst, hist *src) {
+    hist_merge_buckets(dst, src, 0, hist_nbuckets);
+    dst->count += src->count;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+}
+
+/**
+* Adds a range of the buckets of a histogram to another, leaving their
+* count, min and max alone
+*
+* @param dst Pointer to histogram to merge into
+* @param src Pointer to histogram to merge from
+* @param lo Index of the first bucket to add
+* @param hi Index past the last bucket to add
+*/
+void hist_merge_buckets(hist *dst, hist *src, unsigned long lo,
+    unsigned long hi) {
+    v4ul a, b;
+    unsigned long i = lo;
+
+    // Add four buckets at a time
+    for (; i + 4 <= hi; i += 4) {
+        memcpy(&a, dst->counts + i, sizeof(v4ul));
+        memcpy(&b, src->counts + i, sizeof(v4ul));
+        a += b;
+        memcpy(dst->counts + i, &a, sizeof(v4ul));
+    }
+
+    // Buckets left over
+    for (; i < hi; ++i) {
+        dst->counts[i] += src->counts[i];
+    }
+}
+
+/**
+* Finds the range of durations of a bucket
+*
+* @param ind Index of the bucket
+* @param lo Pointer to store the lowest duration of the bucket in
+* @param hi Pointer to store the highest duration of the bucket in
+*/
+void hist_bounds(unsigned long ind, unsigned long *lo, unsigned long *hi) {
+    if (ind < (1UL << hist_bits)) {
+        *lo = *hi = ind;
+        return;
+    }
+    unsigned long half = 1UL << (hist_bits - 1);
+    unsigned long shift = (ind - (1UL << hist_bits)) / half + 1;
+    unsigned long mantissa = (ind - (1UL << hist_bits)) % half + half;
+    *lo = mantissa << shift;
+    *hi = ((mantissa + 1) << shift) - 1;
+}
+
+/**
+* Finds the duration at a quantile of a histogram, the highest duration of
+* the bucket it falls in
+*
+* @param h Pointer to the histogram
+* @param q Quantile, from 0 for the lowest duration to 1 for the highest
+* @return Duration at the quantile
+*/
+unsigned long hist_quantile(hist *h, double q) {
+    unsigned long lo, hi, seen = 0;
+    unsigned long rank = ceil(q * h->count);
+    rank = rank < 1 ? 1 : rank;
+
+    for (unsigned long i = 0; i < hist_nbuckets; ++i) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            // Highest duration seen bounds the last buckets
+            hist_bounds(i, &lo, &hi);
+            return hi < h->max ? hi : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+* Frees the buckets of a histogram
+*
+* @param h Pointer to the histogram
+*/
+void hist_free(hist *h) {
+    free(h->counts);
+    h->counts = NULL;
+}
@@ -0,0 +1,229 @@
+#include "lott.h"
+#include "htable.h"
+
+#define CTRL_EMPTY 0x80
+#define LSB 0x0101010101010101UL
+#define MSB 0x8080808080808080UL
+
+// Finds the slots of a group whose control byte is h2. A byte above a
+// match may be flagged by the borrow, keys of flagged slots are compared.
+static inline unsigned long group_match(unsigned long group,
+    unsigned char h2) {
+    unsigned long x = group ^ (LSB * h2);
+    return (x - LSB) & ~x & MSB;
+}
+
+// Finds the empty slots of a group
+static inline unsigned long group_empty(unsigned long group) {
+    return group & MSB;
+}
+
+// Loads the control bytes of the group starting at a slot
+static inline unsigned long group_load(htable *table, size_t pos) {
+    unsigned long group;
+    memcpy(&group, table->ctrl + pos, sizeof(long));
+    return group;
+}
+
+// Sets the control byte of a slot, and its copy past the last slot
+static inline void ctrl_set(htable *table, size_t i, unsigned char h2) {
+    table->ctrl[i] = h2;
+    if (i < HTABLE_GROUP) {
+        table->ctrl[table->nslots + i] = h2;
+    }
+}
+
+static inline hkey *slot_at(htable *table, size_t i) {
+    return (hkey*)(table->slots + i * table->stride);
+}
+
+// Makes the slots of a table, all empty
+static void slots_alloc(htable *table, size_t nslots) {
+    table->bytes += nslots * (table->stride + 1) + HTABLE_GROUP;
+    table->nslots = nslots;
+    table->ctrl = malloc(nslots + HTABLE_GROUP);
+    memset(table->ctrl, CTRL_EMPTY, nslots + HTABLE_GROUP);
+    table->slots = malloc(nslots * table->stride);
+}
+
+// Finds an empty slot for a hash, the first along its probe sequence
+static size_t slot_free(htable *table, unsigned long hash) {
+    size_t mask = table->nslots - 1, pos = (hash >> 7) & mask;
+    unsigned long empty;
+
+    for (size_t step = 1; !(empty = group_empty(group_load(table, pos)));
+        ++step) {
+        pos = (pos + step * HTABLE_GROUP) & mask;
+    }
+    return (pos + (__builtin_ctzl(empty) >> 3)) & mask;
+}
+
+// Doubles the slots of a table, moving every key to its slot in them
+static void slots_grow(htable *table) {
+    unsigned char *ctrl = table->ctrl;
+    char *slots = table->slots;
+    size_t nslots = table->nslots;
+
+    table->bytes -= nslots * (table->stride + 1) + HTABLE_GROUP;
+    slots_alloc(table, nslots << 1);
+    for (size_t i = 0; i < nslots; ++i) {
+        if (ctrl[i] & CTRL_EMPTY) {
+            continue;
+        }
+        hkey *key = (hkey*)(slots + i * table->stride);
+        size_t j = slot_free(table, key->hash);
+        ctrl_set(table, j, ctrl[i]);
+        memcpy(slot_at(table, j), key, table->stride);
+    }
+    free(ctrl);
+    free(slots);
+}
+
+// Copies a key to the arena of a table, starting a chunk when it is full
+static char *arena_copy(htable *table, char *key, size_t len) {
+    harena *chunk = table->arena;
+    if (chunk == NULL || chunk->used + len > chunk->size) {
+        size_t size = len > HTABLE_ARENA_SIZE ? len : HTABLE_ARENA_SIZE;
+        chunk = malloc(sizeof(harena) + size);
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = table->arena;
+        table->arena = chunk;
+        table->bytes += sizeof(harena) + size;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, key, len);
+    chunk->used += len;
+    return copy;
+}
+
+/**
+* Makes an empty table
+*
+* @param table Pointer to table to initialize
+* @param value_size Size of the value of a key
+*/
+void htable_init(htable *table, size_t value_size) {
+    memset(table, 0, sizeof(htable));
+    table->value_size = value_size;
+    table->stride = (sizeof(hkey) + value_size + sizeof(long) - 1) &
+        ~(sizeof(long) - 1);
+    slots_alloc(table, HTABLE_MIN_SLOTS);
+}
+
+/**
+* Finds the value of a key, adding the key with a zeroed value if it is not
+* in the table
+*
+* @param table Pointer to table
+* @param key Key, not necessarily terminated
+* @param len Length of the key
+* @param hash Hash of the key, from sketch_hash
+* @return Pointer to the value of the key
+*/
+void *htable_get(htable *table, char *key, size_t len, unsigned long hash) {
+    size_t mask = table->nslots - 1, pos = (hash >> 7) & mask;
+    unsigned char h2 = hash & 0x7F;
+    unsigned long group, match;
+    hkey *slot;
+
+    // The key is most often in the first slots of its group, so load them
+    // while the control bytes that point to them are still on their way
+    __builtin_prefetch(slot_at(table, pos));
+
+    // Compare the keys of the slots whose control byte matches, group by
+    // group until a group with an empty slot ends the probe sequence
+    for (size_t step = 1; ; ++step) {
+        group = group_load(table, pos);
+        for (match = group_match(group, h2); match; match &= match - 1) {
+            slot = slot_at(table, (pos + (__builtin_ctzl(match) >> 3)) & mask);
+            if (slot->hash == hash && slot->len == len &&
+                memcmp(htable_key(slot), key, len) == 0) {
+                return slot + 1;
+            }
+        }
+        if (group_empty(group)) {
+            break;
+        }
+        pos = (pos + step * HTABLE_GROUP) & mask;
+    }
+
+    // Add the key, keeping at most 7 of 8 slots full. Keys are never
+    // removed, so the first empty slot of the group that ended the probe
+    // is the one slot_free would find, unless the slots have to grow.
+    size_t i = (pos + (__builtin_ctzl(group_empty(group)) >> 3)) & mask;
+    if ((table->n + 1) * 8 > table->nslots * 7) {
+        slots_grow(table);
+        i = slot_free(table, hash);
+    }
+    ctrl_set(table, i, h2);
+    slot = slot_at(table, i);
+    slot->hash = hash;
+    slot->len = len;
+    if (len <= HTABLE_INLINE) {
+        memcpy(slot->bytes, key, len);
+    } else {
+        slot->key = arena_copy(table, key, len);
+    }
+    memset(slot + 1, 0, table->value_size);
+    ++table->n;
+    return slot + 1;
+}
+
+/**
+* Steps through the keys of a table in slot order
+*
+* @param table Pointer to table
+* @param i Pointer to the slot to start at, 0 for the first, left past the
+* slot returned
+* @param value Pointer to store the value of the key in
+* @return Pointer to the key, NULL once every key has been stepped through
+*/
+hkey *htable_next(htable *table, size_t *i, void **value) {
+    for (; *i < table->nslots; ++*i) {
+        if (!(table->ctrl[*i] & CTRL_EMPTY)) {
+            hkey *key = slot_at(table, (*i)++);
+            *value = key + 1;
+            return key;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Empties a table, keeping its slots and first chunk of arena
+*
+* @param table Pointer to table
+*/
+void htable_clear(htable *table) {
+    memset(table->ctrl, CTRL_EMPTY, table->nslots + HTABLE_GROUP);
+    table->n = 0;
+    if (table->arena == NULL) {
+        return;
+    }
+    while (table->arena->next != NULL) {
+        harena *next = table->arena->next;
+        table->bytes -= sizeof(harena) + table->arena->size;
+        free(table->arena);
+        table->arena = next;
+    }
+    table->arena->used = 0;
+}
+
+/**
+* Frees the slots and arena of a table
+*
+* @param table Pointer to table
+*/
+void htable_free(htable *table) {
+    while (table->arena != NULL) {
+        harena *next = table->arena->next;
+        free(table->arena);
+        table->arena = next;
+    }
+    free(table->ctrl);
+    free(table->slots);
+    table->ctrl = NULL;
+    table->slots = NULL;
+    table->nslots = table->n = table->bytes = 0;
+}
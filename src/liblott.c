@@ -0,0 +1,192 @@
+#include "lott.h"
+#include "liblott.h"
+#include "adhoc.h"
+#include "cache.h"
+#include "filter.h"
+#include "pool.h"
+#include "reader.h"
+#include "topk.h"
+
+#include <stdarg.h>
+
+#define LOTT_ERROR_SIZE 256
+
+struct lott_ctx {
+    char error[LOTT_ERROR_SIZE];
+};
+
+Part current_part;
+
+// Held by the job running, the engine keeps the state of a run in globals
+// so only runs one at a time
+static pthread_mutex_t mut_jobs = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+* Runs a part on current_query, which prints its result
+*
+* @param part Part character, 1 to 5
+* @param nthreads Number of map threads, unused by part 1
+* @return Negative on error, described by query_error if the run failed
+*/
+int lott_part(char part, size_t nthreads) {
+    int ret = -1;
+
+    query_error_clear();
+    switch (part) {
+        case '1': {
+            current_part = PART1;
+            ret = part1();
+        } break;
+        case '2': {
+            current_part = PART2;
+            ret = part2(nthreads);
+        } break;
+        case '3': {
+            current_part = PART3;
+            ret = part3(nthreads);
+        } break;
+        case '4': {
+            current_part = PART4;
+            ret = part4(nthreads);
+        } break;
+        case '5': {
+            current_part = PART5;
+            ret = part5(nthreads);
+        } break;
+        default: {
+            query_fail("Invalid Part Selction", 0);
+        } break;
+    }
+
+    return query_error() != NULL ? -1 : ret;
+}
+
+// Describes the error of the job running on a context
+static void lott_fail(lott_ctx *ctx, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(ctx->error, LOTT_ERROR_SIZE, format, args);
+    va_end(args);
+}
+
+// Hands a row of the result of the job running to its callback
+static void job_result(void *arg, double value, const char *name) {
+    const lott_job *job = arg;
+    job->on_result(job->arg, value, name);
+}
+
+// Hands a warning or error of the job running to its callback, if it has
+// one
+static void job_log(void *arg, const char *message) {
+    const lott_job *job = arg;
+    if (job->on_log != NULL) {
+        job->on_log(job->arg, message);
+    }
+}
+
+// Hands the progress of the job running to its callback
+static void job_progress(void *arg, qprogress *progress) {
+    const lott_job *job = arg;
+    job->on_progress(job->arg, progress->nfiles, progress->nrows);
+}
+
+/**
+* Opens a context
+*
+* @return Pointer to the context, NULL if it could not be made
+*/
+lott_ctx *lott_open() {
+    return calloc(1, sizeof(lott_ctx));
+}
+
+/**
+* Runs a job, handing the rows of its result to on_result, or printing
+* them to stdout like bin/lott if it is NULL
+*
+* @param ctx Pointer to the context
+* @param job Pointer to the job to run
+* @return 0 on success, negative on error, described by lott_error
+*/
+int lott_run(lott_ctx *ctx, const lott_job *job) {
+    int ret = -1;
+
+    ctx->error[0] = '\0';
+    if (job->part < '1' || job->part > '5') {
+        lott_fail(ctx, "%s: %c", "Not an acceptable part", job->part);
+        return -1;
+    }
+
+    pthread_mutex_lock(&mut_jobs);
+    query_logger(job_log, (void*)job);
+    nbad_rows = 0;
+
+    // Set up the globals a run of bin/lott sets from its command line
+    top_k = job->top_k;
+    reduce_shards = job->reducers ? job->reducers : 1;
+    if (job->where != NULL && filter_compile((char*)job->where) < 0) {
+        lott_fail(ctx, "%s: %s", "Not an acceptable condition", job->where);
+        goto done;
+    }
+    if (job->group_by != NULL || job->agg != NULL || job->having != NULL) {
+        current_query = adhoc_compile((char*)job->group_by, (char*)job->agg,
+            (char*)job->where, (char*)job->having);
+        if (current_query == NULL) {
+            lott_fail(ctx, "%s", "Not an acceptable ad-hoc query");
+            goto done;
+        }
+    } else if (job->query == NULL ||
+        (current_query = query_find((char*)job->query)) == NULL) {
+        lott_fail(ctx, "%s: %s", "Not an acceptable query",
+            job->query ? job->query : "(none)");
+        goto done;
+    }
+    if (job->cache) {
+        use_cache = 1;
+        cache_load();
+    }
+
+    query_sinks(job->on_result ? job_result : NULL,
+        job->on_progress ? job_progress : NULL, (void*)job);
+    ret = lott_part(job->part, job->nthreads ? job->nthreads : pool_auto());
+    query_sinks(NULL, NULL, NULL);
+    if (ret < 0 && query_error() != NULL) {
+        lott_fail(ctx, "%s", query_error());
+    } else if (ret < 0) {
+        lott_fail(ctx, "Error during execution of %s with %s",
+            PART_STRINGS[current_part], current_query->name);
+    }
+    if (job->cache) {
+        cache_save();
+    }
+
+done:
+    // Leave the defaults for the next job
+    filter_clear();
+    use_cache = 0;
+    top_k = 0;
+    reduce_shards = 1;
+    current_query = NULL;
+    query_logger(NULL, NULL);
+    pthread_mutex_unlock(&mut_jobs);
+    return ret < 0 ? -1 : 0;
+}
+
+/**
+* Describes the error of the last job run on a context
+*
+* @param ctx Pointer to the context
+* @return Message of the error, empty if the last job succeeded
+*/
+const char *lott_error(lott_ctx *ctx) {
+    return ctx->error;
+}
+
+/**
+* Closes a context
+*
+* @param ctx Pointer to the context
+*/
+void lott_close(lott_ctx *ctx) {
+    free(ctx);
+}
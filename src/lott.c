@@ -1,31 +1,257 @@
 #include "lott.h"
+#include "adhoc.h"
+#include "affinity.h"
+#include "cache.h"
+#include "channel.h"
+#include "columnar.h"
+#include "filter.h"
+#include "hist.h"
+#include "output.h"
+#include "pool.h"
+#include "reader.h"
+#include "rollup.h"
+#include "sketch.h"
+#include "stats.h"
+#include "topk.h"
+#include "watch.h"
 
-int main(int argc, char const* argv[]) {
+static struct option long_options[] = {
+    {"agg", required_argument, NULL, 'A'},
+    {"batch", required_argument, NULL, 'b'},
+    {"bucket", required_argument, NULL, 'B'},
+    {"cache", no_argument, NULL, 'c'},
+    {"capacity", required_argument, NULL, 'C'},
+    {"checkpoint", required_argument, NULL, 'K'},
+    {"error", required_argument, NULL, 'R'},
+    {"format", required_argument, NULL, 'F'},
+    {"group-by", required_argument, NULL, 'G'},
+    {"having", required_argument, NULL, 'V'},
+    {"help", no_argument, NULL, 'h'},
+    {"memory", required_argument, NULL, 'M'},
+    {"numa", no_argument, NULL, 'N'},
+    {"partials", no_argument, NULL, 'p'},
+    {"precision", required_argument, NULL, 'P'},
+    {"quarantine", required_argument, NULL, 'Q'},
+    {"reducers", required_argument, NULL, 'S'},
+    {"resume", no_argument, NULL, 'r'},
+    {"stats", no_argument, NULL, 's'},
+    {"top", required_argument, NULL, 'T'},
+    {"watch", no_argument, NULL, 'w'},
+    {"where", required_argument, NULL, 'W'},
+    {NULL, 0, NULL, 0}
+};
 
-    if (argc < 3) {
-        fprintf(stderr, "%s\n", "No query specified");
+/**
+* Runs the part selected on the command line, writing its result in the
+* format of the output
+*
+* @param part Part character from the command line
+* @param nthreads Number of map threads, unused by part 1
+* @return Negative on error
+*/
+static int run_part(char part, size_t nthreads) {
+    output_start(part, nthreads);
+    int ret = lott_part(part, nthreads);
+    output_end(ret);
+    return ret;
+}
+
+int main(int argc, char* argv[]) {
+
+    // Parse options, leaving the positional arguments at argv[1..]
+    char *group_by = NULL, *agg = NULL, *where = NULL, *having = NULL, *end;
+    int opt, adhoc = 0;
+    while ((opt = getopt_long(argc, argv, "chsw", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'A':
+                agg = optarg, adhoc = 1;
+                break;
+            case 'B':
+                if (rollup_config(optarg) < 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable bucket",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                chan_capacity = (size_t)strtoul(optarg, &end, 10);
+                if (*end != '\0' || chan_capacity == 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable capacity",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                adhoc_budget = (size_t)strtoul(optarg, &end, 10) << 20;
+                if (*end != '\0' || adhoc_budget == 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable memory budget",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                if (output_config(optarg) < 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable format",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'G':
+                group_by = optarg, adhoc = 1;
+                break;
+            case 'N':
+                use_numa = affinity_init() > 0;
+                break;
+            case 'P':
+                if (hist_config(strtol(optarg, &end, 10)) < 0 ||
+                    *end != '\0') {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable precision",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'Q':
+                if (reader_quarantine(optarg) < 0) {
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                if (sketch_config(strtod(optarg, &end)) < 0 ||
+                    *end != '\0') {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable error",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                reduce_shards = (size_t)strtoul(optarg, &end, 10);
+                if (*end != '\0' || reduce_shards == 0) {
+                    fprintf(stderr, "%s: %s\n",
+                        "Not an acceptable number of reducers", optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                top_k = (size_t)strtoul(optarg, &end, 10);
+                if (*end != '\0' || top_k == 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable top count",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'V':
+                having = optarg, adhoc = 1;
+                break;
+            case 'W':
+                where = optarg;
+                break;
+            case 'b':
+                chan_batch = (size_t)strtoul(optarg, &end, 10);
+                if (*end != '\0' || chan_batch == 0) {
+                    fprintf(stderr, "%s: %s\n", "Not an acceptable batch",
+                        optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                use_cache = 1;
+                break;
+            case 'K':
+                cache_checkpoint = (unsigned int)strtoul(optarg, &end, 10);
+                if (*end != '\0' || cache_checkpoint == 0) {
+                    fprintf(stderr, "%s: %s\n",
+                        "Not an acceptable checkpoint interval", optarg);
+                    HELP;
+                    exit(EXIT_FAILURE);
+                }
+                use_cache = 1;
+                break;
+            case 'p':
+                output_files = 1;
+                break;
+            case 'r':
+                use_cache = 1;
+                if (cache_checkpoint == 0) {
+                    cache_checkpoint = CACHE_CHECKPOINT;
+                }
+                break;
+            case 'h':
+                HELP;
+                exit(EXIT_SUCCESS);
+            case 's':
+                use_stats = 1;
+                break;
+            case 'w':
+                use_watch = use_cache = cache_append = 1;
+                break;
+            default:
+                HELP;
+                exit(EXIT_FAILURE);
+        }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    // Convert data files to columns instead of running a query
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0) {
+        size_t nthreads = pool_auto();
+        if (argc >= 3 && strcmp(argv[2], "auto") != 0) {
+            nthreads = (size_t)strtoul(argv[2], &end, 10);
+            if (*end != '\0' || nthreads == 0) {
+                fprintf(stderr, "%s: %s\n",
+                    "Not an acceptable number of threads", argv[2]);
+                HELP;
+                exit(EXIT_FAILURE);
+            }
+        }
+        int nconverted = col_convert(nthreads);
+        if (nconverted < 0) {
+            fprintf(stderr, "%s\n", "Could not convert " DATA_DIR);
+            exit(EXIT_FAILURE);
+        }
+        printf("Converted %d files\n", nconverted);
+        if (nbad_rows) {
+            fprintf(stderr, "%s: %lu\n", "Malformed rows skipped", nbad_rows);
+        }
+        return 0;
+    }
+
+    // Conditions filter the rows of every query
+    if (where != NULL && filter_compile(where) < 0) {
         HELP;
         exit(EXIT_FAILURE);
     }
 
-    if(strcmp(argv[2], QUERY_STRINGS[A]) == 0){
-        current_query = A;
-    } else if(strcmp(argv[2], QUERY_STRINGS[B]) == 0){
-        current_query = B;
-    } else if(strcmp(argv[2], QUERY_STRINGS[C]) == 0){
-        current_query = C;
-    } else if(strcmp(argv[2], QUERY_STRINGS[D]) == 0){
-        current_query = D;
-    } else if(strcmp(argv[2], QUERY_STRINGS[E]) == 0){
-        current_query = E;
-    } else{
+    // Ad-hoc queries take the place of QUERY on the command line
+    if (adhoc) {
+        if ((current_query = adhoc_compile(group_by, agg, where, having)) ==
+            NULL) {
+            HELP;
+            exit(EXIT_FAILURE);
+        }
+        --argv, ++argc;
+        argv[1] = argv[2];
+    } else if (argc < 3) {
+        fprintf(stderr, "%s\n", "No query specified");
+        HELP;
+        exit(EXIT_FAILURE);
+    } else if ((current_query = query_find(argv[2])) == NULL) {
         fprintf(stderr, "%s: %s\n", "Not an acceptable query", argv[2]);
         HELP;
         exit(EXIT_FAILURE);
     }
 
-    char* end;
     int ret = -1;
+    size_t nthreads = 0;
 
     if(argc < 3){
         fprintf(stderr, "%s\n", "No part specified");
@@ -33,52 +259,45 @@ int main(int argc, char const* argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    if (argv[1][0] == '1') {
-        current_part = PART1;
-        ret = part1();
-        goto end;
+    // Size the map threads for the host when M is left out or auto
+    if (argv[1][0] != '1') {
+        if (argc < 4 || strcmp(argv[3], "auto") == 0) {
+            nthreads = pool_auto();
+        } else {
+            nthreads = (size_t)strtoul(argv[3], &end, 10);
+            if (*end != '\0' || nthreads == 0) {
+                fprintf(stderr, "%s: %s\n",
+                    "Not an acceptable number of threads", argv[3]);
+                HELP;
+                exit(EXIT_FAILURE);
+            }
+        }
     }
 
-    if (argc < 4) {
-        fprintf(stderr, "%s\n", "Not enough arguments supplied");
-        HELP;
-        exit(EXIT_FAILURE);
+    // Load partials of unchanged files from previous runs, checkpointing
+    // those of this run as it goes when it can be resumed
+    cache_load();
+    cache_checkpoint_start();
+
+    ret = run_part(argv[1][0], nthreads);
+    if (argv[1][0] != '1' && output_format == OUTPUT_TEXT) {
+        printf("Number of threads: %ld\n", nthreads);
     }
-    size_t nthreads = (size_t)strtoul(argv[3], &end, 10);
-    if (errno != 0) {
-        perror("Invalid thread count specified");
-        exit(0);
+    cache_checkpoint_stop();
+    cache_save();
+    if (nbad_rows) {
+        fprintf(stderr, "%s: %lu\n", "Malformed rows skipped", nbad_rows);
     }
 
-    switch (argv[1][0]) {
-        case '2': {
-            current_part = PART2;
-            ret = part2(nthreads);
-        } break;
-        case '3': {
-            current_part = PART3;
-            ret = part3(nthreads);
-        } break;
-        case '4': {
-            current_part = PART4;
-            ret = part4(nthreads);
-        } break;
-        case '5': {
-            current_part = PART5;
-            ret = part2(nthreads);
-        } break;
-        default: {
-            ret = 0;
-            fprintf(stderr, "%s\n", "Invalid Part Selction");
-        } break;
+    // Keep the result fresh as files are written to DATA_DIR
+    if (use_watch && ret >= 0) {
+        fflush(NULL);
+        ret = watch_data(&run_part, argv[1][0], nthreads);
     }
 
-    printf("Number of threads: %ld\n", nthreads);
-
-end:
     if(ret < 0){
         fprintf(stderr, "Error during execution of %s with %s\n",
-            PART_STRINGS[current_part], QUERY_STRINGS[current_query]);
+            PART_STRINGS[current_part], current_query->name);
     }
 
     return 0;
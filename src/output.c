@@ -0,0 +1,152 @@
+#include "lott.h"
+#include "output.h"
+#include "reader.h"
+
+#include <math.h>
+#include <time.h>
+
+int output_format = OUTPUT_TEXT;
+int output_files;
+
+// Start of the run, when the last progress line was written, and the
+// files and rows done so far
+static struct timespec started, reported;
+static unsigned long nfiles, nrows;
+
+// Finds the seconds from a time to now
+static double output_since(struct timespec *then) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
+
+// Writes a string as a json string, escaping what json does not allow
+static void json_string(const char *str) {
+    putchar('"');
+    for (; *str != '\0'; ++str) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+// Writes a number as a json number, null if it is not one
+static void json_number(double value) {
+    if (isfinite(value)) {
+        printf("%lf", value);
+    } else {
+        printf("null");
+    }
+}
+
+// Writes a row line for a row of the result
+static void json_row(void *arg, double value, const char *name) {
+    printf("{\"type\":\"row\",\"name\":");
+    json_string(name);
+    printf(",\"value\":");
+    json_number(value);
+    printf("}\n");
+    fflush(stdout);
+}
+
+// Writes a file line for the file just done, and a progress line if the
+// last one was written long enough ago. Called with the progress lock held,
+// so lines are written a file at a time.
+static void json_progress(void *arg, qprogress *progress) {
+    double elapsed = output_since(&started);
+
+    nfiles = progress->nfiles;
+    nrows = progress->nrows;
+    if (output_files) {
+        printf("{\"type\":\"file\",\"name\":");
+        json_string(progress->filename);
+        printf(",\"value\":");
+        json_number(progress->value);
+        if (current_query->select == Q_COUNTRY) {
+            printf(",\"country\":");
+            json_string(progress->country);
+        }
+        printf(",\"rows\":%lu,\"elapsed\":%lf}\n", progress->rows, elapsed);
+    }
+
+    if (output_since(&reported) * 1000 >= OUTPUT_INTERVAL_MS) {
+        clock_gettime(CLOCK_MONOTONIC, &reported);
+        printf("{\"type\":\"progress\",\"files\":%lu,\"rows\":%lu,"
+            "\"elapsed\":%lf", nfiles, nrows, elapsed);
+        if (progress->best != NULL) {
+            printf(",\"best\":{\"name\":");
+            json_string(progress->best);
+            printf(",\"value\":");
+            json_number(progress->best_value);
+            putchar('}');
+        }
+        printf("}\n");
+    }
+    fflush(stdout);
+}
+
+/**
+* Sets the format of the output
+*
+* @param format Name of the format: text or json
+* @return 0 on success, negative if the format is not one of those
+*/
+int output_config(char *format) {
+    if (strcmp(format, "text") == 0) {
+        output_format = OUTPUT_TEXT;
+    } else if (strcmp(format, "json") == 0) {
+        output_format = OUTPUT_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Starts the output of a run, sending its rows and progress to the json
+* writer. Does nothing for text output, which the parts print themselves.
+*
+* @param part Part character, 1 to 5
+* @param nthreads Number of map threads, unused by part 1
+*/
+void output_start(char part, size_t nthreads) {
+    if (output_format != OUTPUT_JSON) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    reported = started;
+    nfiles = nrows = 0;
+    printf("{\"type\":\"start\",\"part\":\"%c\",\"query\":", part);
+    json_string(current_query->name);
+    if (part != '1') {
+        printf(",\"threads\":%lu", nthreads);
+    }
+    printf("}\n");
+    fflush(stdout);
+    query_sinks(json_row, json_progress, NULL);
+}
+
+/**
+* Ends the output of a run started by output_start
+*
+* @param ret Return of the run, negative on error
+*/
+void output_end(int ret) {
+    if (output_format != OUTPUT_JSON) {
+        return;
+    }
+
+    query_sinks(NULL, NULL, NULL);
+    printf("{\"type\":\"done\",\"ok\":%s,\"files\":%lu,\"rows\":%lu,"
+        "\"bad_rows\":%lu,\"elapsed\":%lf}\n", ret < 0 ? "false" : "true",
+        nfiles, nrows, nbad_rows, output_since(&started));
+    fflush(stdout);
+}
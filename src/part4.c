@@ -1,9 +1,11 @@
 #include "lott.h"
+#include "affinity.h"
+#include "country.h"
 #include "part4.h"
 
-sem_t mut_pdcr, mut_buf;
-int nproducers;
-sinfo *buf_head;
+// Reduce shards, each taking the mapped files of its keys from a bounded
+// buffer of its own
+static rshard *shards;
 
 int part4(size_t nthreads) {
     // Handle bad calls
@@ -11,29 +13,44 @@ int part4(size_t nthreads) {
         return -1;
     }
 
-    // Initialize semaphores
-    sem_init(&mut_pdcr, 0, 1), sem_init(&mut_buf, 0, 1);
 
     // Create linked list of sinfo nodes, nfiles long
     sinfo *head = NULL, *cursor;
     int nfiles = make_files_list(&head);
+    if (nfiles < 0) {
+        return -1;
+    }
     cursor = head;
 
-    // Spawn and name reduce thread
-    pthread_t t_reduce;
-    char threadname[THREADNAME_SIZE] = {'r','e','d','u','c','e','\0'};
-    sinfo result;
-    memset(&result, 0, sizeof(sinfo));
-    if (current_query == E) {
-        result.einfo = calloc(CCOUNT_SIZE, sizeof(int));
+    // Spawn and name a reduce thread for every shard. Map threads pass the
+    // files they map, waiting while chan_capacity of them are not reduced
+    // yet by a shard.
+    pthread_t t_reduce[reduce_shards];
+    char threadname[THREADNAME_SIZE];
+    shards = calloc(reduce_shards, sizeof(rshard));
+    for (int i = 0; i < reduce_shards; ++i) {
+        shards[i].index = i;
+        chan_open(&shards[i].chan, CHAN_MEMORY, sizeof(sinfo*), NULL);
+        pthread_create(&t_reduce[i], NULL, reduce, &shards[i]);
+        snprintf(threadname, THREADNAME_SIZE, "%s%hu", "reduce",
+            (unsigned short)i);
+        pthread_setname_np(t_reduce[i], threadname);
     }
-    pthread_create(&t_reduce, NULL, reduce, &result);
-    pthread_setname_np(t_reduce, threadname);
 
     // Divide sinfo list equally between map threads
     pthread_t t_readers[nthreads];
     margs args[nthreads];
     int nfiles_per = nfiles / nthreads, nfiles_rem = nfiles % nthreads;
+
+    // Give map threads the files cached on their nodes
+    if (use_numa && nfiles > 0) {
+        int counts[nthreads];
+        for (int i = 0; i < nthreads; ++i) {
+            counts[i] = nfiles_per + (i < nfiles_rem);
+        }
+        place_files(&head, nfiles, counts, nthreads);
+        cursor = head;
+    }
     for (int i = 0; i < nthreads; ++i) {
         
         // Set nfiles
@@ -45,12 +62,13 @@ int part4(size_t nthreads) {
             break;
         }
 
-        // Set new sub-list head
+        // Set new sub-list head and the node of the thread
         args[i].head = cursor;
+        args[i].worker = i;
 
         // Create and name map thread
         pthread_create(&t_readers[i], NULL, map, &args[i]);
-        sprintf(threadname, "%s%d", "map", i + 2);
+        snprintf(threadname, THREADNAME_SIZE, "%s%d", "map", i + 2);
         pthread_setname_np(t_readers[i], threadname);
 
         // Move to next sub-list head
@@ -69,126 +87,42 @@ int part4(size_t nthreads) {
         }
     }
 
-    // Cancel reduce thread since all map threads have been joined
-    pthread_cancel(t_reduce);
-    pthread_join(t_reduce, NULL);
-
-    // Restore resources
-    sinfo *prev;
-    cursor = buf_head;
-    if (current_query == E) {
-        while (cursor != NULL) {
-            free(cursor->einfo);     
-            prev = cursor;
-            cursor = cursor->next;
-            free(prev);
-        }
-    } else {
-        while (cursor != NULL) {
-            prev = cursor;
-            cursor = cursor->next;
-            free(prev);
-        }
-    }
-
-    return 0;
-}
-
-/**
-* Makes a linked list of sinfo nodes, returns the length of the list
-*
-* @param head Pointer to sinfo pointer where head pointer will be stored
-* @return Number of files found in data dir (length of list created)
-*/
-static int make_files_list(sinfo **head) {
-    int nfiles;
-
-    // Open data directory
-    DIR *dir = opendir(DATA_DIR);
-    struct dirent *direp;
-    
-    // For every file found, add a node containing the filename
-    for (nfiles = 0; (direp = readdir(dir)) != NULL; ++nfiles) {
-        if (direp->d_name[0] == '.') {
-            --nfiles;
-            continue;
-        }
-        
-        sinfo *new_node = calloc(1, sizeof(sinfo));
-        strcpy(new_node->filename, direp->d_name);
-        if (current_query == E) {
-            new_node->einfo = calloc(CCOUNT_SIZE, sizeof(int));
-        }
-
-        new_node->next = *head;
-        *head = new_node;
-    }
-
-    closedir(dir);
-    return nfiles;
-}
-
-// Converts string to integer
-static int stoi(char *str, int n) {
-    int num = 0;
-    for (int i = 0; i < n; ++i) {
-        num *= 10;
-        num += str[i] - '0';
+    // Close buffers since all map threads have been joined, the reduce
+    // threads return once they have reduced their last file
+    for (int i = 0; i < reduce_shards; ++i) {
+        chan_close(&shards[i].chan);
     }
-    return num;
-}
-
-// Converts string to long
-static long stol(char *str, int n) {
-    long num = 0;
-    for (int i = 0; i < n; ++i) {
-        num *= 10;
-        num += str[i] - '0';
+    for (int i = 0; i < reduce_shards; ++i) {
+        pthread_join(t_reduce[i], NULL);
     }
-    return num;
-}
 
-// Semaphore locking storage access for global buffer list
-static void s_storeinfo(sinfo *info) {
-    // Wait to change nproducers
-    sem_wait(&mut_pdcr);
-    if (++nproducers == 1) {
-        // Only producer here - wait for access lock
-        sem_wait(&mut_buf);
+    // Merge results of the shards and print them
+    reduce_report();
+    for (int i = 0; i < reduce_shards; ++i) {
+        chan_free(&shards[i].chan);
+        country_free(&shards[i].result.einfo);
     }
-    // Let others change nproducers
-    sem_post(&mut_pdcr);
+    free(shards);
 
-    // Store results in global buffer list
-    info->next = buf_head;
-    buf_head = info;
+    // Restore resources
+    free_files_list(head);
 
-    sem_wait(&mut_pdcr);
-    if (--nproducers == 0) {
-        // Only producer here - free access lock
-        sem_post(&mut_buf);
-    }
-    sem_post(&mut_pdcr);
+    return 0;
 }
 
-// Semaphore locking consumer access for global buffer list
-static int s_consumeinfo(sinfo **info) {
-    int r = 0;
-    // Wait for all producers to free access lock
-    usleep(1);
-    sem_wait(&mut_buf);
-
-    // Consume from global buffer list
-    if ((*info = buf_head) != NULL) {
-        buf_head = buf_head->next;
-        r = 1;
+// Passes a mapped file to the shard of its key, waiting while the buffer
+// of the shard is full
+static void s_passinfo(sinfo *info) {
+    // States are keyed inside, every shard reduces its keys of them
+    if (current_query->select == Q_STATE) {
+        for (int i = 0; i < reduce_shards; ++i) {
+            chan_send(&shards[i].chan, &info);
+        }
+    } else if (current_query->select == Q_COUNTRY) {
+        chan_send(&shards[query_shard((int)info->average)].chan, &info);
     } else {
-        r = 0;
+        chan_send(&shards[query_shard_name(info->filename)].chan, &info);
     }
-
-    // Free access lock
-    sem_post(&mut_buf);
-    return r;
 }
 
 /**
@@ -199,299 +133,194 @@ static int s_consumeinfo(sinfo **info) {
 */
 static void* map(void* v) {
     margs *args = v;
-    sinfo *info = args->head, *next;
-    
-    // Find map for current query
-    void (*f_map)(sinfo*);
-    switch (current_query) {
-        case A:
-        case B:
-            f_map = &map_avg_dur;
-            break;
-        case C:
-        case D:
-            f_map = &map_avg_user;
-            break;
-        case E:
-            f_map = &map_max_country;
-    }
+    sinfo *info = args->head;
 
+    // Run on the node of this thread, so what it allocates is local
+    if (use_numa) {
+        affinity_pin(args->worker);
+    }
+    
     // For all files assigned to this thread
-    char filepath[FILENAME_SIZE];
-    sprintf(filepath, "./%s/", DATA_DIR);
     for (int i = 0; i < args->nfiles; ++i) {
-        // Open file
-        strcpy(filepath + 7, info->filename);
-        info->file = fopen(filepath, "r");
-        if (info->file == NULL) {
-            exit(EXIT_FAILURE);
+        // Leave the rest of the files unmapped once the run has failed
+        if (query_error() != NULL || map_file(info) < 0) {
+            break;
         }
 
-        // Call map for query
-        (*f_map)(info);
-
-        // Store file info to global buffer list
-        next = info->next;
-        s_storeinfo(info);
-
-        // Close file
-        fclose(info->file);
-        info = next;
+        // Pass file info to the reduce shard of its key
+        s_passinfo(info);
+        info = info->next;
     }
     
     pthread_exit(NULL);
     return NULL;
 }
 
-/**
-* (A/B) Map function for finding average duration of visit, sets average in 
-* passed sinfo node
-* 
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_dur(sinfo *info) {
-    char line[LINE_SIZE], *linep = line, *durstr;
-    int nvisits = 0, duration = 0;
-    
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find duration segment of line
-        strsep(&linep, ","), strsep(&linep, ",");
-        durstr = strsep(&linep, ",");
-        
-        // Add duration to total
-        duration += stoi(durstr, strlen(durstr));
-        linep = line;
-        ++nvisits;
+// Keeps a file as the result if it beats the current one
+static void reduce_best(sinfo *result, double average, char *filename) {
+    // Compare with current best
+    char res = query_cmp(average, result->average);
+    if (res > 0) {
+        result->average = average;
+        strcpy(result->filename, filename);
     }
-
-    // Write average duration 
-    info->average = (double)duration / nvisits;
-}
-
-// Helper for map_avg_user
-// Checks bit array used_years for previously found years
-// Returns 1 if year not found, else 0
-static int check_year_used(int year, unsigned long *used_years) {
-    // Check bit at offset from 1970
-    unsigned long mask = 1;
-    year -= 70;
-    mask <<= year;
-    if (mask & *used_years) {
-        // Match found - year used
-        return 0;
+    // Equal - pick alphabetical order first
+    else if (res == 0) {
+        if (strcmp(filename, result->filename) < 0) {
+            result->average = average;
+            strcpy(result->filename, filename);
+        }
     }
-    // Match not found - year not used
-    *used_years |= mask;
-    return 1;
 }
 
-/**
-* (C/D) Map function for finding average users per year, sets average
-* in passed sinfo node
-*
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_user(sinfo *info) {
-    char line[LINE_SIZE], *linep = line, *timestamp;
-    int nvisits = 0, nyears = 0;
-    unsigned long used_years = 0;
-    time_t ts;
-    struct tm tm;
-    
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find timestamp segment of line
-        timestamp = strsep(&linep, ",");
-
-        // Find year from timestamp
-        ts = stol(timestamp, strlen(timestamp));
-        localtime_r(&ts, &tm);
-
-        // Add to nyears if year is new
-        nyears += check_year_used(tm.tm_year, &used_years);
-        ++nvisits;
-        linep = line;
-    } 
-    // Find average users
-    info->average = (double)nvisits / nyears;
-}
-
-/**
-* (E) Map function for finding country count, creates linked list for all 
-* countries 
-* 
-* @param info Pointer to sinfo node to store country counts list in
-*/
-static void map_max_country(sinfo *info) {
-    char line[LINE_SIZE], *linep = line;
-    int ind;
-
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find country code segment of line
-        strsep(&linep, ","), strsep(&linep, ","), strsep(&linep, ",");
-         
-        // Turn country_code into an index
-        ind = ((linep[0] - 'A') * 26) + (linep[1] - 'A');
-
-        // Add to count for that country
-        ++(info->einfo[ind]);
-        linep = line;
+// Merges the results of a shard into those of another. Shards hold
+// disjoint keys, merging them is adding them up.
+static void reduce_merge(rshard *shard, rshard *other) {
+    sinfo *result = &shard->result;
+
+    if (current_query->select == Q_COUNTRY) {
+        country_merge(&result->einfo, &other->result.einfo);
+    } else if (top_k) {
+        topk_merge(&shard->top, &other->top);
+    } else if (other->result.filename[0] != '\0' &&
+        result->filename[0] == '\0') {
+        result->average = other->result.average;
+        strcpy(result->filename, other->result.filename);
+    } else if (other->result.filename[0] != '\0') {
+        reduce_best(result, other->result.average, other->result.filename);
     }
-
-    // Find max country count with lexicographical tie breaking
-    for (int i = 0; i < CCOUNT_SIZE; ++i) {
-        if (info->einfo[i] > info->einfo[ind]) {
-            ind = i;
-        }
-    } 
-    info->average = ind;
+    topk_free(&other->top);
 }
 
 /**
-* Cancel routine for the reduce thread, prints results of query
-*
-* @param v Pointer to sinfo containing results
+* Merges the results of the shards of each node into those of its first
+* shard, then those of the nodes into the first shard, and prints results
+* of query
 */
-static void reduce_cancel(void *v) {
-    sinfo *result = v;
-    if (current_query == E) {
-        int max = 0;
-        for (int i = 1; i < CCOUNT_SIZE; ++i) {
-            if (result->einfo[i] > result->einfo[max]) {
-                max = i;
+static void reduce_report() {
+    sinfo *result = &shards[0].result;
+    theap *top = &shards[0].top;
+
+    // Shard i reduces on the node of worker i, node 0 leading with shard 0
+    for (int node = 0; node < affinity_nodes(); ++node) {
+        rshard *lead = NULL;
+        for (int i = 0; i < reduce_shards; ++i) {
+            if (affinity_node(i) != node) {
+                continue;
             }
+            if (lead == NULL) {
+                lead = &shards[i];
+            } else {
+                reduce_merge(lead, &shards[i]);
+            }
+        }
+        if (lead != NULL && lead != &shards[0]) {
+            reduce_merge(&shards[0], lead);
         }
+    }
 
-        result->filename[0] = (max / 26) + 'A';
-        result->filename[1] = (max % 26) + 'A';
-        result->filename[2] = '\0';
-        result->average = result->einfo[max];
+    if (current_query->select == Q_COUNTRY && top_k) {
+        topk_countries(top, &result->einfo);
+    } else if (current_query->select == Q_COUNTRY) {
+        long max = country_max(&result->einfo);
+        country_code(max, result->filename);
+        result->average = country_get(&result->einfo, max);
     }
 
-    printf(
+    query_print(
         "Part: %s\n"
-        "Query: %s\n"
-        "Result: %lf, %s\n",
-        PART_STRINGS[current_part], QUERY_STRINGS[current_query],
-        result->average, result->filename);
+        "Query: %s\n",
+        PART_STRINGS[current_part], current_query->name);
+    if (current_query->select == Q_STATE) {
+        current_query->report();
+    } else if (top_k) {
+        topk_print(top);
+    } else {
+        query_print("Result: ");
+        query_row(result->average, result->filename);
+    }
+    topk_free(top);
     fflush(NULL);
 }
 
 /**
-* Reduce controller, calls reduce function for current query
+* Reduce controller, calls reduce function for current query on every
+* file passed to a shard until the map threads are done
 * 
-* @param v Pointer to head of sinfo linked list
-* @return Pointer to sinfo containing result
+* @param v Pointer to rshard of the shard to reduce
 */
 static void *reduce(void *v) {
-    pthread_cleanup_push(&reduce_cancel, v);
+    rshard *shard = v;
+    sinfo **infos = malloc(chan_batch * sizeof(sinfo*));
+    size_t ninfos;
+
+    // Run on the node of the worker of the same index, so the results of
+    // the shard are allocated there
+    if (use_numa) {
+        affinity_pin(shard->index);
+    }
+    topk_init(&shard->top, top_k);
 
     // Find reduce for current query
-    void (*f_reduce)(sinfo*);
-    if (current_query == E) {
+    void (*f_reduce)(rshard*, sinfo*);
+    if (current_query->select == Q_COUNTRY) {
         f_reduce = &reduce_max_country;
+    } else if (current_query->select == Q_STATE) {
+        f_reduce = &reduce_state;
     } else {
         f_reduce = &reduce_avg;
+        if (current_query->select == Q_MIN) {
+            shard->result.average = 0x7FFFFFFF;
+        }
     }
 
-    // Find query result
-    sinfo *result = v;
-    (*f_reduce)(result);
-
-     pthread_cleanup_pop(1);
-     return NULL;
-}
-
-// Helper for reduce_avg
-// Returns comparison based on current_query
-static char avgcmp(double a, double b) {
-    if (current_query == A || current_query == C) {
-        if (a > b) {
-            return 1;
-        } else if (a < b) {
-            return -1;
-        } else {
-            return 0;
-        }
-    } else {
-        if (a < b) {
-            return 1;
-        } else if (a > b) {
-            return -1;
-        } else {
-            return 0;
+    // Find query result, taking up to chan_batch files at once
+    while ((ninfos = chan_recv(&shard->chan, infos, chan_batch)) > 0) {
+        for (size_t i = 0; i < ninfos; ++i) {
+            (*f_reduce)(shard, infos[i]);
         }
     }
+
+    free(infos);
+    return NULL;
 }
 
 /**
-* (A/B/C/D) Reduce function for finding max/min average in mapred.tmp, 
+* (A/B/C/D) Reduce function for finding max/min average of the files,
 * bases result from current_query 
 *
-* @param result Pointer of sinfo to store result in
+* @param shard Pointer to rshard to store result in
+* @param info Pointer to sinfo of a mapped file
 */
-static void reduce_avg(sinfo *result) {
-    sinfo *cursor = NULL;
-    char res;
-    if (current_query == B || current_query == D) {
-        result->average = 0x7FFFFFFF;
-    }
-
-    // Until cancelled
-    while (1) {
-        // Consume available info from global buffer list
-        while (s_consumeinfo(&cursor)) {
-            
-            // Block canceling since there is an entry
-            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-
-            // Compare with current best
-            res = avgcmp(cursor->average, result->average);
-            if (res > 0) {
-                result->average = cursor->average;
-                strcpy(result->filename, cursor->filename);
-            }
-            // Equal - pick alphabetical order first
-            else if (res == 0) {
-                if (strcmp(cursor->filename, result->filename) < 0) {
-                    result->average = cursor->average;
-                    strcpy(result->filename, cursor->filename);
-                }
-            }
-        }
-        // Ran out of entries - enable canceling
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+static void reduce_avg(rshard *shard, sinfo *info) {
+    // Rank every file when more than the best is asked for
+    if (top_k) {
+        topk_push(&shard->top, info->average, info->filename);
+        return;
     }
+    reduce_best(&shard->result, info->average, info->filename);
 }
 
 /**
 * (E) Reduce function for finding country with the most users
 *
-* @param result Pointer of sinfo to store result in
+* @param shard Pointer to rshard to store result in
+* @param info Pointer to sinfo of a mapped file
 */
-static void reduce_max_country(sinfo *result) {
-    sinfo *cursor = NULL;
-    
-    // Until cancelled
-    while (1) {
-        
-        // Read line of file and add count to index code 
-        while (s_consumeinfo(&cursor)) {
-
-            // Block canceling since there is an entry
-            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-  
-            
-            // Add count to country code
-            result->einfo[(int)cursor->average] += 
-            cursor->einfo[(int)cursor->average]; 
-        }
-        // Enable canceling 
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    }
+static void reduce_max_country(rshard *shard, sinfo *info) {
+    // Add count to country code
+    country_add(&shard->result.einfo, (int)info->average,
+        country_get(&info->einfo, (int)info->average));
+}
+
+/**
+* (Q_STATE) Reduce function merging the keys of a shard of the query
+* state of every file into the query result
+*
+* @param shard Pointer to rshard of the keys to merge
+* @param info Pointer to sinfo of a mapped file
+*/
+static void reduce_state(rshard *shard, sinfo *info) {
+    // Merge state of the file into the query result
+    current_query->reduce(info->filename, info->state, shard->index);
 }
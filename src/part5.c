@@ -1,49 +1,64 @@
 #include "lott.h"
+#include "affinity.h"
+#include "country.h"
 #include "part5.h"
 
+// Reduce shards, each receiving the packets of its keys on a socket of
+// its own
+static rshard *shards;
+
 int part5(size_t nthreads) {
 
     // Create linked list of sinfo nodes, nfiles long
     sinfo *head = NULL, *cursor;
     int nfiles = make_files_list(&head);
+    if (nfiles < 0) {
+        return -1;
+    }
     cursor = head;
 
-    // Create socket pairs for connecting maps to reduce
-    int socketpairs[nthreads << 1];
-    struct pollfd redpfds[nthreads], mappfds[nthreads];
-    for (int i = 0; i < nthreads; ++i) {
-        socketpair(AF_LOCAL, SOCK_STREAM, 0, socketpairs + (i << 1));
-        // Reduce end
-        redpfds[i].fd = socketpairs[i << 1];
-        redpfds[i].events = POLLIN;
-        // Map end
-        mappfds[i].fd = socketpairs[(i << 1) + 1];
-        mappfds[i].events = POLLOUT;
+    // Spawn a reduce thread for every shard, each with a socket pair
+    // connecting maps to it. Map threads wait while chan_capacity packets
+    // on one are not received.
+    char threadname[THREADNAME_SIZE];
+    pthread_t t_reduce[reduce_shards];
+    shards = calloc(reduce_shards, sizeof(rshard));
+    for (int i = 0; i < reduce_shards; ++i) {
+        if (chan_open(&shards[i].chan, CHAN_SOCKET, sizeof(mrecord), NULL) <
+            0) {
+            query_fail("Could not create socket pair", errno);
+            while (i-- > 0) {
+                chan_free(&shards[i].chan);
+            }
+            free(shards);
+            free_files_list(head);
+            return -1;
+        }
     }
-
-    // Spawn reduce thread
-    char threadname[THREADNAME_SIZE] = {'r','e','d','u','c','e','\0'};
-    pthread_t t_reduce;
-    rargs redargs;
-    redargs.nthreads = nthreads;
-    redargs.pollfds = redpfds;
-    sinfo result;
-    redargs.result = &result;
-    if (current_query == E) {
-        result.einfo = calloc(CCOUNT_SIZE, sizeof(int));
+    for (int i = 0; i < reduce_shards; ++i) {
+        shards[i].index = i;
+        pthread_create(&t_reduce[i], NULL, reduce, &shards[i]);
+        snprintf(threadname, THREADNAME_SIZE, "%s%hu", "reduce",
+            (unsigned short)i);
+        pthread_setname_np(t_reduce[i], threadname);
     }
-    pthread_create(&t_reduce, NULL, reduce, &redargs);
-    pthread_setname_np(t_reduce, threadname);
     
     // Divide sinfo list equally between map threads
     pthread_t t_readers[nthreads];
     margs mapargs[nthreads];
     int nfiles_per = nfiles / nthreads, nfiles_rem = nfiles % nthreads;
+
+    // Give map threads the files cached on their nodes
+    if (use_numa && nfiles > 0) {
+        int counts[nthreads];
+        for (int i = 0; i < nthreads; ++i) {
+            counts[i] = nfiles_per + (i < nfiles_rem);
+        }
+        place_files(&head, nfiles, counts, nthreads);
+        cursor = head;
+    }
     for (int i = 0; i < nthreads; ++i) {
 
-        // Create socket for map reduce communication
-        mapargs[i].pollfd = mappfds[i];
-        
         // Set nfiles
         mapargs[i].nfiles = nfiles_per;
         if (i < nfiles_rem) {
@@ -53,12 +68,13 @@ int part5(size_t nthreads) {
             break;
         }
 
-        // Set new sub-list head
+        // Set new sub-list head and the node of the thread
         mapargs[i].head = cursor;
+        mapargs[i].worker = i;
 
         // Spawn and name map thread
         pthread_create(&t_readers[i], NULL, map, &mapargs[i]);
-        sprintf(threadname, "%s%d", "map", i + 2);
+        snprintf(threadname, THREADNAME_SIZE, "%s%d", "map", i + 2);
         pthread_setname_np(t_readers[i], threadname);
 
         // Move to next sub-list head
@@ -70,143 +86,63 @@ int part5(size_t nthreads) {
         }
     }
 
-    // Join all map threads 
+    // Join all used map threads 
     for (int i = 0; i < nthreads; ++i) {
-        pthread_join(t_readers[i], NULL);
-    }
-
-    // Cancel reduce thread since all map threads have been joined
-    pthread_cancel(t_reduce);
-    pthread_join(t_reduce, NULL);
-
-    // Restore resources
-    for (int i = 0; i < nthreads << 1; ++i) {
-        close(socketpairs[i]);
-    }
-    sinfo *prev;
-    cursor = head;
-    if (current_query == E) {
-        while (cursor != NULL) {
-            free(cursor->einfo);     
-            prev = cursor;
-            cursor = cursor->next;
-            free(prev);
-        }
-    } else {
-        while (cursor != NULL) {
-            prev = cursor;
-            cursor = cursor->next;
-            free(prev);
+        if (mapargs[i].nfiles) {
+            pthread_join(t_readers[i], NULL);
         }
     }
 
-    return 0;
-}
-
-/**
-* Makes a linked list of sinfo nodes, returns the length of the list
-*
-* @param head Pointer to sinfo pointer where head pointer will be stored
-* @return Number of files found in data dir (length of list created)
-*/
-static int make_files_list(sinfo **head) {
-    int nfiles;
-
-    // Open data directory
-    DIR *dir = opendir(DATA_DIR);
-    struct dirent *direp;
-    
-    // For every file found, add a node containing the filename
-    for (nfiles = 0; (direp = readdir(dir)) != NULL; ++nfiles) {
-        if (direp->d_name[0] == '.') {
-            --nfiles;
-            continue;
-        }
-        
-        sinfo *new_node = calloc(1, sizeof(sinfo));
-        strcpy(new_node->filename, direp->d_name);
-        if (current_query == E) {
-            new_node->einfo = calloc(CCOUNT_SIZE, sizeof(int));
-        }
-
-        new_node->next = *head;
-        *head = new_node;
+    // Close sockets since all map threads have been joined, the reduce
+    // threads return once they have received their last packet
+    for (int i = 0; i < reduce_shards; ++i) {
+        chan_close(&shards[i].chan);
     }
-
-    closedir(dir);
-    return nfiles;
-}
-
-// Converts string to integer
-static int stoi(char *str, int n) {
-    int num = 0;
-    for (int i = 0; i < n; ++i) {
-        num *= 10;
-        num += str[i] - '0';
+    for (int i = 0; i < reduce_shards; ++i) {
+        pthread_join(t_reduce[i], NULL);
     }
-    return num;
-}
 
-// Converts string to long
-static long stol(char *str, int n) {
-    long num = 0;
-    for (int i = 0; i < n; ++i) {
-        num *= 10;
-        num += str[i] - '0';
-    }
-    return num;
-}
+    // Merge results of the shards and print them
+    reduce_report();
 
-// Socket writer using poll to wait for availability
-static void s_writeinfo(struct pollfd pfd, sinfo *info) {
-    char packet[PACKET_SIZE];
-    memset(packet, 0, PACKET_SIZE);
-    
-    // Create packet to send
-    if (current_query != E) {
-        sprintf(packet, "%s %lf\n", info->filename, info->average);
-    } else {
-        sprintf(packet, "%d %d\n", info->einfo[(int)info->average], 
-        (int)info->average);
-    }
-    
-    // Wait for availability to write
-    if (poll(&pfd, 1, 10000) <= 0) {
-        perror("Packet writing timeout/error...");
-        exit(EXIT_FAILURE);
+    // Restore resources
+    for (int i = 0; i < reduce_shards; ++i) {
+        chan_free(&shards[i].chan);
+        country_free(&shards[i].result.einfo);
     }
+    free(shards);
+    free_files_list(head);
 
-    // Write packet to socket
-    send(pfd.fd, packet, PACKET_SIZE, 0);
+    return 0;
 }
 
-// Socket reader using poll to wait for availability 
-static int s_readinfo(struct pollfd *pfds, int npfds, void *a, void *b) {
-    char packet[PACKET_SIZE];
-    memset(packet, 0, PACKET_SIZE);
-    // Wait for events on sockets
-    if (poll(pfds, npfds, 10) <= 0) {
-        // Timeout or error
-        return 0;
-    }
-    
-    // Check where event occurred
-    for (int i = 0; i < npfds; ++i) {
-        if (pfds[i].revents & POLLIN) {
-            // Read packet from socket
-            recv(pfds[i].fd, packet, PACKET_SIZE, 0);
-            break;
-        }
+// Sends the packet of a file to the shard of its key, waiting while
+// chan_capacity packets are not received yet
+static void s_writeinfo(sinfo *info) {
+    mrecord record;
+
+    memset(&record, 0, sizeof(mrecord));
+    strcpy(record.filename, info->filename);
+    record.average = info->average;
+    if (current_query->select == Q_STATE) {
+        // Maps and reduce share the address space, pass the state itself
+        record.state = info->state;
+    } else if (current_query->select == Q_COUNTRY) {
+        record.code = (int)info->average;
+        record.count = country_get(&info->einfo, record.code);
     }
 
-    // Parse info from packet
-    if (current_query != E) {
-        sscanf(packet, "%s %lf\n", (char*)a, (double*)b);
+    // Packets of a state are keyed inside it, every shard reduces its keys
+    // of them
+    if (current_query->select == Q_STATE) {
+        for (int i = 0; i < reduce_shards; ++i) {
+            chan_send(&shards[i].chan, &record);
+        }
+    } else if (current_query->select == Q_COUNTRY) {
+        chan_send(&shards[query_shard(record.code)].chan, &record);
     } else {
-        sscanf(packet, "%d %d\n", (int*)a, (int*)b);
+        chan_send(&shards[query_shard_name(record.filename)].chan, &record);
     }
-
-    return 1;
 }
 
 /**
@@ -218,42 +154,21 @@ static int s_readinfo(struct pollfd *pfds, int npfds, void *a, void *b) {
 static void* map(void* v) {
     margs *args = v;
     sinfo *info = args->head;
-    
-    // Find map for current query
-    void (*f_map)(sinfo*);
-    switch (current_query) {
-        case A:
-        case B:
-            f_map = &map_avg_dur;
-            break;
-        case C:
-        case D:
-            f_map = &map_avg_user;
-            break;
-        case E:
-            f_map = &map_max_country;
-    }
 
+    // Run on the node of this thread, so what it allocates is local
+    if (use_numa) {
+        affinity_pin(args->worker);
+    }
+    
     // For all files assigned to this thread
-    char filepath[FILENAME_SIZE];
-    sprintf(filepath, "./%s/", DATA_DIR);
     for (int i = 0; i < args->nfiles; ++i) {
-        
-        // Open file
-        strcpy(filepath + 7, info->filename);
-        info->file = fopen(filepath, "r");
-        if (info->file == NULL) {
-            exit(EXIT_FAILURE);
+        // Leave the rest of the files unmapped once the run has failed
+        if (query_error() != NULL || map_file(info) < 0) {
+            break;
         }
 
-        // Call map for query
-        (*f_map)(info);
-
-        // Write file info to mapred.tmp
-        s_writeinfo(args->pollfd, info);
-
-        // Close file
-        fclose(info->file);
+        // Send file info to the reduce shard
+        s_writeinfo(info);
         info = info->next;
     }
 
@@ -261,260 +176,172 @@ static void* map(void* v) {
     return NULL;
 }
 
-/**
-* (A/B) Map function for finding average duration of visit, sets average in 
-* passed sinfo node
-* 
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_dur(sinfo *info) {
-    char line[LINE_SIZE], *linep = line, *durstr;
-    int nvisits = 0, duration = 0;
-    
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find duration segment of line
-        strsep(&linep, ","), strsep(&linep, ",");
-        durstr = strsep(&linep, ",");
-        
-        // Add duration to total
-        duration += stoi(durstr, strlen(durstr));
-        linep = line;
-        ++nvisits;
-    }
-
-    // Write average duration 
-    info->average = (double)duration / nvisits;
-}
-
-// Helper for map_avg_user
-// Checks bit array used_years for previously found years
-// Returns 1 if year not found, else 0
-static int check_year_used(int year, unsigned long *used_years) {
-    // Check bit at offset from 1970
-    unsigned long mask = 1;
-    year -= 70;
-    mask <<= year;
-    if (mask & *used_years) {
-        // Match found - year used
-        return 0;
-    }
-    // Match not found - year not used
-    *used_years |= mask;
-    return 1;
-}
-
-/**
-* (C/D) Map function for finding average users per year, sets average
-* in passed sinfo node
-*
-* @param info Pointer to sinfo node to store average in 
-*/
-static void map_avg_user(sinfo *info) {
-    char line[LINE_SIZE], *linep = line, *timestamp;
-    int nvisits = 0, nyears = 0;
-    unsigned long used_years = 0;
-    time_t ts;
-    struct tm tm;
-    
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find timestamp segment of line
-        timestamp = strsep(&linep, ",");
-
-        // Find year from timestamp
-        ts = stol(timestamp, strlen(timestamp));
-        localtime_r(&ts, &tm);
-
-        // Add to nyears if year is new
-        nyears += check_year_used(tm.tm_year, &used_years);
-        ++nvisits;
-        linep = line;
+// Keeps a file as the result if it beats the current one
+static void reduce_best(sinfo *result, double average, char *filename) {
+    // Compare file with current selection
+    char res = query_cmp(average, result->average);
+    if (res > 0) {
+        result->average = average;
+        strcpy(result->filename, filename);
     } 
-    // Find average users
-    info->average = (double)nvisits / nyears;
+    // Equal - pick alphabetical order first
+    else if (res == 0) {
+        if (strcmp(filename, result->filename) < 0) {
+            result->average = average;
+            strcpy(result->filename, filename);
+        }
+    }
 }
 
-/**
-* (E) Map function for finding country count, creates linked list for all 
-* countries 
-* 
-* @param info Pointer to sinfo node to store country counts list in
-*/
-static void map_max_country(sinfo *info) {
-    char line[LINE_SIZE], *linep = line;
-    int ind;
-
-    // For all lines in file
-    while (fgets(line, LINE_SIZE, info->file) != NULL) {
-        
-        // Find country code segment of line
-        strsep(&linep, ","), strsep(&linep, ","), strsep(&linep, ",");
-         
-        // Turn country_code into an index
-        ind = ((linep[0] - 'A') * 26) + (linep[1] - 'A');
-
-        // Add to count for that country
-        ++(info->einfo[ind]);
-        linep = line;
+// Merges the results of a shard into those of another. Shards hold
+// disjoint keys, merging them is adding them up.
+static void reduce_merge(rshard *shard, rshard *other) {
+    sinfo *result = &shard->result;
+
+    if (current_query->select == Q_COUNTRY) {
+        country_merge(&result->einfo, &other->result.einfo);
+    } else if (top_k) {
+        topk_merge(&shard->top, &other->top);
+    } else if (other->result.filename[0] != '\0' &&
+        result->filename[0] == '\0') {
+        result->average = other->result.average;
+        strcpy(result->filename, other->result.filename);
+    } else if (other->result.filename[0] != '\0') {
+        reduce_best(result, other->result.average, other->result.filename);
     }
-
-    // Find max country count with lexicographical tie breaking
-    for (int i = 0; i < CCOUNT_SIZE; ++i) {
-        if (info->einfo[i] > info->einfo[ind]) {
-            ind = i;
-        }
-    } 
-    info->average = ind;
+    topk_free(&other->top);
 }
 
 /**
-* Cancel routine for the reduce thread, prints results of query
-*
-* @param v Pointer to sinfo containing results
+* Merges the results of the shards of each node into those of its first
+* shard, then those of the nodes into the first shard, and prints results
+* of query
 */
-static void reduce_cancel(void *v) {
-    sinfo *result = v;
-    if (current_query == E) {
-        int max = 0;
-        for (int i = 1; i < CCOUNT_SIZE; ++i) {
-            if (result->einfo[i] > result->einfo[max]) {
-                max = i;
+static void reduce_report() {
+    sinfo *result = &shards[0].result;
+    theap *top = &shards[0].top;
+
+    // Shard i reduces on the node of worker i, node 0 leading with shard 0
+    for (int node = 0; node < affinity_nodes(); ++node) {
+        rshard *lead = NULL;
+        for (int i = 0; i < reduce_shards; ++i) {
+            if (affinity_node(i) != node) {
+                continue;
+            }
+            if (lead == NULL) {
+                lead = &shards[i];
+            } else {
+                reduce_merge(lead, &shards[i]);
             }
         }
+        if (lead != NULL && lead != &shards[0]) {
+            reduce_merge(&shards[0], lead);
+        }
+    }
 
-        result->filename[0] = (max / 26) + 'A';
-        result->filename[1] = (max % 26) + 'A';
-        result->filename[2] = '\0';
-        result->average = result->einfo[max];
+    if (current_query->select == Q_COUNTRY && top_k) {
+        topk_countries(top, &result->einfo);
+    } else if (current_query->select == Q_COUNTRY) {
+        long max = country_max(&result->einfo);
+        country_code(max, result->filename);
+        result->average = country_get(&result->einfo, max);
     }
 
-    printf(
+    query_print(
         "Part: %s\n"
-        "Query: %s\n"
-        "Result: %lf, %s\n",
-        PART_STRINGS[current_part], QUERY_STRINGS[current_query],
-        result->average, result->filename);
+        "Query: %s\n",
+        PART_STRINGS[current_part], current_query->name);
+    if (current_query->select == Q_STATE) {
+        current_query->report();
+    } else if (top_k) {
+        topk_print(top);
+    } else {
+        query_print("Result: ");
+        query_row(result->average, result->filename);
+    }
+    topk_free(top);
     fflush(NULL);
 }
 
 /**
-* Reduce controller, calls reduce function for current query
+* Reduce controller, calls reduce function for current query on every
+* packet a shard receives until the map threads are done
 * 
-* @param v Pointer to rargs container for reduce arguments
+* @param v Pointer to rshard of the shard to reduce
 */
 static void *reduce(void *v) {
-    rargs *args = v;
-    pthread_cleanup_push(&reduce_cancel, args->result);
+    rshard *shard = v;
+    mrecord *records = malloc(chan_batch * sizeof(mrecord));
+    size_t nrecords;
+
+    // Run on the node of the worker of the same index, so the results of
+    // the shard are allocated there
+    if (use_numa) {
+        affinity_pin(shard->index);
+    }
+    topk_init(&shard->top, top_k);
 
     // Find reduce for current query
-    void (*f_reduce)(rargs*);
-    if (current_query == E) {
+    void (*f_reduce)(rshard*, mrecord*);
+    if (current_query->select == Q_COUNTRY) {
         f_reduce = &reduce_max_country;
+    } else if (current_query->select == Q_STATE) {
+        f_reduce = &reduce_state;
     } else {
         f_reduce = &reduce_avg;
-    }
-
-    // Find query result
-    (*f_reduce)(args);
-
-     pthread_cleanup_pop(1);
-     return NULL;
-}
-
-// Helper for reduce_avg
-// Returns comparison based on current_query
-static char avgcmp(double a, double b) {
-    if (current_query == A || current_query == C) {
-        if (a > b) {
-            return 1;
-        } else if (a < b) {
-            return -1;
+        if (current_query->select == Q_MAX) {
+            shard->result.average = -1;
         } else {
-            return 0;
+            shard->result.average = 0x7FFFFFFF;
         }
-    } else {
-        if (a < b) {
-            return 1;
-        } else if (a > b) {
-            return -1;
-        } else {
-            return 0;
+    }
+
+    // Find query result, receiving up to chan_batch packets at once
+    while ((nrecords = chan_recv(&shard->chan, records, chan_batch)) > 0) {
+        for (size_t i = 0; i < nrecords; ++i) {
+            (*f_reduce)(shard, &records[i]);
         }
     }
+
+    free(records);
+    return NULL;
 }
 
 /**
-* (A/B/C/D) Reduce function for finding max/min average in mapred.tmp, 
+* (A/B/C/D) Reduce function for finding max/min average of the files,
 * bases result from current_query 
 *
-* @param args Pointer to rargs container for reduce args
+* @param shard Pointer to rshard to store result in
+* @param record Packet of a file received from a map thread
 */
-static void reduce_avg(rargs *args) {
-    sinfo *result = args->result;
-    char res, filename[FILENAME_SIZE];
-    double avg;
-    if (current_query == A || current_query == C) {
-        result->average = -1;
-    } else {
-        result->average = 0x7FFFFFFF;
-    }
-    // Find query result
-    char line[LINE_SIZE];
-    memset(line, 0, LINE_SIZE);
-    while (1) {
-        
-        // Read available info from mapred.tmp
-        while (s_readinfo(args->pollfds, args->nthreads, 
-        filename, &avg) != 0) {
-            
-            // Block canceling since there is an entry
-            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-            
-            // Read line of file and compare with current selection
-            res = avgcmp(avg, result->average);
-            if (res > 0) {
-                result->average = avg;
-                strcpy(result->filename, filename);
-            } 
-            // Equal - pick alphabetical order first
-            else if (res == 0) {
-                if (strcmp(filename, result->filename) < 0) {
-                    result->average = avg;
-                    strcpy(result->filename, filename);;
-                }
-            }
-        }
-        // Enable canceling
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+static void reduce_avg(rshard *shard, mrecord *record) {
+    // Rank every file when more than the best is asked for
+    if (top_k) {
+        topk_push(&shard->top, record->average, record->filename);
+        return;
     }
+    reduce_best(&shard->result, record->average, record->filename);
 }
 
 /**
 * (E) Reduce function for finding country with the most users
 *
-* @param args Pointer to rargs container for reduce args
+* @param shard Pointer to rshard to store result in
+* @param record Packet of a file received from a map thread
 */
-static void reduce_max_country(rargs *args) {
-    sinfo *result = args->result;
-    char line[LINE_SIZE];
-    int code = -1, count = -1;
-    memset(line, 0, LINE_SIZE);
-    while (1) {
-        
-        // Read line of file and add count to index code 
-        while (s_readinfo(args->pollfds, args->nthreads, &count, &code) != 0) {
-
-            // Block canceling since there is an entry
-            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-
-            // Add count to country code
-            result->einfo[code] += count; 
-        }
-        // Enable canceling 
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    }
+static void reduce_max_country(rshard *shard, mrecord *record) {
+    // Add count to country code
+    country_add(&shard->result.einfo, record->code, record->count);
 }
 
+/**
+* (Q_STATE) Reduce function merging the keys of a shard of the query
+* state of every file into the query result
+*
+* @param shard Pointer to rshard of the keys to merge
+* @param record Packet of a file received from a map thread
+*/
+static void reduce_state(rshard *shard, mrecord *record) {
+    // Merge state of the file into the query result
+    current_query->reduce(record->filename, record->state, shard->index);
+}
@@ -0,0 +1,221 @@
+#include "lott.h"
+#include "affinity.h"
+#include "pool.h"
+
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+
+// Items of the running pool and the next of them to take
+static void *(*pool_task)(void*);
+static void **pool_items;
+static size_t pool_nitems, pool_next;
+
+// Threads allowed to run tasks at once, of the pool_max started. Slots are
+// posted once per thread allowed, slots owed are withheld by the next
+// threads finishing a task.
+static size_t pool_limit, pool_max, pool_owed;
+static sem_t mut_pool, pool_slots;
+
+// Rows mapped since the pool was last resized, the rows/sec measured then
+// and the direction it was resized in
+static unsigned long pool_rows;
+static double pool_rate;
+static int pool_step;
+static struct timespec pool_tuned;
+
+// Reads the CPU quota of the cgroup of the process in cores, returns 0 if
+// it has none
+static size_t cgroup_quota() {
+    char line[FILENAME_SIZE], path[FILENAME_SIZE + 32] = "", max[32];
+    long quota = -1, period = 0;
+    FILE *file;
+
+    // cgroup v2 keeps quota and period in cpu.max of the cgroup
+    if ((file = fopen("/proc/self/cgroup", "r")) != NULL) {
+        while (fgets(line, sizeof(line), file) != NULL) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = '\0';
+                sprintf(path, "/sys/fs/cgroup%s/cpu.max", line + 3);
+                break;
+            }
+        }
+        fclose(file);
+    }
+    if ((file = fopen(path, "r")) != NULL ||
+        (file = fopen("/sys/fs/cgroup/cpu.max", "r")) != NULL) {
+        if (fscanf(file, "%31s %ld", max, &period) == 2 &&
+            strcmp(max, "max") != 0) {
+            quota = strtol(max, NULL, 10);
+        }
+        fclose(file);
+    } else if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) !=
+        NULL) {
+        // cgroup v1 keeps them apart
+        if (fscanf(file, "%ld", &quota) != 1) {
+            quota = -1;
+        }
+        fclose(file);
+        if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) !=
+            NULL) {
+            if (fscanf(file, "%ld", &period) != 1) {
+                period = 0;
+            }
+            fclose(file);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (quota + period - 1) / period;
+}
+
+/**
+* Finds the number of threads to run by default, the cores the process may
+* run on capped by the CPU quota of its cgroup
+*
+* @return Number of threads, at least 1
+*/
+size_t pool_auto() {
+    cpu_set_t set;
+    size_t ncpus, quota;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == 0) {
+        ncpus = CPU_COUNT(&set);
+    } else {
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if ((quota = cgroup_quota()) > 0 && quota < ncpus) {
+        ncpus = quota;
+    }
+    return ncpus > 0 ? ncpus : 1;
+}
+
+// Resizes the pool by the rows/sec mapped since it was last resized, going
+// on in the same direction while they grow and turning back when they
+// drop. Called with mut_pool held.
+static void pool_tune() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - pool_tuned.tv_sec) +
+        (now.tv_nsec - pool_tuned.tv_nsec) / 1e9;
+    if (elapsed < POOL_TUNE_SEC) {
+        return;
+    }
+    double rate = pool_rows / elapsed;
+    if (rate < pool_rate) {
+        pool_step = -pool_step;
+    }
+
+    if (pool_step > 0 && pool_limit < pool_max) {
+        ++pool_limit;
+        if (pool_owed > 0) {
+            --pool_owed;
+        } else {
+            sem_post(&pool_slots);
+        }
+    } else if (pool_step < 0 && pool_limit > 1) {
+        --pool_limit;
+        ++pool_owed;
+    }
+
+    pool_rate = rate;
+    pool_rows = 0;
+    pool_tuned = now;
+}
+
+// Start routine of pool threads, runs the task on items until every item
+// has been taken
+static void *pool_worker(void *v) {
+    void *item;
+
+    if (use_numa) {
+        affinity_pin((long)v);
+    }
+
+    while (1) {
+        // Take the next item once the pool allows another task
+        sem_wait(&pool_slots);
+        sem_wait(&mut_pool);
+        item = pool_next < pool_nitems ? pool_items[pool_next++] : NULL;
+        sem_post(&mut_pool);
+        if (item == NULL) {
+            sem_post(&pool_slots);
+            break;
+        }
+
+        (*pool_task)(item);
+
+        // Give the slot back unless the pool was resized down
+        sem_wait(&mut_pool);
+        pool_tune();
+        if (pool_owed > 0) {
+            --pool_owed;
+        } else {
+            sem_post(&pool_slots);
+        }
+        sem_post(&mut_pool);
+    }
+
+    return NULL;
+}
+
+/**
+* Runs a task on every item with a bounded pool of threads. The pool
+* starts nthreads of them at once and, measuring the rows/sec tasks report
+* through pool_progress, ramps that up to POOL_MAX_FACTOR times nthreads
+* while throughput grows, and back down while it drops.
+*
+* @param task Start routine of a task, called with an item
+* @param items Items to run the task on
+* @param nitems Number of items
+* @param nthreads Number of threads running at once to start with
+*/
+void pool_run(void *(*task)(void*), void **items, size_t nitems,
+    size_t nthreads) {
+    char threadname[THREADNAME_SIZE];
+
+    pool_task = task;
+    pool_items = items;
+    pool_nitems = nitems;
+    pool_next = 0;
+
+    // No more threads are started than there are items
+    pool_max = nthreads * POOL_MAX_FACTOR;
+    pool_max = pool_max < nitems ? pool_max : nitems;
+    pool_limit = nthreads < pool_max ? nthreads : pool_max;
+    pool_owed = 0;
+    pool_rows = 0;
+    pool_rate = 0;
+    pool_step = 1;
+    clock_gettime(CLOCK_MONOTONIC, &pool_tuned);
+    sem_init(&mut_pool, 0, 1);
+    sem_init(&pool_slots, 0, pool_limit);
+
+    pthread_t *t_workers = malloc(pool_max * sizeof(pthread_t));
+    for (long i = 0; i < pool_max; ++i) {
+        pthread_create(&t_workers[i], NULL, pool_worker, (void*)i);
+        snprintf(threadname, THREADNAME_SIZE, "%s%d", "map", (int)i + 2);
+        pthread_setname_np(t_workers[i], threadname);
+    }
+    for (size_t i = 0; i < pool_max; ++i) {
+        pthread_join(t_workers[i], NULL);
+    }
+
+    free(t_workers);
+    sem_destroy(&mut_pool);
+    sem_destroy(&pool_slots);
+}
+
+/**
+* Reports rows a task has mapped, the measure the pool is resized by
+*
+* @param rows Number of rows mapped since the last report
+*/
+void pool_progress(unsigned long rows) {
+    sem_wait(&mut_pool);
+    pool_rows += rows;
+    sem_post(&mut_pool);
+}
@@ -0,0 +1,886 @@
+#include "lott.h"
+#include "query.h"
+#include "affinity.h"
+#include "cache.h"
+#include "columnar.h"
+#include "country.h"
+#include "filter.h"
+#include "hist.h"
+#include "parse.h"
+#include "reader.h"
+#include "rollup.h"
+#include "stats.h"
+#include "zfile.h"
+#include "zone.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+
+const qdesc *current_query;
+size_t reduce_shards = 1;
+
+// Receivers of the rows of results and of files done mapping, with the
+// argument they are called with, and the progress of the run so far
+static void (*result_sink)(void*, double, const char*);
+static void (*progress_sink)(void*, qprogress*);
+static void *sink_arg;
+static qprogress run_progress;
+static char best_name[FILENAME_SIZE];
+static chist best_ccount;
+static pthread_mutex_t mut_progress = PTHREAD_MUTEX_INITIALIZER;
+
+// Receiver of warnings and errors, and the argument it is called with
+static void (*log_sink)(void*, const char*);
+static void *log_arg;
+
+// First error of the run, and set once there is one
+static char run_error[QUERY_ERROR_SIZE];
+static int run_failed;
+static pthread_mutex_t mut_error = PTHREAD_MUTEX_INITIALIZER;
+
+/********* Average duration of visit (A/B) *********/
+
+static void init_avg_dur(pinfo *partial, void *state) {
+    memset(partial, 0, sizeof(pinfo));
+    partial->fields = P_DURATION;
+}
+
+static void row_avg_dur(pinfo *partial, chist *einfo, void *state,
+    char **cols) {
+    char *durstr = cols[CSV_DURATION];
+    partial->duration += stoi(durstr, strlen(durstr));
+    ++partial->nvisits;
+}
+
+// Adds a batch of rows, summing durations in QUERY_LANES accumulators so
+// the adds of consecutive rows do not wait on one another
+static void rows_avg_dur(pinfo *partial, chist *einfo, void *state,
+    char *(*cols)[CSV_NCOLS], int n) {
+    unsigned long sums[QUERY_LANES] = {0};
+    char *durstr;
+    int i;
+
+    for (i = 0; i + QUERY_LANES <= n; i += QUERY_LANES) {
+        for (int j = 0; j < QUERY_LANES; ++j) {
+            durstr = cols[i + j][CSV_DURATION];
+            sums[j] += stoi(durstr, strlen(durstr));
+        }
+    }
+    for (; i < n; ++i) {
+        durstr = cols[i][CSV_DURATION];
+        sums[0] += stoi(durstr, strlen(durstr));
+    }
+    for (int j = 0; j < QUERY_LANES; ++j) {
+        partial->duration += sums[j];
+    }
+    partial->nvisits += n;
+}
+
+static double finalize_avg_dur(pinfo *partial, chist *einfo,
+    void *state) {
+    return (double)partial->duration / partial->nvisits;
+}
+
+/********* Average users per year (C/D) *********/
+
+static void init_avg_user(pinfo *partial, void *state) {
+    memset(partial, 0, sizeof(pinfo));
+    partial->fields = P_YEARS;
+}
+
+// Finds the bit of the year of a timestamp at its offset from 1970. Scans
+// reject rows out of the QUERY_YEARS years first, 0 if one gets here.
+static inline unsigned long year_bit(char *timestamp) {
+    time_t ts = stol(timestamp, strlen(timestamp));
+    struct tm tm;
+
+    if (localtime_r(&ts, &tm) == NULL || tm.tm_year < 70 ||
+        tm.tm_year >= 70 + QUERY_YEARS) {
+        return 0;
+    }
+    return 1UL << (tm.tm_year - 70);
+}
+
+static void row_avg_user(pinfo *partial, chist *einfo, void *state,
+    char **cols) {
+    partial->used_years |= year_bit(cols[CSV_TIMESTAMP]);
+    ++partial->nvisits;
+}
+
+// Adds a batch of rows, marking years in QUERY_LANES masks so the marks
+// of consecutive rows do not wait on one another
+static void rows_avg_user(pinfo *partial, chist *einfo, void *state,
+    char *(*cols)[CSV_NCOLS], int n) {
+    unsigned long years[QUERY_LANES] = {0};
+
+    for (int i = 0; i < n; ++i) {
+        years[i % QUERY_LANES] |= year_bit(cols[i][CSV_TIMESTAMP]);
+    }
+    for (int j = 0; j < QUERY_LANES; ++j) {
+        partial->used_years |= years[j];
+    }
+    partial->nvisits += n;
+}
+
+static double finalize_avg_user(pinfo *partial, chist *einfo,
+    void *state) {
+    return (double)partial->nvisits / __builtin_popcountl(partial->used_years);
+}
+
+/********* Country with the most users (E) *********/
+
+static void init_max_country(pinfo *partial, void *state) {
+    memset(partial, 0, sizeof(pinfo));
+    partial->fields = P_COUNTRY;
+}
+
+static void row_max_country(pinfo *partial, chist *einfo,
+    void *state, char **cols) {
+    // Count the country in its slot, skipping codes that are not two
+    // capital letters
+    long ind = country_index(cols[CSV_COUNTRY]);
+    if (ind >= 0) {
+        country_add(einfo, country_slot(ind), 1);
+    }
+    ++partial->nvisits;
+}
+
+static double finalize_max_country(pinfo *partial, chist *einfo,
+    void *state) {
+    // Find max country count with lexicographical tie breaking
+    return country_max(einfo);
+}
+
+/********* Duration histogram (H) *********/
+
+// Histogram of all files, printed by report_hist
+static hist result_hist;
+static pthread_once_t result_hist_once = PTHREAD_ONCE_INIT;
+
+// Histograms of files merged since the last report, freed once every shard
+// has merged them
+static hist **merged_hists;
+static size_t nmerged_hists, merged_hists_size;
+
+// Makes the buckets of the histogram of all files
+static void result_hist_alloc() {
+    hist_clear(&result_hist);
+}
+
+static void init_hist(pinfo *partial, void *state) {
+    memset(partial, 0, sizeof(pinfo));
+    hist_clear(state);
+}
+
+static void row_hist(pinfo *partial, chist *einfo, void *state,
+    char **cols) {
+    char *durstr = cols[CSV_DURATION];
+    hist_add(state, stoi(durstr, strlen(durstr)));
+    ++partial->nvisits;
+}
+
+static double finalize_hist(pinfo *partial, chist *einfo,
+    void *state) {
+    return partial->nvisits;
+}
+
+// Merges the range of buckets of a shard of the histogram of a file into
+// that of all files. Buckets are split into contiguous ranges rather than
+// hashed so shards keep adding four at a time. Shard 0 merges the count,
+// min and max and keeps the histogram to free at the next report.
+static void reduce_hist(char *filename, void *state, int shard) {
+    hist *h = state;
+
+    pthread_once(&result_hist_once, result_hist_alloc);
+    hist_merge_buckets(&result_hist, h, hist_nbuckets * shard / reduce_shards,
+        hist_nbuckets * (shard + 1) / reduce_shards);
+    if (shard != 0) {
+        return;
+    }
+    result_hist.count += h->count;
+    result_hist.min = h->min < result_hist.min ? h->min : result_hist.min;
+    result_hist.max = h->max > result_hist.max ? h->max : result_hist.max;
+    if (nmerged_hists == merged_hists_size) {
+        merged_hists_size = merged_hists_size ? merged_hists_size << 1 : 16;
+        merged_hists = realloc(merged_hists,
+            merged_hists_size * sizeof(hist*));
+    }
+    merged_hists[nmerged_hists++] = h;
+}
+
+// Prints the count of every bucket with durations in it, then quantiles
+// derived from them
+static void report_hist() {
+    static const double quantiles[] = {0.5, 0.9, 0.95, 0.99, 0.999};
+    static const char *labels[] = {"p50", "p90", "p95", "p99", "p99.9"};
+    char label[48];
+    unsigned long lo, hi;
+
+    pthread_once(&result_hist_once, result_hist_alloc);
+    for (size_t i = 0; i < nmerged_hists; ++i) {
+        hist_free(merged_hists[i]);
+    }
+    nmerged_hists = 0;
+    query_print("Result:\n");
+    for (unsigned long i = 0; i < hist_nbuckets; ++i) {
+        if (result_hist.counts[i] != 0) {
+            hist_bounds(i, &lo, &hi);
+            sprintf(label, "%lu-%lu", lo, hi);
+            query_count(result_hist.counts[i], label);
+        }
+    }
+    if (result_hist.count != 0) {
+        query_print("Quantiles:\n");
+        query_count(result_hist.min, "min");
+        for (int i = 0; i < sizeof(quantiles) / sizeof(double); ++i) {
+            query_count(hist_quantile(&result_hist, quantiles[i]),
+                (char*)labels[i]);
+        }
+        query_count(result_hist.max, "max");
+    }
+    hist_clear(&result_hist);
+}
+
+/********* Time-bucketed rollup (T) *********/
+
+// Series of every file, merged by report_rollup
+static rollup *series;
+static size_t nseries, series_size;
+
+static void init_rollup(pinfo *partial, void *state) {
+    memset(partial, 0, sizeof(pinfo));
+    rollup_clear(state);
+}
+
+static void row_rollup(pinfo *partial, chist *einfo, void *state,
+    char **cols) {
+    char *timestamp = cols[CSV_TIMESTAMP], *durstr = cols[CSV_DURATION];
+    rollup_add(state, rollup_key(stol(timestamp, strlen(timestamp))),
+        stoi(durstr, strlen(durstr)));
+    ++partial->nvisits;
+}
+
+static double finalize_rollup(pinfo *partial, chist *einfo,
+    void *state) {
+    return partial->nvisits;
+}
+
+// Takes the series of a file for report_rollup, doubling the series kept
+// when full. Taking it is shard 0's alone, rollup_merge splits the pages
+// of the series between threads once they are all taken.
+static void reduce_rollup(char *filename, void *state, int shard) {
+    if (shard != 0) {
+        return;
+    }
+    if (nseries == series_size) {
+        series_size = series_size ? series_size << 1 : 16;
+        series = realloc(series, series_size * sizeof(rollup));
+    }
+    series[nseries++] = *(rollup*)state;
+    memset(state, 0, sizeof(rollup));
+}
+
+// Merges the series of all files, then prints the visits and summed
+// duration of every bucket with rows, from the first to the last
+static void report_rollup() {
+    char label[ROLLUP_LABEL_SIZE], row[ROLLUP_LABEL_SIZE + 24];
+    size_t nmerged;
+
+    rentry *merged = rollup_merge(series, nseries, &nmerged);
+    query_print("Result:\n");
+    for (size_t i = 0; i < nmerged; ++i) {
+        rollup_label(merged[i].key, label);
+        sprintf(row, "%lu, %s", merged[i].bucket.duration, label);
+        query_count(merged[i].bucket.nvisits, row);
+    }
+
+    free(merged);
+    for (size_t i = 0; i < nseries; ++i) {
+        rollup_free(&series[i]);
+    }
+    nseries = 0;
+}
+
+const qdesc queries[] = {
+    {"A", P_DURATION, Q_MAX, 0, init_avg_dur, row_avg_dur, rows_avg_dur,
+        partial_merge, finalize_avg_dur},
+    {"B", P_DURATION, Q_MIN, 0, init_avg_dur, row_avg_dur, rows_avg_dur,
+        partial_merge, finalize_avg_dur},
+    {"C", P_YEARS, Q_MAX, 0, init_avg_user, row_avg_user, rows_avg_user,
+        partial_merge, finalize_avg_user},
+    {"D", P_YEARS, Q_MIN, 0, init_avg_user, row_avg_user, rows_avg_user,
+        partial_merge, finalize_avg_user},
+    {"E", P_COUNTRY, Q_COUNTRY, 0, init_max_country, row_max_country, NULL,
+        partial_merge, finalize_max_country},
+    {"H", 0, Q_STATE, sizeof(hist), init_hist, row_hist, NULL, partial_merge,
+        finalize_hist, reduce_hist, report_hist},
+    {"T", 0, Q_STATE, sizeof(rollup), init_rollup, row_rollup, NULL,
+        partial_merge, finalize_rollup, reduce_rollup, report_rollup},
+    {NULL}
+};
+
+/**
+* Finds a query in the registry by name
+*
+* @param name Name of the query, as given on the command line
+* @return Pointer to the query descriptor, NULL if there is none
+*/
+const qdesc *query_find(char *name) {
+    for (const qdesc *query = queries; query->name != NULL; ++query) {
+        if (strcmp(query->name, name) == 0) {
+            return query;
+        }
+    }
+    return NULL;
+}
+
+// Timestamps of the start of 1970 and of the year QUERY_YEARS after it in
+// local time, the years used_years has bits for
+static long years_start, years_end;
+static pthread_once_t years_once = PTHREAD_ONCE_INIT;
+
+static void years_bounds() {
+    struct tm start = {.tm_year = 70, .tm_mday = 1, .tm_isdst = -1};
+    struct tm end = {.tm_year = 70 + QUERY_YEARS, .tm_mday = 1,
+        .tm_isdst = -1};
+
+    years_start = mktime(&start);
+    years_end = mktime(&end);
+}
+
+/**
+* Checks timestamps from ts_min to ts_max all fall in the QUERY_YEARS years
+* from 1970 that used_years has bits for, in local time
+*
+* @param ts_min Earliest timestamp
+* @param ts_max Latest timestamp
+* @return 1 if they do, else 0
+*/
+int query_years(long ts_min, long ts_max) {
+    pthread_once(&years_once, years_bounds);
+    return ts_min >= years_start && ts_max < years_end;
+}
+
+// Maps lines of an open data file up to limit bytes, or to its end if
+// limit is negative. Rows are rejected by their timestamp before the rest
+// of them is split, malformed rows are skipped. Queries counting years
+// also reject rows out of the years used_years has bits for. Ranges of
+// the well formed rows are widened to them unless range is NULL.
+static void query_scan(lreader *reader, char *filename, long limit,
+    pinfo *partial, chist *einfo, void *state, srange *range) {
+    void (*f_row)(pinfo*, chist*, void*, char**) = current_query->row;
+    void (*f_rows)(pinfo*, chist*, void*, char *(*)[CSV_NCOLS], int) =
+        current_query->rows;
+    int check_years = current_query->fields & P_YEARS;
+    char *lines[QUERY_BATCH], *ends[QUERY_BATCH], *rest;
+    char *cols[QUERY_BATCH][CSV_NCOLS];
+    size_t raws[QUERY_BATCH];
+    int nlines, nrows;
+    long ts, dur;
+
+    pthread_once(&years_once, years_bounds);
+
+    // For all lines in range, a batch of them at a time
+    while (limit != 0 &&
+        (nlines = reader_lines(reader, lines, ends, raws, QUERY_BATCH)) > 0) {
+        nrows = 0;
+        for (int i = 0; i < nlines && limit != 0; ++i) {
+            if (limit > 0) {
+                limit -= raws[i];
+                limit = limit > 0 ? limit : 0;
+            }
+            if (lines[i] == ends[i]) {
+                continue;
+            }
+
+            // Split timestamp off line first to check it against the filter
+            rest = csv_timestamp(lines[i], ends[i], cols[nrows]);
+            if (rest == NULL) {
+                reader_reject(filename, lines[i], ends[i]);
+                continue;
+            }
+            if (use_filter && !filter_timestamp(cols[nrows][CSV_TIMESTAMP])) {
+                continue;
+            }
+
+            // Split rest of line into its columns
+            if (csv_rest(rest, ends[i], cols[nrows]) < 0) {
+                reader_reject(filename, lines[i], ends[i]);
+                continue;
+            }
+            if (range != NULL || check_years) {
+                ts = stol(lines[i], rest - lines[i] - 1);
+            }
+            if (range != NULL) {
+                dur = stoi(cols[nrows][CSV_DURATION],
+                    cols[nrows][CSV_COUNTRY] - cols[nrows][CSV_DURATION] - 1);
+                range->ts_min = ts < range->ts_min ? ts : range->ts_min;
+                range->ts_max = ts > range->ts_max ? ts : range->ts_max;
+                range->dur_min = dur < range->dur_min ? dur : range->dur_min;
+                range->dur_max = dur > range->dur_max ? dur : range->dur_max;
+            }
+            if (check_years && (ts < years_start || ts >= years_end)) {
+                reader_reject(filename, lines[i], ends[i]);
+                continue;
+            }
+            if (use_filter && !filter_row(cols[nrows])) {
+                continue;
+            }
+            ++nrows;
+        }
+
+        // Add the rows kept, all at once for queries taking batches
+        if (f_rows != NULL) {
+            (*f_rows)(partial, einfo, state, cols, nrows);
+        } else {
+            for (int i = 0; i < nrows; ++i) {
+                (*f_row)(partial, einfo, state, cols[i]);
+            }
+        }
+    }
+}
+
+/**
+* Maps the rest of an open data file into partials for current_query. The
+* row callback is looked up once for the file, not for every line. Filtered
+* runs only read the chunks of the file its zone map says may have rows
+* passing the filter.
+*
+* @param file Pointer to open data file
+* @param filename Name of the data file in DATA_DIR
+* @param partial Pointer to pinfo to store the partials in
+* @param einfo Country histogram to add counts to
+* @param state Query state of the file, NULL if the query keeps none
+* @param range Pointer to store the ranges of the well formed rows in,
+* NULL if they are not needed
+* @return Bytes of a last line without a newline left unread when files
+* are mapped as they are appended to, it is mapped once it is whole
+*/
+size_t query_map(FILE *file, char *filename, pinfo *partial,
+    chist *einfo, void *state, srange *range) {
+    struct stat st;
+    zheader header;
+    zone *zones;
+    lreader reader;
+    size_t held;
+
+    current_query->init(partial, state);
+    reader_init(&reader, file);
+    if (range != NULL) {
+        *range = (srange){LONG_MAX, LONG_MIN, LONG_MAX, LONG_MIN};
+    }
+
+    // Rows of files being appended to may be half written at their end,
+    // compressed files are mapped whole every time
+    reader.hold = cache_append && !zcompressed(filename);
+
+    if (!use_filter || fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode) ||
+        (zones = zone_load(filename, &st, &header)) == NULL) {
+        query_scan(&reader, filename, -1, partial, einfo, state, range);
+        held = reader.hold ? reader.end - reader.start : 0;
+        reader_free(&reader);
+        return held;
+    }
+
+    // Skip the whole file, or every chunk of it, out of the filter window
+    long start = ftell(file);
+    if (filter_window(header.ts_min, header.ts_max)) {
+        for (unsigned long i = 0; i < header.nzones; ++i) {
+            long end = i + 1 < header.nzones ? zones[i + 1].offset :
+                header.src_size;
+            long offset = zones[i].offset > start ? zones[i].offset : start;
+            if (offset >= end ||
+                !filter_window(zones[i].ts_min, zones[i].ts_max)) {
+                continue;
+            }
+            if (fseek(file, offset, SEEK_SET) == 0) {
+                reader_reset(&reader);
+                query_scan(&reader, filename, end - offset, partial, einfo,
+                    state, NULL);
+            }
+        }
+    }
+    reader_free(&reader);
+    free(zones);
+    return 0;
+}
+
+/**
+* Maps a file of DATA_DIR for current_query, the same way for every part.
+* Partials cached for the file are reused, only mapping what was appended
+* to it since they were stored, and stats and columns of the file are
+* preferred to its rows. The result of the file is finalized and reported
+* as progress.
+*
+* @param info Pointer to sinfo of the file, marked mapped once it is
+* @return Number of rows read from the file itself, negative if it could
+* not be opened, which fails the run
+*/
+long map_file(sinfo *info) {
+    char filepath[FILENAME_SIZE + 16];
+    struct stat st;
+    pinfo cached;
+    srange range, *rangep = NULL;
+    off_t covered;
+    size_t held;
+    long rows = 0;
+    FILE *file;
+
+    snprintf(filepath, sizeof(filepath), "./%s/%s", DATA_DIR, info->filename);
+    if (use_numa) {
+        affinity_alloc(&info->state);
+    }
+
+    covered = cache_lookup(filepath, &st, &cached, &info->einfo);
+    if (covered == 0 &&
+        (stats_lookup(info->filename, &st, &info->partial, &info->einfo) ||
+        col_map(info->filename, &st, &info->partial, &info->einfo))) {
+        // Answered from the stats or columnar conversion of the file
+        cache_store(filepath, &st, &info->partial, &info->einfo);
+    } else if (covered == 0 && use_filter &&
+        stats_prune(info->filename, &st)) {
+        // No row of the file can pass the filter
+        current_query->init(&info->partial, info->state);
+    } else if (covered == 0 || covered < st.st_size) {
+        // Open file
+        file = zopen(filepath, covered);
+        if (file == NULL) {
+            query_fail(filepath, errno);
+            return -1;
+        }
+
+        // Map file for query, recording ranges when the scan sees every row
+        if (use_stats && covered == 0 && !use_filter) {
+            rangep = &range;
+        }
+        held = query_map(file, info->filename, &info->partial, &info->einfo,
+            info->state, rangep);
+        rows = info->partial.nvisits;
+
+        // Close file
+        st.st_size = zclose(file, st.st_size) - held;
+        current_query->combine(&info->partial, &cached);
+        cache_store(filepath, &st, &info->partial, &info->einfo);
+        if (use_stats) {
+            stats_store(info->filename, &st, &info->partial, &info->einfo,
+                rangep);
+        }
+    } else {
+        info->partial = cached;
+    }
+    info->average = current_query->finalize(&info->partial, &info->einfo,
+        info->state);
+    info->mapped = 1;
+    query_progress(info->filename, info->average, info->partial.nvisits,
+        &info->einfo);
+    return rows;
+}
+
+/**
+* Makes a linked list of sinfo nodes, returns the length of the list
+*
+* @param head Pointer to sinfo pointer where head pointer will be stored
+* @return Number of files found in data dir (length of list created),
+* negative if it could not be opened
+*/
+int make_files_list(sinfo **head) {
+    int nfiles;
+
+    // Open data directory
+    DIR *dir = opendir(DATA_DIR);
+    struct dirent *direp;
+    if (dir == NULL) {
+        query_fail(DATA_DIR, errno);
+        return -1;
+    }
+
+    // For every file found, add a node containing the filename
+    for (nfiles = 0; (direp = readdir(dir)) != NULL; ++nfiles) {
+        if (direp->d_name[0] == '.') {
+            --nfiles;
+            continue;
+        }
+
+        sinfo *new_node = calloc(1, sizeof(sinfo));
+        strcpy(new_node->filename, direp->d_name);
+
+        // Map threads placed on nodes allocate the partials of their files
+        if (!use_numa) {
+            affinity_alloc(&new_node->state);
+        }
+
+        new_node->next = *head;
+        *head = new_node;
+    }
+
+    closedir(dir);
+    return nfiles;
+}
+
+/**
+* Frees a linked list of sinfo nodes made by make_files_list
+*
+* @param head Pointer to head of sinfo linked list
+*/
+void free_files_list(sinfo *head) {
+    sinfo *prev;
+
+    while (head != NULL) {
+        country_free(&head->einfo);
+        free(head->state);
+        prev = head;
+        head = head->next;
+        free(prev);
+    }
+}
+
+/**
+* Reorders the sinfo list so the share of each map thread is, where
+* possible, cached on the node the thread runs on
+*
+* @param head Pointer to sinfo pointer of the head of the list
+* @param nfiles Length of the list
+* @param counts Number of files of each map thread
+* @param nthreads Number of map threads
+*/
+void place_files(sinfo **head, int nfiles, int *counts, size_t nthreads) {
+    sinfo *infos[nfiles], *cursor = *head;
+    char *filenames[nfiles];
+    int order[nfiles];
+
+    for (int i = 0; i < nfiles; ++i, cursor = cursor->next) {
+        infos[i] = cursor;
+        filenames[i] = cursor->filename;
+    }
+    affinity_assign(filenames, nfiles, counts, nthreads, order);
+
+    // Relink the list in the order the threads take the files
+    for (int i = 0; i < nfiles; ++i) {
+        infos[order[i]]->next = i + 1 < nfiles ? infos[order[i + 1]] : NULL;
+    }
+    *head = infos[order[0]];
+}
+
+/**
+* Compares two per-file results by the select direction of current_query
+*
+* @param a Result of a file
+* @param b Result of another file
+* @return Positive if a is the better result, negative if b is, else 0
+*/
+int query_cmp(double a, double b) {
+    // Files without a result, such as files filtered empty, are the worst
+    if (isnan(b)) {
+        return !isnan(a);
+    }
+    if (isnan(a)) {
+        return -1;
+    }
+    if (current_query->select == Q_MIN) {
+        return (a < b) - (a > b);
+    }
+    return (a > b) - (a < b);
+}
+
+/**
+* Sends the rows of results to a sink in place of stdout, and reports files
+* done mapping to another, starting the progress of a run over
+*
+* @param result Sink of rows, called with arg, the value and the name of a
+* row, NULL to print rows
+* @param progress Sink of progress, called with arg and the progress of the
+* run every time a file is done mapping, NULL for none
+* @param arg Argument the sinks are called with
+*/
+void query_sinks(void (*result)(void*, double, const char*),
+    void (*progress)(void*, qprogress*), void *arg) {
+    pthread_mutex_lock(&mut_progress);
+    result_sink = result;
+    progress_sink = progress;
+    sink_arg = arg;
+    memset(&run_progress, 0, sizeof(qprogress));
+    country_free(&best_ccount);
+    pthread_mutex_unlock(&mut_progress);
+}
+
+/**
+* Sends the warnings and errors of the engine to a sink in place of stderr
+*
+* @param log Sink of messages, called with arg and a message without its
+* newline from any thread, NULL to print them to stderr
+* @param arg Argument the sink is called with
+*/
+void query_logger(void (*log)(void*, const char*), void *arg) {
+    log_sink = log;
+    log_arg = arg;
+}
+
+/**
+* Prints a warning or error of the engine to stderr, or hands it to the log
+* sink
+*
+* @param format printf format of the message, without a newline
+*/
+void query_log(const char *format, ...) {
+    char message[QUERY_ERROR_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, QUERY_ERROR_SIZE, format, args);
+    va_end(args);
+    if (log_sink != NULL) {
+        log_sink(log_arg, message);
+    } else {
+        fprintf(stderr, "%s\n", message);
+    }
+}
+
+/**
+* Prints a line of the output of a query other than a row of its result,
+* such as its name. Nothing is printed while rows go to a result sink, or
+* once the run has failed.
+*
+* @param format printf format of the line
+*/
+void query_print(const char *format, ...) {
+    va_list args;
+
+    if (result_sink != NULL || query_error() != NULL) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/**
+* Prints a row of the result of a query, or hands it to the result sink.
+* Rows of a failed run are dropped.
+*
+* @param value Value of the row, such as the average of a file
+* @param name Name of the row, such as the file or country
+*/
+void query_row(double value, char *name) {
+    if (query_error() != NULL) {
+        return;
+    } else if (result_sink != NULL) {
+        result_sink(sink_arg, value, name);
+    } else {
+        printf("%lf, %s\n", value, name);
+    }
+}
+
+/**
+* Prints a row of the result of a query whose value is a count, or hands it
+* to the result sink. Rows of a failed run are dropped.
+*
+* @param value Count of the row
+* @param name Name of the row, such as the bucket counted
+*/
+void query_count(unsigned long value, char *name) {
+    if (query_error() != NULL) {
+        return;
+    } else if (result_sink != NULL) {
+        result_sink(sink_arg, value, name);
+    } else {
+        printf("%lu, %s\n", value, name);
+    }
+}
+
+/**
+* Reports a file a part is done mapping to the progress sink, if set
+*
+* @param filename Name of the file
+* @param value Result of the file, from finalize
+* @param rows Number of rows of the file
+* @param einfo Country histogram of the file
+*/
+void query_progress(char *filename, double value, unsigned long rows,
+    chist *einfo) {
+    if (progress_sink == NULL) {
+        return;
+    }
+
+    // Report totals in order, a file at a time
+    pthread_mutex_lock(&mut_progress);
+    ++run_progress.nfiles;
+    run_progress.nrows += rows;
+    run_progress.filename = filename;
+    run_progress.value = value;
+    run_progress.rows = rows;
+
+    // Keep the result over the files so far the way the reduce finds it
+    if (current_query->select == Q_COUNTRY) {
+        run_progress.value = country_get(einfo, (long)value);
+        run_progress.country[0] = '\0';
+        if (run_progress.value != 0) {
+            country_code((long)value, run_progress.country);
+        }
+        country_add(&best_ccount, (long)value, country_get(einfo, (long)value));
+        long max = country_max(&best_ccount);
+        if (country_get(&best_ccount, max) != 0) {
+            country_code(max, best_name);
+            run_progress.best = best_name;
+            run_progress.best_value = country_get(&best_ccount, max);
+        }
+    } else if (current_query->select != Q_STATE) {
+        int cmp = run_progress.best ? query_cmp(value, run_progress.best_value) : 1;
+        if (cmp > 0 || (cmp == 0 && strcmp(filename, best_name) < 0)) {
+            snprintf(best_name, FILENAME_SIZE, "%s", filename);
+            run_progress.best = best_name;
+            run_progress.best_value = value;
+        }
+    }
+    progress_sink(sink_arg, &run_progress);
+    pthread_mutex_unlock(&mut_progress);
+}
+
+/**
+* Fails the run with an error the process can go on after, such as a data
+* file or channel that could not be read, logging it like perror. Maps
+* skip the files they have left, the result is not printed and the part
+* returns an error once its threads are done. The first error of a run is
+* kept for query_error.
+*
+* @param what What failed, such as the path of a file
+* @param err errno of the failure, 0 if there is none
+*/
+void query_fail(const char *what, int err) {
+    char message[QUERY_ERROR_SIZE];
+
+    if (err != 0) {
+        snprintf(message, QUERY_ERROR_SIZE, "%s: %s", what, strerror(err));
+    } else {
+        snprintf(message, QUERY_ERROR_SIZE, "%s", what);
+    }
+    query_log("%s", message);
+
+    pthread_mutex_lock(&mut_error);
+    if (!run_failed) {
+        strcpy(run_error, message);
+        __atomic_store_n(&run_failed, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mut_error);
+}
+
+/**
+* Finds the error that failed the run
+*
+* @return Message of the first error of the run, NULL if it has not failed
+*/
+const char *query_error() {
+    return __atomic_load_n(&run_failed, __ATOMIC_ACQUIRE) ? run_error : NULL;
+}
+
+/**
+* Clears the error of the last run, before a run starts
+*/
+void query_error_clear() {
+    pthread_mutex_lock(&mut_error);
+    run_failed = 0;
+    run_error[0] = '\0';
+    pthread_mutex_unlock(&mut_error);
+}
@@ -0,0 +1,250 @@
+#include "lott.h"
+#include "parse.h"
+#include "reader.h"
+
+#include <semaphore.h>
+
+unsigned long nbad_rows;
+
+// File malformed rows are written to, shared by all map threads
+static FILE *quarantine;
+static sem_t mut_quarantine;
+
+/**
+* Makes a line reader reading an open file from its current offset
+*
+* @param r Pointer to the reader
+* @param file Pointer to open data file
+*/
+void reader_init(lreader *r, FILE *file) {
+    r->file = file;
+    r->size = READER_BUF_SIZE;
+    r->buf = malloc(r->size);
+    r->hold = 0;
+    reader_reset(r);
+}
+
+/**
+* Drops what a reader has buffered, for when its file was seeked
+*
+* @param r Pointer to the reader
+*/
+void reader_reset(lreader *r) {
+    r->start = r->scanned = r->end = 0;
+    r->eof = 0;
+}
+
+// Takes the line ending at a newline, or at the end of the buffer if nl is
+// NULL, terminating it in place
+static char *reader_take(lreader *r, char *nl, char **end, size_t *raw) {
+    char *line = r->buf + r->start;
+    char *e = nl != NULL ? nl : r->buf + r->end;
+    *raw = e - line + (nl != NULL);
+    r->start = r->scanned = r->start + *raw;
+    if (e > line && e[-1] == '\r') {
+        --e;
+    }
+    *e = '\0';
+    *end = e;
+    return line;
+}
+
+/**
+* Reads the next line, terminated in place without its newline or CRLF
+*
+* @param r Pointer to the reader
+* @param end Pointer to store the end of the line in
+* @param raw Pointer to store the bytes the line took in the file in
+* @return Pointer to the line, NULL at the end of the file
+*/
+char *reader_line(lreader *r, char **end, size_t *raw) {
+    char *nl;
+
+    while (1) {
+        // Find the newline in what was not searched yet
+        nl = memchr(r->buf + r->scanned, '\n', r->end - r->scanned);
+        if (nl != NULL || (r->eof && !r->hold && r->start < r->end)) {
+            return reader_take(r, nl, end, raw);
+        }
+        if (r->eof) {
+            return NULL;
+        }
+        r->scanned = r->end;
+
+        // Move the partial line to the front, doubling the buffer when the
+        // line fills it. A byte is kept free to terminate a last line
+        // without a newline.
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->scanned -= r->start;
+            r->start = 0;
+        }
+        if (r->end + 1 >= r->size) {
+            r->size <<= 1;
+            r->buf = realloc(r->buf, r->size);
+        }
+        size_t n = fread(r->buf + r->end, 1, r->size - r->end - 1, r->file);
+        r->eof = n == 0;
+        r->end += n;
+    }
+}
+
+/**
+* Reads a batch of lines, all of them from the buffer as last filled so
+* they stay valid together until the next read
+*
+* @param r Pointer to the reader
+* @param lines Array of max to store the lines in
+* @param ends Array of max to store the ends of the lines in
+* @param raws Array of max to store the bytes each line took in
+* @param max Most lines to read
+* @return Number of lines read, 0 at the end of the file
+*/
+int reader_lines(lreader *r, char **lines, char **ends, size_t *raws,
+    int max) {
+    char *nl;
+    int n;
+
+    if (max < 1 || (lines[0] = reader_line(r, &ends[0], &raws[0])) == NULL) {
+        return 0;
+    }
+    for (n = 1; n < max; ++n) {
+        nl = memchr(r->buf + r->scanned, '\n', r->end - r->scanned);
+        if (nl == NULL && !(r->eof && !r->hold && r->start < r->end)) {
+            break;
+        }
+        lines[n] = reader_take(r, nl, &ends[n], &raws[n]);
+    }
+    return n;
+}
+
+/**
+* Frees the buffer of a reader
+*
+* @param r Pointer to the reader
+*/
+void reader_free(lreader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// Splits a column off a line at the next comma, returns the length of the
+// column, -1 if there is no comma
+static inline long csv_field(char **linep, char *end) {
+    char *field = *linep, *comma = memchr(field, ',', end - field);
+    if (comma == NULL) {
+        return -1;
+    }
+    *comma = '\0';
+    *linep = comma + 1;
+    return comma - field;
+}
+
+// Returns 1 if a column of len bytes is all digits, and no more than max
+static inline int csv_digits(char *str, long len, long max) {
+    long i = 0;
+    if (len <= 0 || len > max) {
+        return 0;
+    }
+
+    // Check eight bytes at a time, then the bytes left over
+    for (; i + 8 <= len; i += 8) {
+        if (!parse_is_8digits(str + i)) {
+            return 0;
+        }
+    }
+    for (; i < len; ++i) {
+        if ((unsigned char)(str[i] - '0') > 9) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+* Splits the timestamp column off a line in place, checking it is a
+* number that fits a long
+*
+* @param line Line to split
+* @param end End of the line
+* @param cols Columns of the line to store the timestamp in
+* @return Pointer to the rest of the line, NULL if the column is malformed
+*/
+char *csv_timestamp(char *line, char *end, char **cols) {
+    char *rest = line;
+    long len = csv_field(&rest, end);
+    if (!csv_digits(line, len, TIMESTAMP_MAX_DIGITS)) {
+        return NULL;
+    }
+    cols[0] = line;
+    return rest;
+}
+
+/**
+* Splits the rest of a line into its ip, duration and country columns in
+* place, checking the duration is a number that fits an int and the
+* country is a two letter code
+*
+* @param rest Rest of the line after the timestamp column
+* @param end End of the line
+* @param cols Columns of the line to store the columns in
+* @return 0 if the columns are well formed, else negative
+*/
+int csv_rest(char *rest, char *end, char **cols) {
+    char *linep = rest;
+
+    cols[1] = linep;
+    if (csv_field(&linep, end) <= 0) {
+        return -1;
+    }
+    cols[2] = linep;
+    if (!csv_digits(cols[2], csv_field(&linep, end), DURATION_MAX_DIGITS)) {
+        return -1;
+    }
+    cols[3] = linep;
+    if (end - linep != 2 || linep[0] < 'A' || linep[0] > 'Z' ||
+        linep[1] < 'A' || linep[1] > 'Z') {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Counts a malformed row, writing it to the quarantine file if one is open
+*
+* @param filename Name of the data file the row is in
+* @param line Line of the row, split in place or not
+* @param end End of the line
+*/
+void reader_reject(char *filename, char *line, char *end) {
+    __sync_fetch_and_add(&nbad_rows, 1);
+    if (quarantine == NULL) {
+        return;
+    }
+
+    // Put back the commas the line was split at
+    for (char *c = line; c < end; ++c) {
+        if (*c == '\0') {
+            *c = ',';
+        }
+    }
+    sem_wait(&mut_quarantine);
+    fprintf(quarantine, "%s: %.*s\n", filename, (int)(end - line), line);
+    sem_post(&mut_quarantine);
+}
+
+/**
+* Opens the file malformed rows are quarantined in, appending to it
+*
+* @param path Path of the quarantine file
+* @return 0 on success, negative on error
+*/
+int reader_quarantine(char *path) {
+    if ((quarantine = fopen(path, "a")) == NULL) {
+        query_log("%s: %s", path, strerror(errno));
+        return -1;
+    }
+    sem_init(&mut_quarantine, 0, 1);
+    return 0;
+}
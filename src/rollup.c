@@ -0,0 +1,323 @@
+#include "lott.h"
+#include "rollup.h"
+
+#include <time.h>
+
+// Width of buckets
+static int rollup_width = R_DAY;
+
+/**
+* Arguments of a merging thread, merging the pages whose keys fall in
+* partition part of nparts
+*/
+typedef struct rmargs {
+    rollup *series;
+    size_t n;
+    size_t part;
+    size_t nparts;
+    rentry *entries;
+    size_t nentries;
+} rmargs;
+
+/**
+* Sets the width of rollup buckets
+*
+* @param width Bucket width: hour, day, month or year
+* @return 0 on success, negative if the width is not one of those
+*/
+int rollup_config(char *width) {
+    static const char *widths[] = {"hour", "day", "month", "year"};
+    for (int i = 0; i < sizeof(widths) / sizeof(char*); ++i) {
+        if (strcmp(width, widths[i]) == 0) {
+            rollup_width = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Floors the quotient of a and b, b being positive
+static inline long floor_div(long a, long b) {
+    return a / b - (a % b < 0);
+}
+
+// Finds the month since 1970 of a day since 1970, from the civil calendar
+// algorithm of days_from_civil run backwards
+static long month_of_day(long day) {
+    long z = day + 719468;
+    long era = floor_div(z, 146097);
+    long doe = z - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    long month = mp < 10 ? mp + 3 : mp - 9;
+    long year = yoe + era * 400 + (month <= 2);
+    return (year - 1970) * 12 + month - 1;
+}
+
+/**
+* Finds the key of the bucket of a timestamp
+*
+* @param ts Timestamp, seconds since 1970
+* @return Buckets of the configured width since 1970
+*/
+long rollup_key(long ts) {
+    switch (rollup_width) {
+        case R_HOUR:
+            return floor_div(ts, 3600);
+        case R_DAY:
+            return floor_div(ts, 86400);
+        case R_MONTH:
+            return month_of_day(floor_div(ts, 86400));
+        default:
+            return floor_div(month_of_day(floor_div(ts, 86400)), 12);
+    }
+}
+
+/**
+* Writes the start of a bucket as a UTC date, to the hour for hourly
+* buckets
+*
+* @param key Key of the bucket
+* @param label Buffer of ROLLUP_LABEL_SIZE to write the label to
+*/
+void rollup_label(long key, char *label) {
+    struct tm tm;
+    time_t ts;
+
+    switch (rollup_width) {
+        case R_HOUR:
+            ts = key * 3600;
+            gmtime_r(&ts, &tm);
+            strftime(label, ROLLUP_LABEL_SIZE, "%Y-%m-%d %H:00", &tm);
+            break;
+        case R_DAY:
+            ts = key * 86400;
+            gmtime_r(&ts, &tm);
+            strftime(label, ROLLUP_LABEL_SIZE, "%Y-%m-%d", &tm);
+            break;
+        case R_MONTH:
+            snprintf(label, ROLLUP_LABEL_SIZE, "%04d-%02d",
+                (int)(1970 + floor_div(key, 12)),
+                (int)(key - floor_div(key, 12) * 12 + 1));
+            break;
+        default:
+            snprintf(label, ROLLUP_LABEL_SIZE, "%04d", (int)(1970 + key));
+    }
+}
+
+// Hashes the key of a page, mixing its bits so pages next to each other
+// land in different slots and partitions
+static inline unsigned long rollup_hash(long page) {
+    unsigned long hash = page;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9UL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBUL;
+    return hash ^ (hash >> 31);
+}
+
+// Finds a page of a table of pages, making it zeroed the first time
+static rpage *rollup_page(htable *pages, long page) {
+    rpage **slot = htable_get(pages, (char*)&page, sizeof(long),
+        rollup_hash(page));
+    if (*slot == NULL) {
+        *slot = calloc(1, sizeof(rpage));
+        (*slot)->page = page;
+    }
+    return *slot;
+}
+
+// Frees the pages of a table of pages, leaving it empty
+static void rollup_free_pages(htable *pages) {
+    rpage **value;
+    size_t i = 0;
+
+    while (htable_next(pages, &i, (void**)&value) != NULL) {
+        free(*value);
+    }
+    htable_clear(pages);
+}
+
+/**
+* Empties a series, making its table the first time
+*
+* @param r Pointer to the series, zeroed or emptied before
+*/
+void rollup_clear(rollup *r) {
+    if (r->pages.ctrl == NULL) {
+        htable_init(&r->pages, sizeof(rpage*));
+    } else {
+        rollup_free_pages(&r->pages);
+    }
+    r->dir_n = 0;
+}
+
+/**
+* Frees the pages and table of a series
+*
+* @param r Pointer to the series
+*/
+void rollup_free(rollup *r) {
+    if (r->pages.ctrl != NULL) {
+        rollup_free_pages(&r->pages);
+        htable_free(&r->pages);
+    }
+    free(r->dir);
+    r->dir = NULL;
+    r->dir_n = r->dir_size = 0;
+}
+
+// Finds the page of a row not in the directory, adding the page to the
+// directory if the directory can grow to span it
+static rpage *rollup_dir_miss(rollup *r, long page) {
+    rpage *p = rollup_page(&r->pages, page);
+
+    if (r->dir_n == 0) {
+        r->dir_base = page;
+    }
+    long lo = page < r->dir_base ? page : r->dir_base;
+    long hi = page >= r->dir_base + (long)r->dir_n ? page + 1 :
+        r->dir_base + (long)r->dir_n;
+    if (hi - lo > ROLLUP_DIR_PAGES) {
+        return p;
+    }
+
+    // Grow to span the page, doubling the directory when full
+    size_t n = hi - lo;
+    if (n > r->dir_size) {
+        r->dir_size = r->dir_size ? r->dir_size : 16;
+        while (r->dir_size < n) {
+            r->dir_size <<= 1;
+        }
+        r->dir = realloc(r->dir, r->dir_size * sizeof(rpage*));
+    }
+    if (lo < r->dir_base) {
+        memmove(r->dir + (r->dir_base - lo), r->dir,
+            r->dir_n * sizeof(rpage*));
+        memset(r->dir, 0, (r->dir_base - lo) * sizeof(rpage*));
+    } else {
+        memset(r->dir + r->dir_n, 0, (n - r->dir_n) * sizeof(rpage*));
+    }
+    r->dir_base = lo;
+    r->dir_n = n;
+    r->dir[page - lo] = p;
+    return p;
+}
+
+/**
+* Adds a row to its bucket, adding the page of the bucket the first time
+*
+* @param r Pointer to the series
+* @param key Key of the bucket of the row
+* @param duration Duration of the row
+*/
+void rollup_add(rollup *r, long key, unsigned int duration) {
+    long page = key >> ROLLUP_PAGE_BITS;
+    size_t i = page - r->dir_base;
+    rpage *p = i < r->dir_n ? r->dir[i] : NULL;
+    if (p == NULL) {
+        p = rollup_dir_miss(r, page);
+    }
+
+    rbucket *bucket = &p->buckets[key & (ROLLUP_PAGE_SIZE - 1)];
+    ++bucket->nvisits;
+    bucket->duration += duration;
+}
+
+// Start routine of merging threads, adds the pages of every series that
+// fall in the partition of the thread, then lists their buckets with rows
+static void *rollup_merge_part(void *v) {
+    rmargs *args = v;
+    htable merged;
+    rpage **src, **dst;
+    hkey *key;
+    size_t i;
+
+    htable_init(&merged, sizeof(rpage*));
+    for (size_t s = 0; s < args->n; ++s) {
+        for (i = 0; (key = htable_next(&args->series[s].pages, &i,
+            (void**)&src)) != NULL;) {
+            if (key->hash % args->nparts != args->part) {
+                continue;
+            }
+            dst = htable_get(&merged, htable_key(key), key->len, key->hash);
+            if (*dst == NULL) {
+                *dst = calloc(1, sizeof(rpage));
+                (*dst)->page = (*src)->page;
+            }
+            for (int b = 0; b < ROLLUP_PAGE_SIZE; ++b) {
+                (*dst)->buckets[b].nvisits += (*src)->buckets[b].nvisits;
+                (*dst)->buckets[b].duration += (*src)->buckets[b].duration;
+            }
+        }
+    }
+
+    args->nentries = 0;
+    args->entries = malloc((merged.n ? merged.n : 1) * ROLLUP_PAGE_SIZE *
+        sizeof(rentry));
+    for (i = 0; htable_next(&merged, &i, (void**)&dst) != NULL;) {
+        for (int b = 0; b < ROLLUP_PAGE_SIZE; ++b) {
+            if ((*dst)->buckets[b].nvisits == 0) {
+                continue;
+            }
+            rentry *entry = &args->entries[args->nentries++];
+            entry->key = ((*dst)->page << ROLLUP_PAGE_BITS) + b;
+            entry->bucket = (*dst)->buckets[b];
+        }
+    }
+    rollup_free_pages(&merged);
+    htable_free(&merged);
+    return NULL;
+}
+
+static int rentry_cmp(const void *a, const void *b) {
+    long x = ((rentry*)a)->key, y = ((rentry*)b)->key;
+    return (x > y) - (x < y);
+}
+
+/**
+* Merges series into the buckets with rows of all of them in key order, in
+* parallel over partitions of the pages
+*
+* @param series Array of series to merge
+* @param n Number of series
+* @param nentries Pointer to store the number of buckets in
+* @return Array of the buckets, freed with free
+*/
+rentry *rollup_merge(rollup *series, size_t n, size_t *nentries) {
+    size_t nkeys = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        nkeys += series[i].pages.n * ROLLUP_PAGE_SIZE;
+    }
+
+    // Give each thread a partition of the pages
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = nkeys / ROLLUP_MERGE_SPAN + 1;
+    nthreads = nthreads < ncpus ? nthreads : (ncpus > 0 ? ncpus : 1);
+    pthread_t t_mergers[nthreads];
+    rmargs args[nthreads];
+    for (size_t i = 0; i < nthreads; ++i) {
+        args[i].series = series;
+        args[i].n = n;
+        args[i].part = i;
+        args[i].nparts = nthreads;
+        pthread_create(&t_mergers[i], NULL, rollup_merge_part, &args[i]);
+    }
+
+    // Gather the buckets of every partition and order them by key
+    *nentries = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_join(t_mergers[i], NULL);
+        *nentries += args[i].nentries;
+    }
+    rentry *entries = malloc((*nentries ? *nentries : 1) * sizeof(rentry));
+    size_t at = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        memcpy(entries + at, args[i].entries,
+            args[i].nentries * sizeof(rentry));
+        at += args[i].nentries;
+        free(args[i].entries);
+    }
+    qsort(entries, *nentries, sizeof(rentry), rentry_cmp);
+    return entries;
+}
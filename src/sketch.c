@@ -0,0 +1,367 @@
+#include "lott.h"
+#include "sketch.h"
+
+#include <math.h>
+
+// Sizes of new sketches
+static int hll_precision = 12;
+static unsigned int kll_k = 83;
+
+/**
+* Sizes new sketches for a relative error, the standard error of
+* distinct counts and the rank error of quantiles
+*
+* @param error Relative error, such as 0.01
+* @return 0 on success, negative if the error is out of range
+*/
+int sketch_config(double error) {
+    if (!(error > 0 && error < 1)) {
+        return -1;
+    }
+
+    // Standard error of HyperLogLog is 1.04 / sqrt(registers)
+    double m = (1.04 / error) * (1.04 / error);
+    for (hll_precision = HLL_MIN_PRECISION; hll_precision < HLL_MAX_PRECISION &&
+        (1UL << hll_precision) < m; ++hll_precision);
+
+    // Rank error of KLL is about 1.65 / k
+    kll_k = ceil(1.65 / error);
+    kll_k = kll_k < KLL_MIN_K ? KLL_MIN_K : kll_k;
+    return 0;
+}
+
+/**
+* Hashes a value for a distinct count sketch
+*
+* @param str Value to hash
+* @param len Length of the value
+* @return 64-bit hash of the value
+*/
+unsigned long sketch_hash(char *str, size_t len) {
+    // FNV-1a, then mix the bits so the high ones depend on every byte
+    unsigned long h = 0xcbf29ce484222325UL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)str[i];
+        h *= 0x100000001b3UL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+/********* HyperLogLog *********/
+
+/**
+* Makes an empty HyperLogLog sketch
+*
+* @return Pointer to the sketch, freed with free
+*/
+hll *hll_new() {
+    hll *sketch = calloc(1, sizeof(hll) + (1UL << hll_precision));
+    sketch->precision = hll_precision;
+    return sketch;
+}
+
+/**
+* Adds a hashed value to a HyperLogLog sketch
+*
+* @param sketch Pointer to the sketch
+* @param hash Hash of the value, from sketch_hash
+*/
+void hll_add(hll *sketch, unsigned long hash) {
+    int p = sketch->precision;
+    unsigned long ind = hash >> (64 - p), rest = hash << p;
+
+    // Rank is the position of the first set bit after the index bits
+    unsigned char rank = rest ? __builtin_clzl(rest) + 1 : 64 - p + 1;
+    if (rank > sketch->reg[ind]) {
+        sketch->reg[ind] = rank;
+    }
+}
+
+/**
+* Merges a HyperLogLog sketch into another of the same precision
+*
+* @param dst Pointer to sketch to merge into
+* @param src Pointer to sketch to merge from
+*/
+void hll_merge(hll *dst, hll *src) {
+    for (unsigned long i = 0; i < (1UL << dst->precision); ++i) {
+        if (src->reg[i] > dst->reg[i]) {
+            dst->reg[i] = src->reg[i];
+        }
+    }
+}
+
+/**
+* Estimates the number of distinct values added to a HyperLogLog sketch
+*
+* @param sketch Pointer to the sketch
+* @return Estimated distinct count
+*/
+double hll_count(hll *sketch) {
+    double m = 1UL << sketch->precision, sum = 0;
+    unsigned long zeros = 0;
+
+    for (unsigned long i = 0; i < (1UL << sketch->precision); ++i) {
+        sum += ldexp(1.0, -sketch->reg[i]);
+        zeros += sketch->reg[i] == 0;
+    }
+    double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+    // Count small sets by the registers still empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+/**
+* Writes a HyperLogLog sketch to a file
+*
+* @param sketch Pointer to the sketch
+* @param fp File to write to
+* @return 0 on success, negative if it could not be written
+*/
+int hll_write(hll *sketch, FILE *fp) {
+    size_t m = 1UL << sketch->precision;
+    if (fwrite(&sketch->precision, sizeof(int), 1, fp) != 1 ||
+        fwrite(sketch->reg, 1, m, fp) != m) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Reads a HyperLogLog sketch written by hll_write
+*
+* @param fp File to read from
+* @return Pointer to the sketch, freed with free, NULL if it could not be
+* read
+*/
+hll *hll_read(FILE *fp) {
+    int precision;
+    if (fread(&precision, sizeof(int), 1, fp) != 1 ||
+        precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+        return NULL;
+    }
+    size_t m = 1UL << precision;
+    hll *sketch = malloc(sizeof(hll) + m);
+    sketch->precision = precision;
+    if (fread(sketch->reg, 1, m, fp) != m) {
+        free(sketch);
+        return NULL;
+    }
+    return sketch;
+}
+
+/********* KLL *********/
+
+/**
+* Makes an empty KLL sketch
+*
+* @return Pointer to the sketch, freed with kll_free
+*/
+kll *kll_new() {
+    kll *sketch = calloc(1, sizeof(kll));
+    sketch->k = kll_k;
+    sketch->seed = 0x9e3779b97f4a7c15UL;
+    return sketch;
+}
+
+static int uint_cmp(const void *a, const void *b) {
+    unsigned int x = *(unsigned int*)a, y = *(unsigned int*)b;
+    return (x > y) - (x < y);
+}
+
+static int ulong_cmp(const void *a, const void *b) {
+    unsigned long x = *(unsigned long*)a, y = *(unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+// Appends a value to a level, making room for twice k values
+static inline void kll_push(kll *sketch, int h, unsigned int value) {
+    if (sketch->levels[h] == NULL) {
+        sketch->levels[h] = malloc(2 * sketch->k * sizeof(int));
+    }
+    sketch->levels[h][sketch->n[h]++] = value;
+}
+
+// Promotes every other value of each full level, odd or even ones picked
+// at random, until no level holds more than k values
+static void kll_compact(kll *sketch) {
+    for (int h = 0; h + 1 < KLL_MAX_LEVELS; ++h) {
+        if (sketch->n[h] < sketch->k) {
+            continue;
+        }
+        unsigned int *level = sketch->levels[h];
+        qsort(level, sketch->n[h], sizeof(int), uint_cmp);
+
+        sketch->seed ^= sketch->seed << 13;
+        sketch->seed ^= sketch->seed >> 7;
+        sketch->seed ^= sketch->seed << 17;
+        unsigned int npromoted = sketch->n[h] & ~1U;
+        for (unsigned int i = sketch->seed & 1; i < npromoted; i += 2) {
+            kll_push(sketch, h + 1, level[i]);
+        }
+
+        // Keep the odd value out when the level has an odd count
+        if (sketch->n[h] & 1) {
+            level[0] = level[sketch->n[h] - 1];
+            sketch->n[h] = 1;
+        } else {
+            sketch->n[h] = 0;
+        }
+    }
+}
+
+/**
+* Adds a value to a KLL sketch
+*
+* @param sketch Pointer to the sketch
+* @param value Value to add
+*/
+void kll_add(kll *sketch, unsigned int value) {
+    kll_push(sketch, 0, value);
+    ++sketch->nvalues;
+    if (sketch->n[0] == sketch->k) {
+        kll_compact(sketch);
+    }
+}
+
+/**
+* Merges a KLL sketch into another
+*
+* @param dst Pointer to sketch to merge into
+* @param src Pointer to sketch to merge from
+*/
+void kll_merge(kll *dst, kll *src) {
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        for (unsigned int i = 0; i < src->n[h]; ++i) {
+            kll_push(dst, h, src->levels[h][i]);
+            if (dst->n[h] == dst->k) {
+                kll_compact(dst);
+            }
+        }
+    }
+    dst->nvalues += src->nvalues;
+}
+
+/**
+* Estimates a quantile of the values added to a KLL sketch
+*
+* @param sketch Pointer to the sketch
+* @param q Quantile, from 0 for the lowest value to 1 for the highest
+* @return Estimated value at the quantile
+*/
+double kll_quantile(kll *sketch, double q) {
+    unsigned long total = 0, n = 0, seen = 0;
+
+    // Weigh every value kept by the values it stands for, the level of a
+    // value being kept in its low byte
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        n += sketch->n[h];
+    }
+    if (n == 0) {
+        return NAN;
+    }
+    unsigned long *weighted = malloc(n * sizeof(long));
+    n = 0;
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        for (unsigned int i = 0; i < sketch->n[h]; ++i) {
+            weighted[n++] = ((unsigned long)sketch->levels[h][i] << 8) | h;
+        }
+        total += (unsigned long)sketch->n[h] << h;
+    }
+    qsort(weighted, n, sizeof(long), ulong_cmp);
+
+    // Find the first value whose cumulative weight reaches the rank
+    double rank = q * total;
+    double value = weighted[n - 1] >> 8;
+    for (unsigned long i = 0; i < n; ++i) {
+        seen += 1UL << (weighted[i] & 0xFF);
+        if (seen >= rank) {
+            value = weighted[i] >> 8;
+            break;
+        }
+    }
+    free(weighted);
+    return value;
+}
+
+/**
+* Frees a KLL sketch
+*
+* @param sketch Pointer to the sketch
+*/
+void kll_free(kll *sketch) {
+    if (sketch == NULL) {
+        return;
+    }
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        free(sketch->levels[h]);
+    }
+    free(sketch);
+}
+
+/**
+* Writes a KLL sketch to a file
+*
+* @param sketch Pointer to the sketch
+* @param fp File to write to
+* @return 0 on success, negative if it could not be written
+*/
+int kll_write(kll *sketch, FILE *fp) {
+    if (fwrite(&sketch->k, sizeof(int), 1, fp) != 1 ||
+        fwrite(&sketch->nvalues, sizeof(long), 1, fp) != 1 ||
+        fwrite(&sketch->seed, sizeof(long), 1, fp) != 1 ||
+        fwrite(sketch->n, sizeof(int), KLL_MAX_LEVELS, fp) != KLL_MAX_LEVELS) {
+        return -1;
+    }
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        if (fwrite(sketch->levels[h], sizeof(int), sketch->n[h], fp) !=
+            sketch->n[h]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+* Reads a KLL sketch written by kll_write
+*
+* @param fp File to read from
+* @return Pointer to the sketch, freed with kll_free, NULL if it could not
+* be read
+*/
+kll *kll_read(FILE *fp) {
+    kll *sketch = calloc(1, sizeof(kll));
+    if (fread(&sketch->k, sizeof(int), 1, fp) != 1 ||
+        fread(&sketch->nvalues, sizeof(long), 1, fp) != 1 ||
+        fread(&sketch->seed, sizeof(long), 1, fp) != 1 ||
+        fread(sketch->n, sizeof(int), KLL_MAX_LEVELS, fp) != KLL_MAX_LEVELS) {
+        free(sketch);
+        return NULL;
+    }
+
+    // Levels hold up to twice k values, as kll_push makes them
+    for (int h = 0; h < KLL_MAX_LEVELS; ++h) {
+        if (sketch->n[h] == 0) {
+            continue;
+        }
+        if (sketch->n[h] > 2 * sketch->k) {
+            kll_free(sketch);
+            return NULL;
+        }
+        sketch->levels[h] = malloc(2 * sketch->k * sizeof(int));
+        if (fread(sketch->levels[h], sizeof(int), sketch->n[h], fp) !=
+            sketch->n[h]) {
+            kll_free(sketch);
+            return NULL;
+        }
+    }
+    return sketch;
+}
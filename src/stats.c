@@ -0,0 +1,187 @@
+#include "lott.h"
+#include "stats.h"
+#include "country.h"
+#include "filter.h"
+
+#include <fcntl.h>
+#include <limits.h>
+
+int use_stats;
+
+// Reads the countries following the header of a sidecar, returns the
+// number read, or -1 if they could not be
+static long stats_read_countries(int fd, cpacked *packed) {
+    unsigned long n;
+
+    if (read(fd, &n, sizeof(long)) != sizeof(long) || n > CCOUNT_SIZE ||
+        read(fd, packed, n * sizeof(cpacked)) != n * sizeof(cpacked)) {
+        return -1;
+    }
+    return n;
+}
+
+// Opens the stats sidecar of a data file and reads its header, returns the
+// descriptor if the sidecar is newer than the file, else -1
+static int stats_open(char *filename, struct stat *st, sheader *header) {
+    char statspath[FILENAME_SIZE + 32];
+    struct stat sst;
+
+    sprintf(statspath, "./%s/%s/%s%s", DATA_DIR, SIDECAR_DIR, filename,
+        STATS_SUFFIX);
+    int fd = open(statspath, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Sidecar must have been written after the file last changed
+    if (fstat(fd, &sst) < 0 ||
+        sst.st_mtim.tv_sec < st->st_mtim.tv_sec ||
+        (sst.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+        sst.st_mtim.tv_nsec < st->st_mtim.tv_nsec) ||
+        read(fd, header, sizeof(sheader)) != sizeof(sheader) ||
+        header->magic != STATS_MAGIC || header->src_size != st->st_size) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+* Reads the partials current_query needs from the stats sidecar of a
+* data file, if it is newer than the file
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param partial Pointer to pinfo to copy the partials to
+* @param einfo Country histogram to copy counts to, only written for E
+* @return 1 if the partials were read from the sidecar, else 0
+*/
+int stats_lookup(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo) {
+    int fields = current_query->fields, r = 0;
+    cpacked packed[CCOUNT_SIZE];
+    sheader header;
+
+    if (fields == 0 || use_filter) {
+        return 0;
+    }
+    int fd = stats_open(filename, st, &header);
+    if (fd < 0) {
+        return 0;
+    }
+
+    if ((header.partial.fields & fields) == fields) {
+        r = 1;
+        if (fields & P_COUNTRY) {
+            long n = stats_read_countries(fd, packed);
+            r = n >= 0 && country_unpack(packed, n, einfo) == 0;
+        }
+        if (r) {
+            *partial = header.partial;
+        }
+    }
+
+    close(fd);
+    return r;
+}
+
+/**
+* Checks if the stats sidecar of a data file rules out every row of it for
+* the filter of the run, by the ranges of its timestamps and durations
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @return 1 if no row of the file can pass the filter, else 0
+*/
+int stats_prune(char *filename, struct stat *st) {
+    sheader header;
+
+    int fd = stats_open(filename, st, &header);
+    if (fd < 0) {
+        return 0;
+    }
+    close(fd);
+    return !filter_ranges(header.range.ts_min, header.range.ts_max,
+        header.range.dur_min, header.range.dur_max);
+}
+
+/**
+* Writes the partials of a data file to its stats sidecar, keeping the
+* fields of other queries already in a valid sidecar
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file, st_size being the number of bytes
+* the partials cover
+* @param partial Pointer to partials to write
+* @param einfo Country histogram to write, only read if P_COUNTRY is set
+* @param range Ranges of every row of the file, NULL to keep those of a
+* valid sidecar or leave them unknown
+*/
+void stats_store(char *filename, struct stat *st, pinfo *partial,
+    chist *einfo, srange *range) {
+    char statspath[FILENAME_SIZE + 32], tmppath[FILENAME_SIZE + 40];
+    cpacked packed[CCOUNT_SIZE];
+    unsigned long npacked = 0;
+    sheader header, old;
+
+    if (partial->fields == 0 || use_filter) {
+        return;
+    }
+    memset(&header, 0, sizeof(sheader));
+    header.magic = STATS_MAGIC;
+    header.src_size = st->st_size;
+    header.partial = *partial;
+    header.range = (srange){LONG_MIN, LONG_MAX, LONG_MIN, LONG_MAX};
+    if (range != NULL) {
+        header.range = *range;
+    }
+
+    // Sidecars keep countries by code, not by the slots of this run
+    if (partial->fields & P_COUNTRY) {
+        npacked = country_pack(einfo, packed);
+    }
+
+    // Keep fields other queries stored for the same version of the file
+    int fd = stats_open(filename, st, &old);
+    if (fd >= 0) {
+        int fields = old.partial.fields & ~partial->fields;
+        long n = (fields & P_COUNTRY) ? stats_read_countries(fd, packed) : 0;
+        if (n < 0) {
+            fields &= ~P_COUNTRY;
+        }
+        if (fields & P_DURATION) {
+            header.partial.duration = old.partial.duration;
+        }
+        if (fields & P_YEARS) {
+            header.partial.used_years = old.partial.used_years;
+        }
+        if (fields & P_COUNTRY) {
+            npacked = n;
+        }
+        if (range == NULL) {
+            header.range = old.range;
+        }
+        header.partial.fields |= fields;
+        close(fd);
+    }
+
+    // Write to a temporary file, then move it in place
+    mkdir("./" DATA_DIR "/" SIDECAR_DIR, 0755);
+    sprintf(statspath, "./%s/%s/%s%s", DATA_DIR, SIDECAR_DIR, filename,
+        STATS_SUFFIX);
+    sprintf(tmppath, "%s.tmp", statspath);
+    FILE *file = fopen(tmppath, "w");
+    if (file == NULL) {
+        query_log("%s: %s", tmppath, strerror(errno));
+        return;
+    }
+    fwrite(&header, sizeof(sheader), 1, file);
+    if (header.partial.fields & P_COUNTRY) {
+        fwrite(&npacked, sizeof(long), 1, file);
+        fwrite(packed, sizeof(cpacked), npacked, file);
+    }
+    if (fclose(file) == 0) {
+        rename(tmppath, statspath);
+    }
+}
@@ -0,0 +1,130 @@
+#include "lott.h"
+#include "topk.h"
+#include "country.h"
+
+size_t top_k;
+
+// Compares two results, positive if a ranks above b
+static int topk_cmp(tentry *a, tentry *b) {
+    int res = query_cmp(a->score, b->score);
+    return res != 0 ? res : strcmp(b->name, a->name);
+}
+
+static int topk_qsort_cmp(const void *a, const void *b) {
+    return topk_cmp((tentry*)b, (tentry*)a);
+}
+
+// Moves the result at i down the heap until its children rank above it
+static void topk_sift_down(theap *heap, size_t i) {
+    tentry *e = heap->entries, tmp;
+    while (1) {
+        size_t worst = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < heap->n && topk_cmp(&e[l], &e[worst]) < 0) {
+            worst = l;
+        }
+        if (r < heap->n && topk_cmp(&e[r], &e[worst]) < 0) {
+            worst = r;
+        }
+        if (worst == i) {
+            return;
+        }
+        tmp = e[i], e[i] = e[worst], e[worst] = tmp;
+        i = worst;
+    }
+}
+
+/**
+* Makes an empty heap keeping the k best results
+*
+* @param heap Pointer to heap to initialize
+* @param k Number of results to keep
+*/
+void topk_init(theap *heap, size_t k) {
+    heap->entries = malloc(k * sizeof(tentry));
+    heap->n = 0;
+    heap->k = k;
+}
+
+/**
+* Adds a result to a heap, if it ranks among the k best
+*
+* @param heap Pointer to heap to add to
+* @param score Score of the result
+* @param name Name of the result
+*/
+void topk_push(theap *heap, double score, char *name) {
+    tentry entry, tmp, *e = heap->entries;
+    entry.score = score;
+    snprintf(entry.name, FILENAME_SIZE, "%s", name);
+
+    // Full - replace the worst result if the new one ranks above it
+    if (heap->n == heap->k) {
+        if (heap->k > 0 && topk_cmp(&entry, &e[0]) > 0) {
+            e[0] = entry;
+            topk_sift_down(heap, 0);
+        }
+        return;
+    }
+
+    // Move the new result up while it ranks below its parent
+    size_t i = heap->n++;
+    e[i] = entry;
+    while (i > 0 && topk_cmp(&e[i], &e[(i - 1) / 2]) < 0) {
+        tmp = e[i], e[i] = e[(i - 1) / 2], e[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+* Adds every country with users in a histogram to a heap
+*
+* @param heap Pointer to heap to add to
+* @param ccount Pointer to the country histogram
+*/
+void topk_countries(theap *heap, chist *ccount) {
+    char code[3];
+    for (long i = 0; i < ccount->size; ++i) {
+        if (ccount->counts[i] == 0) {
+            continue;
+        }
+        country_code(i, code);
+        topk_push(heap, ccount->counts[i], code);
+    }
+}
+
+/**
+* Adds the results of a heap to another
+*
+* @param dst Pointer to heap to add to
+* @param src Pointer to heap to add from
+*/
+void topk_merge(theap *dst, theap *src) {
+    for (size_t i = 0; i < src->n; ++i) {
+        topk_push(dst, src->entries[i].score, src->entries[i].name);
+    }
+}
+
+/**
+* Prints the results of a heap best first, leaving the heap empty
+*
+* @param heap Pointer to heap to print
+*/
+void topk_print(theap *heap) {
+    qsort(heap->entries, heap->n, sizeof(tentry), topk_qsort_cmp);
+    query_print("Result:\n");
+    for (size_t i = 0; i < heap->n; ++i) {
+        query_row(heap->entries[i].score, heap->entries[i].name);
+    }
+    heap->n = 0;
+}
+
+/**
+* Frees the results of a heap
+*
+* @param heap Pointer to heap to free
+*/
+void topk_free(theap *heap) {
+    free(heap->entries);
+    heap->entries = NULL;
+    heap->n = heap->k = 0;
+}
@@ -0,0 +1,81 @@
+#include "lott.h"
+#include "cache.h"
+#include "filter.h"
+#include "watch.h"
+
+int use_watch;
+
+// Reads pending inotify events, returns 1 if any concerned a data file
+static int watch_read(int fd) {
+    char buf[WATCH_BUF_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    int changed = 0;
+    ssize_t len = read(fd, buf, WATCH_BUF_SIZE);
+
+    for (char *p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+        event = (struct inotify_event*)p;
+
+        // Events were dropped - assume something changed
+        if (event->mask & IN_Q_OVERFLOW) {
+            changed = 1;
+        }
+        // Hidden files include the sidecar directory lott writes itself
+        else if (event->len > 0 && event->name[0] != '.') {
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+/**
+* Watches DATA_DIR for written, moved or removed files and reruns the part
+* after every burst of changes. The result cache is kept between runs, so
+* only new files and the appended tails of grown files are mapped. Queries
+* keeping a state (H, T and ad-hoc queries) and runs filtered by --where
+* are not cached, every rerun of them maps every file again.
+*
+* @param f_run Function running the part and printing its result
+* @param part Part character from the command line
+* @param nthreads Number of map threads
+* @return Negative on error, only returns if watching failed
+*/
+int watch_data(int (*f_run)(char, size_t), char part, size_t nthreads) {
+    struct pollfd pfd;
+    int ret = 0, changed, nsettles;
+
+    pfd.fd = inotify_init1(IN_CLOEXEC);
+    if (pfd.fd < 0 || inotify_add_watch(pfd.fd, DATA_DIR, WATCH_EVENTS) < 0) {
+        query_log("%s: %s", "Could not watch " DATA_DIR, strerror(errno));
+        return -1;
+    }
+    pfd.events = POLLIN;
+    if (current_query->select == Q_STATE || use_filter) {
+        query_log("%s", "Query is not cached, every change maps every file "
+            "again");
+    }
+
+    while (ret >= 0) {
+        // Block until something changes, then let the burst of writes
+        // settle so a file being written is not mapped once per write
+        changed = 0;
+        nsettles = 0;
+        for (int timeout = -1; nsettles < WATCH_MAX_SETTLES &&
+            poll(&pfd, 1, timeout) > 0; timeout = WATCH_SETTLE_MS) {
+            changed |= watch_read(pfd.fd);
+            nsettles += changed;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        // Rerun and persist the partials mapped for the new data
+        ret = (*f_run)(part, nthreads);
+        cache_save();
+        fflush(NULL);
+    }
+
+    close(pfd.fd);
+    return ret;
+}
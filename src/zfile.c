@@ -0,0 +1,337 @@
+#include "lott.h"
+#include "zfile.h"
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+
+#ifdef LOTT_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef LOTT_ZSTD
+#include <zstd.h>
+
+/**
+* Frame of a zstd file, decompressed by a worker ahead of the reader
+*/
+typedef struct zframe {
+    char *src;
+    size_t srcsize;
+    char *out;
+    size_t outsize;
+    int error;
+    sem_t ready;
+} zframe;
+
+/**
+* Reader state of a zstd file. Files with a single frame, or read by a
+* single worker, are decompressed as they are read through dctx.
+*/
+typedef struct zstream {
+    char *src;
+    size_t srcsize;
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    zframe *frames;
+    size_t nframes, next, cur, pos;
+    int waited, nworkers;
+    pthread_t t_workers[ZST_MAX_WORKERS];
+    sem_t mut_next, slots;
+} zstream;
+
+// Decompresses a whole frame into a buffer grown as needed
+static void zst_frame(ZSTD_DCtx *dctx, zframe *frame) {
+    unsigned long long size = ZSTD_getFrameContentSize(frame->src,
+        frame->srcsize);
+    size_t cap = size < ZSTD_CONTENTSIZE_ERROR ? size + 1 : frame->srcsize * 4;
+    ZSTD_inBuffer in = {frame->src, frame->srcsize, 0};
+    ZSTD_outBuffer out = {malloc(cap), cap, 0};
+
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    while (in.pos < in.size) {
+        if (out.pos == out.size) {
+            out.size <<= 1;
+            out.dst = realloc(out.dst, out.size);
+        }
+        if (ZSTD_isError(ZSTD_decompressStream(dctx, &out, &in))) {
+            frame->error = 1;
+            break;
+        }
+    }
+    frame->out = out.dst;
+    frame->outsize = out.pos;
+}
+
+// Start routine of decompression workers, takes frames in order while
+// fewer than ZST_FRAMES_AHEAD frames per worker wait for the reader
+static void *zst_work(void *v) {
+    zstream *zs = v;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t ind;
+
+    while (1) {
+        sem_wait(&zs->slots);
+        sem_wait(&zs->mut_next);
+        ind = zs->next < zs->nframes ? zs->next++ : zs->nframes;
+        sem_post(&zs->mut_next);
+        if (ind == zs->nframes) {
+            break;
+        }
+
+        zst_frame(dctx, &zs->frames[ind]);
+        sem_post(&zs->frames[ind].ready);
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+// Reads decompressed frames in order, handing slots back to the workers
+static ssize_t zst_read_frames(void *cookie, char *buf, size_t size) {
+    zstream *zs = cookie;
+    size_t n = 0, len;
+
+    while (n < size && zs->cur < zs->nframes) {
+        zframe *frame = &zs->frames[zs->cur];
+
+        // Wait for a worker to finish the frame
+        if (!zs->waited) {
+            sem_wait(&frame->ready);
+            zs->waited = 1;
+        }
+        if (frame->error) {
+            return -1;
+        }
+
+        len = frame->outsize - zs->pos < size - n ?
+            frame->outsize - zs->pos : size - n;
+        memcpy(buf + n, frame->out + zs->pos, len);
+        n += len;
+        zs->pos += len;
+
+        // Done with the frame - let a worker take the next one
+        if (zs->pos == frame->outsize) {
+            free(frame->out);
+            frame->out = NULL;
+            zs->pos = 0;
+            zs->waited = 0;
+            ++zs->cur;
+            sem_post(&zs->slots);
+        }
+    }
+
+    return n;
+}
+
+// Decompresses straight into the reader's buffer
+static ssize_t zst_read_stream(void *cookie, char *buf, size_t size) {
+    zstream *zs = cookie;
+    ZSTD_outBuffer out = {buf, size, 0};
+
+    while (out.pos == 0 && zs->in.pos < zs->in.size) {
+        if (ZSTD_isError(ZSTD_decompressStream(zs->dctx, &out, &zs->in))) {
+            return -1;
+        }
+    }
+    return out.pos;
+}
+
+// Stops the workers and frees all reader state
+static int zst_close(void *cookie) {
+    zstream *zs = cookie;
+
+    if (zs->nworkers) {
+        // Let workers run out of frames
+        sem_wait(&zs->mut_next);
+        zs->next = zs->nframes;
+        sem_post(&zs->mut_next);
+        for (int i = 0; i < zs->nworkers; ++i) {
+            sem_post(&zs->slots);
+        }
+        for (int i = 0; i < zs->nworkers; ++i) {
+            pthread_join(zs->t_workers[i], NULL);
+        }
+        for (size_t i = 0; i < zs->nframes; ++i) {
+            free(zs->frames[i].out);
+            sem_destroy(&zs->frames[i].ready);
+        }
+        free(zs->frames);
+    } else {
+        ZSTD_freeDCtx(zs->dctx);
+    }
+
+    munmap(zs->src, zs->srcsize);
+    free(zs);
+    return 0;
+}
+
+// Opens a zstd file, splitting it at frame boundaries so frames can be
+// decompressed by parallel workers
+static FILE *zst_open(char *filepath) {
+    struct stat st;
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    zstream *zs = calloc(1, sizeof(zstream));
+    zs->srcsize = st.st_size;
+    zs->src = zs->srcsize ? mmap(NULL, zs->srcsize, PROT_READ, MAP_PRIVATE,
+        fd, 0) : NULL;
+    close(fd);
+    if (zs->src == MAP_FAILED) {
+        free(zs);
+        return NULL;
+    }
+    madvise(zs->src, zs->srcsize, MADV_SEQUENTIAL);
+
+    // Find frame boundaries
+    size_t off = 0, len, nalloc = 0;
+    while (off < zs->srcsize) {
+        len = ZSTD_findFrameCompressedSize(zs->src + off, zs->srcsize - off);
+        if (ZSTD_isError(len)) {
+            break;
+        }
+        if (zs->nframes == nalloc) {
+            nalloc = nalloc ? nalloc << 1 : 16;
+            zs->frames = realloc(zs->frames, nalloc * sizeof(zframe));
+        }
+        memset(&zs->frames[zs->nframes], 0, sizeof(zframe));
+        zs->frames[zs->nframes].src = zs->src + off;
+        zs->frames[zs->nframes].srcsize = len;
+        ++zs->nframes;
+        off += len;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    zs->nworkers = ncpus < ZST_MAX_WORKERS ? ncpus : ZST_MAX_WORKERS;
+    if (zs->nworkers > zs->nframes) {
+        zs->nworkers = zs->nframes;
+    }
+
+    // Stream a single frame, or a file not split cleanly, through one context
+    cookie_io_functions_t io = {.close = zst_close};
+    if (zs->nworkers < 2 || off != zs->srcsize) {
+        free(zs->frames);
+        zs->frames = NULL;
+        zs->nframes = zs->nworkers = 0;
+        zs->dctx = ZSTD_createDCtx();
+        zs->in = (ZSTD_inBuffer){zs->src, zs->srcsize, 0};
+        io.read = zst_read_stream;
+        return fopencookie(zs, "r", io);
+    }
+
+    // Decompress frames in parallel, bounding how far workers get ahead
+    sem_init(&zs->mut_next, 0, 1);
+    sem_init(&zs->slots, 0, zs->nworkers * ZST_FRAMES_AHEAD);
+    for (size_t i = 0; i < zs->nframes; ++i) {
+        sem_init(&zs->frames[i].ready, 0, 0);
+    }
+    for (int i = 0; i < zs->nworkers; ++i) {
+        pthread_create(&zs->t_workers[i], NULL, zst_work, zs);
+    }
+    io.read = zst_read_frames;
+    return fopencookie(zs, "r", io);
+}
+#endif
+
+#ifdef LOTT_ZLIB
+// Reads decompressed bytes from a gzip file
+static ssize_t gz_read(void *cookie, char *buf, size_t size) {
+    return gzread((gzFile)cookie, buf, size);
+}
+
+// Closes a gzip file
+static int gz_close(void *cookie) {
+    return gzclose((gzFile)cookie) == Z_OK ? 0 : EOF;
+}
+
+// Opens a gzip file, decompressing it as it is read
+static FILE *gz_open(char *filepath) {
+    gzFile gz = gzopen(filepath, "rb");
+    if (gz == NULL) {
+        return NULL;
+    }
+    gzbuffer(gz, GZ_BUF_SIZE);
+
+    cookie_io_functions_t io = {.read = gz_read, .close = gz_close};
+    return fopencookie(gz, "r", io);
+}
+#endif
+
+// Returns 1 if str ends with suffix
+static int has_suffix(char *str, char *suffix) {
+    size_t len = strlen(str), slen = strlen(suffix);
+    return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+/**
+* Checks if a data file is read through a decompressor
+*
+* @param filepath Path of the data file
+* @return 1 if the file is gzip or zstd compressed, else 0
+*/
+int zcompressed(char *filepath) {
+    return has_suffix(filepath, GZ_SUFFIX) || has_suffix(filepath, ZST_SUFFIX);
+}
+
+/**
+* Opens a data file for reading, .gz and .zst files are decompressed as
+* they are read. Independent frames of multi-frame .zst files are
+* decompressed in parallel ahead of the reader.
+*
+* @param filepath Path of the data file
+* @param offset Offset to start reading at, must be 0 for compressed files
+* @return Stream of the file, NULL on error
+*/
+FILE *zopen(char *filepath, off_t offset) {
+    FILE *file = NULL;
+
+    if (!zcompressed(filepath)) {
+        file = fopen(filepath, "r");
+        if (file != NULL && offset > 0) {
+            fseek(file, offset, SEEK_SET);
+        }
+        return file;
+    }
+    if (offset > 0) {
+        query_log("%s: %s", "Cannot seek compressed file", filepath);
+        return NULL;
+    }
+
+#ifdef LOTT_ZLIB
+    if (has_suffix(filepath, GZ_SUFFIX)) {
+        file = gz_open(filepath);
+    }
+#endif
+#ifdef LOTT_ZSTD
+    if (has_suffix(filepath, ZST_SUFFIX)) {
+        file = zst_open(filepath);
+    }
+#endif
+
+    if (file == NULL) {
+        query_log("%s: %s", "Could not open compressed file", filepath);
+    }
+    return file;
+}
+
+/**
+* Closes a stream opened by zopen
+*
+* @param file Stream to close
+* @param size Size of the file as it was opened
+* @return Number of bytes of the file read, size for compressed files
+*/
+off_t zclose(FILE *file, off_t size) {
+    // Streams of compressed files cannot tell their position
+    off_t pos = ftell(file);
+
+    fclose(file);
+    return pos < 0 ? size : pos;
+}
@@ -0,0 +1,70 @@
+#include "lott.h"
+#include "zone.h"
+
+/**
+* Reads the zone map of a data file, if one exists that is as recent as
+* the file
+*
+* @param filename Name of the data file in DATA_DIR
+* @param st Identity of the data file
+* @param header Pointer to zheader to store the header of the map in
+* @return Array of header->nzones zones to be freed, NULL if there is none
+*/
+zone *zone_load(char *filename, struct stat *st, zheader *header) {
+    char zonepath[FILENAME_SIZE + 32];
+
+    sprintf(zonepath, "./%s/%s/%s%s", DATA_DIR, SIDECAR_DIR, filename,
+        ZONE_SUFFIX);
+    FILE *file = fopen(zonepath, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // Ignore zones of an older version of the file
+    if (fread(header, sizeof(zheader), 1, file) != 1 ||
+        header->magic != ZONE_MAGIC || header->src_size != st->st_size ||
+        header->src_mtime_sec != st->st_mtim.tv_sec ||
+        header->src_mtime_nsec != st->st_mtim.tv_nsec) {
+        fclose(file);
+        return NULL;
+    }
+
+    zone *zones = malloc(header->nzones * sizeof(zone));
+    if (fread(zones, sizeof(zone), header->nzones, file) != header->nzones) {
+        free(zones);
+        zones = NULL;
+    }
+    fclose(file);
+    return zones;
+}
+
+/**
+* Writes the zone map of a data file to its sidecar directory
+*
+* @param filename Name of the data file in DATA_DIR
+* @param header Pointer to header of the map, identifying the data file
+* @param zones Array of header->nzones zones
+* @return 0 on success, negative on error
+*/
+int zone_store(char *filename, zheader *header, zone *zones) {
+    char tmppath[FILENAME_SIZE + 40], zonepath[FILENAME_SIZE + 32];
+    int r = -1;
+
+    // Write zones to a temporary file, then move it in place
+    mkdir("./" DATA_DIR "/" SIDECAR_DIR, 0755);
+    sprintf(zonepath, "./%s/%s/%s%s", DATA_DIR, SIDECAR_DIR, filename,
+        ZONE_SUFFIX);
+    sprintf(tmppath, "%s.tmp", zonepath);
+    FILE *file = fopen(tmppath, "w");
+    if (file != NULL) {
+        fwrite(header, sizeof(zheader), 1, file);
+        fwrite(zones, sizeof(zone), header->nzones, file);
+        if (fclose(file) == 0) {
+            r = rename(tmppath, zonepath);
+        }
+    }
+    if (r < 0) {
+        query_log("%s: %s", zonepath, strerror(errno));
+    }
+    return r;
+}
@@ -0,0 +1,167 @@
+#include "htable.h"
+#include "sketch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+* Microbenchmark of htable against a chained hash table with a node
+* allocated for every key, counting keys like the ip group-by does, from
+* 10^3 keys up to 10^max. Every key is added, then counted once more in a
+* shuffled order, so the nodes of the chained table are not visited in the
+* order they were allocated. Each table is timed as the best of ROUNDS
+* runs, so neither pays for warming up the allocator of the other. Exits
+* with failure if the tables disagree on a count. 10^8 keys take over
+* 10 GB, make test stops at 10^6.
+*
+* Usage: bin/bench_htable [max]
+*/
+
+#define KEY_SIZE 24
+#define ROUNDS 3
+
+// Node of a chained table, keeping a copy of its key
+typedef struct cnode {
+    struct cnode *next;
+    unsigned long hash;
+    unsigned long count;
+    char key[];
+} cnode;
+
+// Chained table, doubling its buckets once it has as many keys
+typedef struct ctable {
+    cnode **buckets;
+    size_t nbuckets;
+    size_t n;
+} ctable;
+
+// Finds the count of a key, adding the key the first time
+static unsigned long *ctable_get(ctable *table, char *key, size_t len,
+    unsigned long hash) {
+    cnode **bucket = &table->buckets[hash & (table->nbuckets - 1)];
+    for (cnode *node = *bucket; node != NULL; node = node->next) {
+        if (node->hash == hash && strcmp(node->key, key) == 0) {
+            return &node->count;
+        }
+    }
+
+    if (table->n == table->nbuckets) {
+        cnode **old = table->buckets;
+        table->nbuckets <<= 1;
+        table->buckets = calloc(table->nbuckets, sizeof(cnode*));
+        for (size_t i = 0; i < table->nbuckets >> 1; ++i) {
+            for (cnode *node = old[i], *next; node != NULL; node = next) {
+                next = node->next;
+                cnode **to =
+                    &table->buckets[node->hash & (table->nbuckets - 1)];
+                node->next = *to;
+                *to = node;
+            }
+        }
+        free(old);
+        bucket = &table->buckets[hash & (table->nbuckets - 1)];
+    }
+
+    cnode *node = malloc(sizeof(cnode) + len + 1);
+    node->hash = hash;
+    node->count = 0;
+    memcpy(node->key, key, len + 1);
+    node->next = *bucket;
+    *bucket = node;
+    ++table->n;
+    return &node->count;
+}
+
+// Frees the nodes and buckets of a chained table
+static void ctable_free(ctable *table) {
+    for (size_t i = 0; i < table->nbuckets; ++i) {
+        for (cnode *node = table->buckets[i], *next; node != NULL;
+            node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(table->buckets);
+}
+
+// Finds the seconds from a time to now
+static double since(struct timespec *then) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    struct timespec start;
+    int failed = 0;
+
+    printf("%10s %14s %14s\n", "keys", "htable ns/op", "chained ns/op");
+    size_t n = 1000;
+    for (int e = 3; e <= max; ++e, n *= 10) {
+        // Ip-like keys, hashed up front so both tables time only probes
+        char *keys = malloc(n * KEY_SIZE);
+        unsigned long *hashes = malloc(n * sizeof(long));
+        size_t *lens = malloc(n * sizeof(size_t));
+        size_t *order = malloc(2 * n * sizeof(size_t));
+        for (size_t i = 0; i < n; ++i) {
+            lens[i] = sprintf(keys + i * KEY_SIZE, "%lu.%lu.%lu.%lu",
+                (i >> 24) & 255, (i >> 16) & 255, (i >> 8) & 255, i & 255);
+            hashes[i] = sketch_hash(keys + i * KEY_SIZE, lens[i]);
+            order[i] = order[n + i] = i;
+        }
+        for (size_t i = 2 * n - 1; i > n; --i) {
+            size_t j = n + sketch_hash((char*)&i, sizeof(i)) % (i - n + 1);
+            size_t k = order[i];
+            order[i] = order[j];
+            order[j] = k;
+        }
+
+        double flat = 0, chain = 0;
+        for (int r = 0; r < ROUNDS; ++r) {
+            htable table;
+            htable_init(&table, sizeof(long));
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t o = 0; o < 2 * n; ++o) {
+                size_t i = order[o];
+                ++*(unsigned long*)htable_get(&table, keys + i * KEY_SIZE,
+                    lens[i], hashes[i]);
+            }
+            double secs = since(&start);
+            flat = r == 0 || secs < flat ? secs : flat;
+
+            ctable chained = {calloc(16, sizeof(cnode*)), 16, 0};
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t o = 0; o < 2 * n; ++o) {
+                size_t i = order[o];
+                ++*ctable_get(&chained, keys + i * KEY_SIZE, lens[i],
+                    hashes[i]);
+            }
+            secs = since(&start);
+            chain = r == 0 || secs < chain ? secs : chain;
+
+            // Every key was counted twice in both
+            for (size_t i = 0; i < n; ++i) {
+                if (*(unsigned long*)htable_get(&table, keys + i * KEY_SIZE,
+                    lens[i], hashes[i]) != 2 || *ctable_get(&chained,
+                    keys + i * KEY_SIZE, lens[i], hashes[i]) != 2) {
+                    failed = 1;
+                }
+            }
+            htable_free(&table);
+            ctable_free(&chained);
+        }
+        printf("%10lu %14.2f %14.2f%s\n", n, flat * 1e9 / (2 * n),
+            chain * 1e9 / (2 * n), failed ? "  MISMATCH" : "");
+
+        free(keys);
+        free(hashes);
+        free(lens);
+        free(order);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+#include "columnar.h"
+#include "parse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+* Microbenchmark of the decimal parsers of parse.h against the digit by
+* digit loop they replaced, on the timestamps and durations of random rows.
+* The parsers are given the lengths that splitting a row finds, the loop
+* finds them itself as stoi did. Exits with failure if any parser disagrees
+* with the loop.
+*
+* Usage: bin/bench_parse [rows]
+*/
+
+#define TIMESTAMP_LEN 11
+#define DURATION_LEN 8
+#define ROUNDS 10
+
+// Converts a terminated string digit by digit after finding its length,
+// the way stoi did before parse.h
+static unsigned long naive_parse(char *str) {
+    unsigned long num = 0;
+    int n = strlen(str);
+
+    for (int i = 0; i < n; ++i) {
+        num = num * 10 + (str[i] - '0');
+    }
+    return num;
+}
+
+// Finds the seconds from a time to now
+static double since(struct timespec *then) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
+
+// Prints the time of a parser per column, and checks its sum
+static int report(char *name, double secs, size_t n, unsigned long sum,
+    unsigned long expected) {
+    printf("%-12s %8.2f ns/column%s\n", name, secs * 1e9 / (n * ROUNDS),
+        sum == expected ? "" : "  MISMATCH");
+    return sum == expected ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    char *timestamps = malloc(n * TIMESTAMP_LEN);
+    char *durations = malloc(n * DURATION_LEN);
+    char **cols = malloc(2 * n * sizeof(char*));
+    int *lens = malloc(2 * n * sizeof(int));
+    unsigned long nums[2 * COL_BATCH];
+    struct timespec start;
+    int failed = 0;
+
+    // Timestamps are ten digits, durations one to seven
+    srand(1);
+    for (size_t i = 0; i < n; ++i) {
+        cols[i] = timestamps + i * TIMESTAMP_LEN;
+        cols[n + i] = durations + i * DURATION_LEN;
+        sprintf(cols[i], "%ld", 1000000000L + rand() % 1000000000L);
+        sprintf(cols[n + i], "%d", rand() % (1 << (rand() % 23)));
+        lens[i] = strlen(cols[i]);
+        lens[n + i] = strlen(cols[n + i]);
+    }
+
+    unsigned long expected = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < 2 * n; ++i) {
+            expected += naive_parse(cols[i]);
+        }
+    }
+    report("naive", since(&start), 2 * n, expected, expected);
+
+    unsigned long sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+            sum += stol(cols[i], lens[i]);
+            sum += stoi(cols[n + i], lens[n + i]);
+        }
+    }
+    failed |= report("stoi/stol", since(&start), 2 * n, sum, expected);
+
+    sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; ++r) {
+        // Timestamps of a batch of rows, then their durations, as
+        // conversion does
+        for (size_t i = 0; i < n; i += COL_BATCH) {
+            size_t nbatch = n - i < COL_BATCH ? n - i : COL_BATCH;
+            parse_uints(cols + i, lens + i, nbatch, nums);
+            parse_uints(cols + n + i, lens + n + i, nbatch, nums + nbatch);
+            for (size_t j = 0; j < 2 * nbatch; ++j) {
+                sum += nums[j];
+            }
+        }
+    }
+    failed |= report("parse_uints", since(&start), 2 * n, sum, expected);
+
+    free(timestamps);
+    free(durations);
+    free(cols);
+    free(lens);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
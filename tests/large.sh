@@ -0,0 +1,57 @@
+#!/bin/sh
+# Checks A, C and E on a file whose summed durations overflow 32 bits, on
+# every part and on the columnar conversion of the file
+#
+# Usage: tests/large.sh bin/lott [rows]
+
+LOTT=$(realpath "$1")
+ROWS=${2:-1500000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+export TZ=UTC
+
+# Durations 3000 to 5999 sum to over 2^32 from about a million rows, two
+# rows in five are from US
+mkdir "$DIR/data"
+awk -v rows="$ROWS" 'BEGIN {
+    split("US US DE FR JP", countries)
+    for (i = 0; i < rows; ++i) {
+        printf "%d,10.0.%d.%d,%d,%s\n", 1400000000 + i * 60, i % 250, i % 200,
+            3000 + i % 3000, countries[i % 5 + 1]
+    }
+}' > "$DIR/data/large.csv"
+EXPECTED_A=$(awk -F, '{ sum += $3 }
+    END { printf "Result: %f, large.csv", sum / NR }' "$DIR/data/large.csv")
+EXPECTED_C=$(awk -F, '!(strftime("%Y", $1) in years) {
+        years[strftime("%Y", $1)]; ++nyears
+    }
+    END { printf "Result: %f, large.csv", NR / nyears }' "$DIR/data/large.csv")
+EXPECTED_E=$(awk -F, '{ ++count[$4] }
+    END { printf "Result: %f, US", count["US"] }' "$DIR/data/large.csv")
+
+cd "$DIR" || exit 1
+FAILED=0
+check() {
+    EXPECTED=$1
+    shift
+    RESULT=$("$LOTT" "$@" | grep '^Result')
+    if [ "$RESULT" = "$EXPECTED" ]; then
+        echo "ok: lott $*$FROM"
+    else
+        echo "FAILED: lott $*$FROM: $RESULT, expected $EXPECTED"
+        FAILED=1
+    fi
+}
+
+for PART in 1 2 3 4 5; do
+    check "$EXPECTED_A" $PART A 2
+    check "$EXPECTED_C" $PART C 2
+    check "$EXPECTED_E" $PART E 2
+done
+"$LOTT" convert 1 > /dev/null
+FROM=" from columns"
+check "$EXPECTED_A" 2 A 2
+check "$EXPECTED_C" 2 C 2
+check "$EXPECTED_E" 2 E 2
+
+exit $FAILED